@@ -8,6 +8,7 @@ LOCAL_CFLAGS     += -DWILDMIDI_BUILD
 LOCAL_CFLAGS     += -fvisibility=hidden -DSYM_VISIBILITY
 
 LOCAL_SRC_FILES := \
+	src/chorus.c \
 	src/f_hmi.c \
 	src/f_hmp.c \
 	src/f_midi.c \
@@ -16,7 +17,10 @@ LOCAL_SRC_FILES := \
 	src/file_io.c \
 	src/gus_pat.c \
 	src/internal_midi.c \
+	src/live.c \
 	src/lock.c \
+	src/thread.c \
+	src/upsample.c \
 	src/mus2mid.c \
 	src/patches.c \
 	src/reverb.c \
@@ -61,6 +61,15 @@
 /* Define if you have the <inttypes.h> header file. */
 #define HAVE_INTTYPES_H
 
+/* Define if you have mmap() and madvise() */
+#define HAVE_MMAP
+
+/* Define if the compiler has the `__sync_bool_compare_and_swap' built-in function */
+#define HAVE___SYNC_BOOL_COMPARE_AND_SWAP
+
+/* Define if you have POSIX threads */
+#define HAVE_PTHREAD
+
 /* Define our audio drivers */
 /* #undef HAVE_LINUX_SOUNDCARD_H */
 /* #undef HAVE_SYS_SOUNDCARD_H */
@@ -0,0 +1,50 @@
+/*
+ * chorus.h - chorus effect for lib
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHORUS_H
+#define __CHORUS_H
+
+struct _chorus {
+    /* the send, delayed, a channel per buffer of buf_size */
+    int32_t *l_buf;
+    int32_t *r_buf;
+    int buf_size;
+    int pos;
+    /* delay of delay +- depth, in 1024ths of a sample */
+    int32_t delay;
+    int32_t depth;
+    /* triangle wave sweeping the delay, the right runs a quarter ahead */
+    uint32_t lfo;
+    uint32_t lfo_inc;
+    /* frames since the send had anything in it */
+    int quiet;
+};
+
+extern struct _chorus *_WM_init_chorus(int rate);
+extern void _WM_reset_chorus(struct _chorus *chorus);
+extern void _WM_seek_chorus(struct _chorus *chorus, uint32_t sample, uint32_t tempo_scale);
+extern void _WM_free_chorus(struct _chorus *chorus);
+extern void _WM_do_chorus(struct _chorus *chorus, int32_t *buffer, int32_t *send, int size);
+extern void _WM_do_chorus_mono(struct _chorus *chorus, int32_t *buffer, int32_t *send, int size);
+
+#endif /* __CHORUS_H */
@@ -40,10 +40,21 @@ extern float _WM_reverb_room_length; /* = 22.5f;   */
 
 extern float _WM_reverb_listen_posx; /* = 8.4375f; */
 extern float _WM_reverb_listen_posy; /* = 16.875f; */
+extern int _WM_reverb_type;         /* = RVB_ROOM; */
 
 extern void _cvt_reset_options (void);
 extern uint16_t _cvt_get_option (uint16_t tag);
 
+/*
+ * SIMD the build targets, for the few loops written with intrinsics.
+ * Each file includes the intrinsics header it needs itself.
+ */
+#if defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(_M_X64)
+#define WM_SSE2
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(WORDS_BIGENDIAN)
+#define WM_NEON
+#endif
+
 /* Set our global defines here */
 #ifndef M_PI
 #define M_PI  3.14159265358979323846
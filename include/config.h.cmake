@@ -61,6 +61,15 @@
 /* Define if you have the <inttypes.h> header file. */
 #cmakedefine HAVE_INTTYPES_H
 
+/* Define if you have mmap() and madvise() */
+#cmakedefine HAVE_MMAP
+
+/* Define if the compiler has the `__sync_bool_compare_and_swap' built-in function */
+#cmakedefine HAVE___SYNC_BOOL_COMPARE_AND_SWAP
+
+/* Define if you have POSIX threads */
+#cmakedefine HAVE_PTHREAD
+
 /* Define our audio drivers */
 #cmakedefine HAVE_LINUX_SOUNDCARD_H
 #cmakedefine HAVE_SYS_SOUNDCARD_H
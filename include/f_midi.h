@@ -24,7 +24,12 @@
 #ifndef __MIDI_H
 #define __MIDI_H
 
-extern struct _mdi *_WM_ParseNewMidi(uint8_t *midi_data, uint32_t midi_size);
+extern struct _mdi *_WM_ParseNewMidi(uint8_t *midi_data, uint32_t midi_size, struct _mdi *owner);
 extern int _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize);
+extern int _WM_ParseMidiAhead(struct _mdi *mdi, uint32_t sample);
+extern void _WM_WantMidiParse(struct _mdi *mdi, uint32_t sample);
+extern void _WM_WaitMidiParse(struct _mdi *mdi);
+extern void _WM_StopMidiParse(struct _mdi *mdi);
+extern void _WM_FreeMidiParse(struct _mdi *mdi);
 
 #endif /* __MIDI_H */
@@ -30,5 +30,26 @@ extern void *_WM_BufferFileImpl(const char *filename, uint32_t *size);
 extern void  _WM_FreeBufferFileImpl(void*);
 extern void * (*_WM_BufferFile)(const char *, uint32_t *);
 extern void   (*_WM_FreeBufferFile)(void*);
+extern void *_WM_BufferFileRO(const char *filename, uint32_t *size, int *mapped);
+extern void  _WM_FreeBufferFileRO(void *buf, uint32_t size, int mapped);
+
+struct _WM_VIO_Stream;
+extern void  _WM_SetStreamVIO(const struct _WM_VIO_Stream *callbacks);
+extern void *_WM_BufferFileStream(const char *filename, uint32_t *size);
+
+/* sequential reader for loaders that don't need the whole file at once */
+struct _WM_Reader {
+    const char *filename;
+    uint8_t *data;      /* the whole file, or the last read for streams */
+    uint32_t data_size; /* size of the read buffer for streams */
+    uint32_t size;
+    uint32_t pos;
+    void *stream;
+    int mapped;         /* data came from _WM_BufferFileRO() mapped */
+};
+
+extern int      _WM_ReaderOpen(struct _WM_Reader *rdr, const char *filename);
+extern uint8_t *_WM_ReaderGet(struct _WM_Reader *rdr, uint32_t len);
+extern void     _WM_ReaderClose(struct _WM_Reader *rdr);
 
 #endif /* __FILE_IO_H */
@@ -31,6 +31,9 @@ struct _channel {
     uint8_t volume;
     uint8_t pressure;
     uint8_t expression;
+    uint8_t reverb;
+    uint8_t chorus;
+    uint8_t brightness;
     int8_t  balance;
     int8_t  pan;
     int16_t left_adjust;
@@ -41,14 +44,10 @@ struct _channel {
     uint16_t reg_data;
     uint8_t reg_non;
     uint8_t isdrum;
-};
-
-struct _event_data {
-    uint8_t channel;
-    union Data {
-        uint32_t value;
-        char * string;
-    } data;
+    /* low pass set by brightness, lpf_b0 of 0 when it is open */
+    int32_t lpf_b0;
+    int32_t lpf_a1;
+    int32_t lpf_a2;
 };
 
 struct _note {
@@ -62,12 +61,21 @@ struct _note {
     uint8_t env;
     int32_t env_level;
     uint8_t modes;
+    uint8_t loop_reverse;
     uint8_t hold;
     uint8_t active;
     struct _note *replay;
     struct _note *next;
     uint32_t left_mix_volume;
     uint32_t right_mix_volume;
+    uint32_t reverb_send;
+    uint32_t chorus_send;
+    /* the channel's low pass, and where this note is in it */
+    int32_t lpf_b0;
+    int32_t lpf_a1;
+    int32_t lpf_a2;
+    int32_t lpf_x[2];
+    int32_t lpf_y[2];
     uint8_t is_off;
     uint8_t ignore_chan_events;
 };
@@ -97,6 +105,9 @@ enum _event_type {
     ev_control_channel_sound_off,
     ev_control_channel_controllers_off,
     ev_control_channel_notes_off,
+    ev_control_channel_reverb,
+    ev_control_channel_chorus,
+    ev_control_channel_brightness,
     ev_control_dummy,
     ev_patch,
     ev_channel_pressure,
@@ -122,14 +133,73 @@ enum _event_type {
     ev_meta_cuepoint
 };
 
+/*
+ * Events are kept small since long songs have a great many of them.
+ * The handler comes from _WM_do_event[evtype] and text events keep
+ * their string in mdi->strings, data.string being its offset there.
+ */
 struct _event {
-    enum _event_type evtype;
-    void (*do_event)(struct _mdi *mdi, struct _event_data *data);
-    struct _event_data event_data;
+    int8_t evtype; /* enum _event_type */
+    uint8_t channel;
+    union Data {
+        uint32_t value;
+        uint32_t string;
+    } data;
     uint32_t samples_to_next;
-    uint32_t samples_to_next_fixed;
 };
 
+typedef void (*_WM_do_event_t)(struct _mdi *mdi, struct _event *data);
+extern const _WM_do_event_t _WM_do_event[];
+
+/*
+ * Playback state at an event boundary, saved every CHECKPOINT_INTERVAL
+ * seconds so seeking only has to replay the events after the closest
+ * one instead of the whole song. They are taken while playing, not while
+ * parsing: the parsers only track the bank, patch and drum state, the
+ * rest of the channel state comes from running the events.
+ */
+struct _checkpoint {
+    uint32_t event; /* index of the next event to play */
+    uint32_t sample; /* current_sample at that event */
+    uint32_t lyric_event; /* last lyric before it, 0xffffffff if none */
+    uint32_t note; /* its notes in mdi->checkpoint_notes start here */
+    uint32_t note_count; /* 0xffffffff when the notes weren't being played */
+    struct _channel channel[16];
+};
+
+/* a sounding note and the note_table entry it goes back to */
+struct _checkpoint_note {
+    struct _note *slot;
+    struct _note note;
+};
+
+/*
+ * The tempo map is kept sorted by tick. sample and frac place tick
+ * exactly, frac being in divisions * 1000000ths of a sample.
+ */
+struct _tempo_change {
+    uint32_t tick;
+    uint32_t tempo; /* microseconds per quarter note */
+    uint32_t sample;
+    uint64_t frac;
+};
+
+#define TEMPO_SCALE_ONE 0x10000
+
+/* fraction bits of the low pass coefficients */
+#define LPF_BITS 24
+
+/* WildMidi_OpenAsync() handle states */
+#define WM_ASYNC_LOADING   1
+#define WM_ASYNC_FAILED    2
+#define WM_ASYNC_CANCELLED 3
+
+struct _midi_parse;
+struct _midi_parse_thread;
+struct _live;
+struct _chorus;
+struct _upsample;
+
 struct _mdi {
     int lock;
     uint32_t samples_to_mix;
@@ -137,6 +207,9 @@ struct _mdi {
     struct _event *current_event;
     uint32_t event_count;
     uint32_t events_size; /* try to stay optimally ahead to prevent reallocs */
+    char *strings; /* text event storage */
+    uint32_t strings_count;
+    uint32_t strings_size;
     struct _WM_Info extra_info;
     struct _WM_Info *tmp_info;
     uint16_t midi_master_vol;
@@ -149,9 +222,13 @@ struct _mdi {
     int16_t amp;
 
     int32_t *mix_buffer;
+    int32_t *reverb_buffer; /* the reverb send, mix_buffer_size long */
+    int32_t *chorus_buffer; /* the chorus send, mix_buffer_size long */
     uint32_t mix_buffer_size;
 
     struct _rvb *reverb;
+    struct _chorus *chorus; /* set up once a channel sends to it */
+    struct _upsample *upsample; /* WM_MO_HALF_RATE only */
 
     int32_t dyn_vol_peak;
     double dyn_vol_adjust;
@@ -160,7 +237,37 @@ struct _mdi {
 
     uint8_t is_type2;
 
-    char *lyric;
+    uint32_t lyric; /* in strings, 0xffffffff when there is none to read */
+    char *lyric_copy; /* handed out while the parse thread can move strings */
+
+    /* non-zero while WildMidi_OpenAsync() is still loading the file */
+    uint8_t async_state;
+
+    /* rest of the file still to be parsed, see WM_MO_INCREMENTAL */
+    struct _midi_parse *parse;
+    struct _midi_parse_thread *parse_thread;
+
+    struct _checkpoint *checkpoints;
+    uint32_t checkpoint_count;
+    uint32_t checkpoint_size;
+    uint32_t checkpoint_next; /* sample the next checkpoint is due at */
+    struct _checkpoint_note *checkpoint_notes;
+    uint32_t checkpoint_note_count;
+    uint32_t checkpoint_note_size;
+
+    struct _tempo_change *tempo_map;
+    uint32_t tempo_count;
+    uint32_t tempo_size;
+    uint32_t divisions;
+    uint32_t tempo_tick; /* tick the parsed song so far ends on */
+    uint32_t samples_stripped; /* lead in taken off by WM_MO_STRIPSILENCE */
+
+    /* playback speed, 16.16 fixed point, see WildMidi_SetTempoScale() */
+    uint32_t tempo_scale;
+    uint32_t tempo_scale_pos; /* song position past current_sample, in 1/65536ths */
+
+    /* events fed in as they happen, see WildMidi_OpenLive() */
+    struct _live *live;
 };
 
 
@@ -172,50 +279,53 @@ extern uint32_t _WM_freq_table[];
 /*
  * All "do" functions need to be "extern" for playback
  */
-extern void _WM_do_midi_divisions(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_note_off(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_note_on(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_aftertouch(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_bank_select(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_data_entry_course(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_channel_volume(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_channel_balance(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_channel_pan(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_channel_expression(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_data_entry_fine(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_channel_hold(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_data_increment(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_data_decrement(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_non_registered_param_fine(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_non_registered_param_course(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_registered_param_fine(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_registered_param_course(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_channel_sound_off(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_channel_controllers_off(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_channel_notes_off(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_control_dummy(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_patch(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_channel_pressure(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_pitch(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_sysex_roland_drum_track(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_sysex_gm_reset(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_sysex_roland_reset(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_sysex_yamaha_reset(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_endoftrack(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_tempo(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_timesignature(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_keysignature(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_sequenceno(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_channelprefix(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_portprefix(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_smpteoffset(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_text(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_copyright(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_trackname(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_instrumentname(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_lyric(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_marker(struct _mdi *mdi, struct _event_data *data);
-extern void _WM_do_meta_cuepoint(struct _mdi *mdi, struct _event_data *data);
+extern void _WM_do_midi_divisions(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_note_off(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_note_on(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_aftertouch(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_bank_select(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_data_entry_course(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_volume(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_balance(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_pan(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_expression(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_data_entry_fine(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_hold(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_data_increment(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_data_decrement(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_non_registered_param_fine(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_non_registered_param_course(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_registered_param_fine(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_registered_param_course(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_sound_off(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_controllers_off(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_notes_off(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_reverb(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_chorus(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_channel_brightness(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_control_dummy(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_patch(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_channel_pressure(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_pitch(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_sysex_roland_drum_track(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_sysex_gm_reset(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_sysex_roland_reset(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_sysex_yamaha_reset(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_endoftrack(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_tempo(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_timesignature(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_keysignature(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_sequenceno(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_channelprefix(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_portprefix(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_smpteoffset(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_text(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_copyright(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_trackname(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_instrumentname(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_lyric(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_marker(struct _mdi *mdi, struct _event *data);
+extern void _WM_do_meta_cuepoint(struct _mdi *mdi, struct _event *data);
 
 /*
  * We need to expose these fuctions for use on some or the parsers due to some
@@ -238,15 +348,28 @@ extern int _WM_midi_setup_divisions(struct _mdi *mdi, uint32_t divisions);
  * All other declarations
  */
 
-extern struct _mdi * _WM_initMDI(void);
+extern struct _mdi * _WM_initMDI(struct _mdi *owner);
 extern void _WM_freeMDI(struct _mdi *mdi);
+extern void _WM_discardMDI(struct _mdi *mdi, struct _mdi *owner);
+extern int _WM_AsyncCancelled(struct _mdi *owner);
 extern uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, uint8_t *event_data, uint32_t inlen, uint8_t running_event);
-extern void _WM_ResetToStart(struct _mdi *mdi);
+extern uint32_t _WM_MidiEventLength(const uint8_t *event_data, uint32_t inlen, uint8_t running_event);
+extern int _WM_ResetToStart(struct _mdi *mdi);
+extern int _WM_ReserveEvents(struct _mdi *mdi, uint32_t count);
+extern uint32_t _WM_GuessEvents(uint32_t size, uint32_t per_event);
+extern void _WM_ShrinkEvents(struct _mdi *mdi);
+extern void _WM_SaveCheckpoint(struct _mdi *mdi, struct _event *event, uint8_t notes);
+extern struct _checkpoint *_WM_FindCheckpoint(struct _mdi *mdi, uint32_t sample, uint32_t event);
+extern struct _event *_WM_RestoreCheckpoint(struct _mdi *mdi, struct _checkpoint *checkpoint, struct _event *from);
 extern void _WM_do_pan_adjust(struct _mdi *mdi, uint8_t ch);
 extern void _WM_do_note_off_extra(struct _note *nte);
 /* extern void _WM_DynamicVolumeAdjust(struct _mdi *mdi, int32_t *tmp_buffer, uint32_t buffer_used);*/
 extern void _WM_AdjustChannelVolumes(struct _mdi *mdi, uint8_t ch);
 extern float _WM_GetSamplesPerTick(uint32_t divisions, uint32_t tempo);
+extern int _WM_SetTempo(struct _mdi *mdi, uint32_t tempo);
+extern int _WM_AdvanceTicks(struct _mdi *mdi, uint32_t ticks);
+extern uint32_t _WM_TickToSample(struct _mdi *mdi, uint32_t tick);
+extern uint32_t _WM_SampleToTick(struct _mdi *mdi, uint32_t sample);
 
 #endif /* __INTERNAL_MIDI_H */
 
@@ -0,0 +1,58 @@
+/*
+ * live.h - live midi input queue for lib
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIVE_H
+#define __LIVE_H
+
+/* must be a power of 2 */
+#define LIVE_QUEUE_SIZE 1024
+
+struct _live_event {
+    uint32_t sample; /* output sample the event is due at */
+    uint32_t message; /* status, data 1 and data 2 from the low byte up */
+};
+
+/*
+ * Single producer, single consumer ring of live events. head and tail
+ * count up forever and are only ever written by one side each, the
+ * producer pushing and the render thread taking events off.
+ */
+struct _live {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t clock; /* output samples rendered so far */
+    /* setting up events runs ahead of playing them, so it keeps its own channels */
+    struct _channel channel[16];
+    /* the producer's own idea of the banks and drums, to load patches by */
+    uint8_t bank[16];
+    uint8_t isdrum[16];
+    int patch_lock; /* guards the handle's patch list between the two */
+    struct _live_event queue[LIVE_QUEUE_SIZE];
+};
+
+extern struct _live *_WM_NewLive(void);
+extern int _WM_LivePush(struct _live *live, uint32_t sample, uint32_t message);
+extern struct _live_event *_WM_LivePeek(struct _live *live);
+extern void _WM_LivePop(struct _live *live);
+
+#endif /* __LIVE_H */
@@ -53,5 +53,6 @@ extern int _WM_patch_lock;
 
 extern struct _patch *_WM_get_patch_data(struct _mdi *mdi, uint16_t patchid);
 extern void _WM_load_patch(struct _mdi *mdi, uint16_t patchid);
+extern void _WM_load_live_patch(struct _mdi *mdi, uint16_t patchid, int *lock);
 
 #endif /* __PATCHES_H */
@@ -25,13 +25,28 @@
 #ifndef __REVERB_H
 #define __REVERB_H
 
+/* 8 reflection points with 6 band filters each */
+#define RVB_FILTERS 48
+
+/* reverb_type in wildmidi.cfg */
+#define RVB_ROOM 0 /* model of the room, the default */
+#define RVB_FDN 1 /* feedback delay network, far cheaper */
+
+#define RVB_FDN_LINES 8
+
+/* wet output at or under this, with no input, counts as silence */
+#define RVB_QUIET 1
+
 struct _rvb {
-    /* filter data */
-    int32_t l_buf_flt_in[8][6][2];
-    int32_t l_buf_flt_out[8][6][2];
-    int32_t r_buf_flt_in[8][6][2];
-    int32_t r_buf_flt_out[8][6][2];
-    int32_t coeff[8][6][5];
+    /*
+     * filter data, laid out so all the filters of a channel run side by
+     * side. They share their input, so only one input history is kept.
+     */
+    int32_t coeff[5][RVB_FILTERS];
+    int32_t l_buf_flt_in[2];
+    int32_t r_buf_flt_in[2];
+    int32_t l_buf_flt_out[2][RVB_FILTERS];
+    int32_t r_buf_flt_out[2][RVB_FILTERS];
     /* buffer data */
     int32_t *l_buf;
     int32_t *r_buf;
@@ -45,11 +60,36 @@ struct _rvb {
     int r_in[4];
     int gain;
     uint32_t max_reverb_time;
+
+    int type;
+    /* RVB_FDN delay lines, fdn_size samples each */
+    int32_t *fdn_buf;
+    int fdn_size;
+    int fdn_pos;
+    int fdn_len[RVB_FDN_LINES];
+    int32_t fdn_gain[RVB_FDN_LINES]; /* feedback, in 1/32768ths */
+    int32_t fdn_lp[RVB_FDN_LINES]; /* damping filter state */
+
+    /*
+     * frames the reverb has gone without input while staying quiet, once
+     * this reaches quiet_max the tail is over and it is skipped
+     */
+    int quiet;
+    int quiet_max;
+
+    /* what it was set up with, to match pooled reverbs against */
+    int rate;
+    float room_x;
+    float room_y;
+    float listen_x;
+    float listen_y;
+    struct _rvb *next;
 };
 
 extern void _WM_reset_reverb (struct _rvb *rvb);
-extern struct _rvb *_WM_init_reverb(int rate, float room_x, float room_y, float listen_x, float listen_y);
+extern struct _rvb *_WM_init_reverb(int rate, float room_x, float room_y, float listen_x, float listen_y, int type);
 extern void _WM_free_reverb (struct _rvb *rvb);
+extern void _WM_free_reverb_pool (void);
 extern void _WM_do_reverb (struct _rvb *rvb, int32_t *buffer, int size);
 
 #endif /* __REVERB_H */
@@ -57,6 +57,8 @@ struct _sample {
     int32_t env_target[7];
     uint32_t inc_div;
     int16_t *data;
+    int16_t peak_min;
+    int16_t peak_max;
     struct _sample *next;
 
     uint32_t note_off_decay;
@@ -0,0 +1,42 @@
+/*
+ * thread.h - background worker threads for lib
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __THREAD_H
+#define __THREAD_H
+
+struct _WM_Thread;
+struct _WM_Signal;
+
+typedef void (*_WM_ThreadFunc)(void *arg);
+
+extern struct _WM_Thread *_WM_CreateThread(_WM_ThreadFunc func, void *arg);
+extern void _WM_JoinThread(struct _WM_Thread *thread);
+extern struct _WM_Signal *_WM_CreateSignal(void);
+extern void _WM_RaiseSignal(struct _WM_Signal *signal);
+extern void _WM_WaitSignal(struct _WM_Signal *signal);
+extern void _WM_FreeSignal(struct _WM_Signal *signal);
+extern void _WM_RunOnPool(_WM_ThreadFunc func, void *arg, int threads);
+extern void _WM_FreeThreadPool(void);
+extern int _WM_GetCPUCount(void);
+
+#endif /* __THREAD_H */
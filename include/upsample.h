@@ -0,0 +1,53 @@
+/*
+ * upsample.h - doubles the rate of the output for lib
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UPSAMPLE_H
+#define __UPSAMPLE_H
+
+/* taps either side of the point between two frames */
+#define UPS_TAPS 16
+/* frames kept back for the taps, the output runs this far behind */
+#define UPS_HIST ((UPS_TAPS * 2) - 1)
+
+struct _upsample {
+    int32_t coeff[UPS_TAPS]; /* in 1/16384ths */
+    int channels;
+    /* UPS_HIST frames of history then the frames to double, 16 bit */
+    int8_t *buf;
+    uint32_t buf_size;
+    /* the last output frame when there was no room for it, to go out next */
+    int16_t spare[2];
+    int have_spare;
+    /* silent frames fed in since the input ended, to push out the history */
+    uint32_t flushed;
+};
+
+extern struct _upsample *_WM_init_upsample(int channels);
+extern void _WM_reset_upsample(struct _upsample *ups);
+extern void _WM_free_upsample(struct _upsample *ups);
+extern int8_t *_WM_upsample_buffer(struct _upsample *ups, uint32_t size);
+extern uint32_t _WM_upsample_spare(struct _upsample *ups, int8_t *out);
+extern uint32_t _WM_upsample_flush(struct _upsample *ups, uint32_t size, uint32_t room);
+extern uint32_t _WM_do_upsample(struct _upsample *ups, int8_t *out, uint32_t size, uint32_t out_size);
+
+#endif /* __UPSAMPLE_H */
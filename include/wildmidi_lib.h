@@ -38,6 +38,9 @@
 #define WM_MO_ENHANCED_RESAMPLING 0x0002
 #define WM_MO_REVERB            0x0004
 #define WM_MO_LOOP              0x0008
+#define WM_MO_MONO              0x0200
+#define WM_MO_HALF_RATE         0x0400
+#define WM_MO_INCREMENTAL       0x0800
 #define WM_MO_SAVEASTYPE0       0x1000
 #define WM_MO_ROUNDTEMPO        0x2000
 #define WM_MO_STRIPSILENCE      0x4000
@@ -119,23 +122,70 @@ struct _WM_VIO {
     _WM_VIO_Free free_file;
 };
 
+typedef void *  (*_WM_VIO_Open)(const char *);
+typedef int32_t (*_WM_VIO_Read)(void *, void *, uint32_t);
+typedef int32_t (*_WM_VIO_Size)(void *);
+typedef void    (*_WM_VIO_Close)(void *);
+
+struct _WM_VIO_Stream {
+    /*
+    This function should open the requested file and return a
+    handle which is passed to the other functions, or NULL if
+    the file can not be opened.
+    */
+    _WM_VIO_Open open_file;
+
+    /*
+    This function should read up to size bytes from the current
+    position of the file into the buffer and return the number
+    of bytes read, 0 at the end of the file or -1 on error.
+    */
+    _WM_VIO_Read read_file;
+
+    /*
+    This function should return the size of the file in bytes,
+    or -1 on error.
+    */
+    _WM_VIO_Size size_file;
+
+    /*
+    This function should close the file handle.
+    */
+    _WM_VIO_Close close_file;
+};
+
+/*
+ Called from the loader thread when WildMidi_OpenAsync() has finished.
+ result is 0 when the handle is ready to play, or -1 if loading failed.
+ Not called at all if the handle was closed before loading finished.
+ */
+typedef void (*_WM_Async_Callback)(midi *handle, int result, void *user);
+
 WM_SYMBOL const char * WildMidi_GetString (uint16_t info);
 WM_SYMBOL long WildMidi_GetVersion (void);
 WM_SYMBOL int WildMidi_Init (const char *config_file, uint16_t rate, uint16_t mixer_options);
 WM_SYMBOL int WildMidi_InitVIO(struct _WM_VIO * callbacks, const char *config_file, uint16_t rate, uint16_t mixer_options);
+WM_SYMBOL int WildMidi_InitStreamVIO(struct _WM_VIO_Stream * callbacks, const char *config_file, uint16_t rate, uint16_t mixer_options);
 WM_SYMBOL int WildMidi_MasterVolume (uint8_t master_volume);
 WM_SYMBOL midi * WildMidi_Open (const char *midifile);
 WM_SYMBOL midi * WildMidi_OpenBuffer (uint8_t *midibuffer, uint32_t size);
+WM_SYMBOL midi * WildMidi_OpenAsync (const char *midifile, _WM_Async_Callback callback, void *user);
+WM_SYMBOL midi * WildMidi_OpenLive (void);
+WM_SYMBOL int WildMidi_Live (midi * handle, uint32_t midi_event, unsigned long int sample_pos);
 WM_SYMBOL int WildMidi_GetMidiOutput (midi *handle, int8_t **buffer, uint32_t *size);
 WM_SYMBOL int WildMidi_GetOutput (midi *handle, int8_t *buffer, uint32_t size);
 WM_SYMBOL int WildMidi_SetOption (midi *handle, uint16_t options, uint16_t setting);
+WM_SYMBOL int WildMidi_SetTempoScale (midi *handle, float factor);
 WM_SYMBOL int WildMidi_SetCvtOption (uint16_t tag, uint16_t setting);
 WM_SYMBOL int WildMidi_ConvertToMidi (const char *file, uint8_t **out, uint32_t *size);
 WM_SYMBOL int WildMidi_ConvertBufferToMidi (uint8_t *in, uint32_t insize,
                                             uint8_t **out, uint32_t *size);
 WM_SYMBOL struct _WM_Info * WildMidi_GetInfo (midi * handle);
 WM_SYMBOL int WildMidi_FastSeek (midi * handle, unsigned long int *sample_pos);
+WM_SYMBOL int WildMidi_SlowSeek (midi * handle, unsigned long int *sample_pos);
 WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong);
+WM_SYMBOL int WildMidi_TickToSample (midi * handle, unsigned long int tick, unsigned long int *sample_pos);
+WM_SYMBOL int WildMidi_SampleToTick (midi * handle, unsigned long int sample_pos, unsigned long int *tick);
 WM_SYMBOL int WildMidi_Close (midi * handle);
 WM_SYMBOL int WildMidi_Shutdown (void);
 WM_SYMBOL char * WildMidi_GetLyric (midi * handle);
@@ -144,13 +194,6 @@ WM_SYMBOL char * WildMidi_GetError (void);
 WM_SYMBOL void WildMidi_ClearError (void);
 
 
-/* NOTE: Not Yet Implemented Or Tested Properly */
-/* Due to delay in audio output in the player, this is not being developed
-   futher at the moment. Further Development will occur when output latency
-   has been reduced enough to "appear" instant.
-WM_SYMBOL int WildMidi_Live (midi * handle, uint32_t midi_event);
- */
-
 /* reserved for future coding
  * need to change these to use a time for cmd_pos and new_cmd_pos
 
@@ -20,3 +20,8 @@
 
 #define HAVE_STDINT_H 1
 #define HAVE_INTTYPES_H 1
+#define HAVE_MMAP 1
+#define HAVE_PTHREAD 1
+#if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1)
+#define HAVE___SYNC_BOOL_COMPARE_AND_SWAP 1
+#endif
@@ -0,0 +1,171 @@
+/*
+ * chorus.c - chorus effect for lib
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "chorus.h"
+
+/* delay swings from 9ms to 17ms and back a little faster than once a second */
+#define CHORUS_DELAY 0.013
+#define CHORUS_DEPTH 0.004
+#define CHORUS_RATE 0.6
+
+/* delay, in 1024ths of a sample, at this point of the lfo */
+static inline int32_t chorus_delay(struct _chorus *chorus, uint32_t lfo) {
+    uint32_t tri = (lfo & 0x80000000) ? ~lfo : lfo;
+    return (chorus->delay - chorus->depth
+            + (int32_t) (((int64_t) (tri >> 15) * (chorus->depth * 2)) >> 16));
+}
+
+/* the buffer, delay 1024ths of a sample back from pos */
+static inline int32_t chorus_tap(int32_t *buf, int mask, int pos, int32_t delay) {
+    int32_t ofs = (pos << 10) - delay;
+    int32_t a = buf[(ofs >> 10) & mask];
+    int32_t b = buf[((ofs >> 10) + 1) & mask];
+    return (a + (((b - a) * (ofs & 1023)) / 1024));
+}
+
+void _WM_reset_chorus(struct _chorus *chorus) {
+    if (!chorus) return;
+    memset(chorus->l_buf, 0, (chorus->buf_size * sizeof(int32_t)));
+    memset(chorus->r_buf, 0, (chorus->buf_size * sizeof(int32_t)));
+    chorus->pos = 0;
+    chorus->lfo = 0;
+    chorus->quiet = chorus->buf_size;
+}
+
+/*
+ For a seek to sample, of a song running tempo_scale / 65536 samples
+ for each output frame. What was delayed is gone, but the sweep is put
+ where playing through at that tempo would have left it, the sweep
+ moving on with the frames rather than with the song.
+ */
+void _WM_seek_chorus(struct _chorus *chorus, uint32_t sample, uint32_t tempo_scale) {
+    uint64_t frames;
+
+    if (!chorus) return;
+    _WM_reset_chorus(chorus);
+    frames = ((uint64_t) sample << 16) / tempo_scale;
+    chorus->pos = (int) (frames & (uint64_t) (chorus->buf_size - 1));
+    chorus->lfo = (uint32_t) (chorus->lfo_inc * frames);
+}
+
+struct _chorus *_WM_init_chorus(int rate) {
+    struct _chorus *chorus = (struct _chorus *) calloc(1, sizeof(struct _chorus));
+    int max_delay = (int) ((double) rate * (CHORUS_DELAY + CHORUS_DEPTH)) + 2;
+
+    if (chorus == NULL) {
+        return NULL;
+    }
+    chorus->buf_size = 1;
+    while (chorus->buf_size < max_delay) {
+        chorus->buf_size <<= 1;
+    }
+    chorus->l_buf = (int32_t *) malloc(chorus->buf_size * sizeof(int32_t));
+    chorus->r_buf = (int32_t *) malloc(chorus->buf_size * sizeof(int32_t));
+    if ((chorus->l_buf == NULL) || (chorus->r_buf == NULL)) {
+        _WM_free_chorus(chorus);
+        return NULL;
+    }
+    chorus->delay = (int32_t) ((double) rate * CHORUS_DELAY * 1024.0);
+    chorus->depth = (int32_t) ((double) rate * CHORUS_DEPTH * 1024.0);
+    chorus->lfo_inc = (uint32_t) (CHORUS_RATE / (double) rate * 4294967296.0);
+
+    _WM_reset_chorus(chorus);
+    return chorus;
+}
+
+void _WM_free_chorus(struct _chorus *chorus) {
+    if (!chorus) return;
+    free(chorus->l_buf);
+    free(chorus->r_buf);
+    free(chorus);
+}
+
+/*
+ Delays the send, with the delay swept back and forth, and adds it to
+ buffer, size samples of channels interleaved. The cost is the same
+ however many midi channels send to it. In stereo each side has its
+ own buffer and tap. In mono the send is the same on both sides, so one
+ buffer does and both taps are averaged.
+ */
+static inline void chorus_run(struct _chorus *chorus, int32_t *buffer, int32_t *send,
+                              int size, const int channels) {
+    int i;
+    int mask = chorus->buf_size - 1;
+    int pos = chorus->pos;
+    int quiet = chorus->quiet;
+    int frames = size / channels;
+    uint32_t lfo = chorus->lfo;
+    int32_t *r_buf = (channels == 2) ? chorus->r_buf : chorus->l_buf;
+    int32_t l_tap;
+    int32_t r_tap;
+
+    if (quiet >= chorus->buf_size) {
+        /* all that is delayed is silence, only the time moves on */
+        for (i = 0; i < size; i++) {
+            if (send[i] != 0)
+                break;
+        }
+        if (i == size) {
+            chorus->pos = (pos + frames) & mask;
+            chorus->lfo = lfo + (chorus->lfo_inc * (uint32_t) frames);
+            return;
+        }
+    }
+
+    for (i = 0; i < size; i += channels) {
+        chorus->l_buf[pos] = send[i];
+        r_buf[pos] = send[i + channels - 1];
+        quiet = (send[i] | send[i + channels - 1]) ? 0 : (quiet + 1);
+
+        l_tap = chorus_tap(chorus->l_buf, mask, pos, chorus_delay(chorus, lfo)) / 2;
+        r_tap = chorus_tap(r_buf, mask, pos, chorus_delay(chorus, (lfo + 0x40000000))) / 2;
+        if (channels == 2) {
+            buffer[i] += l_tap;
+            buffer[i + 1] += r_tap;
+        } else {
+            buffer[i] += (l_tap + r_tap) / 2;
+        }
+
+        pos = (pos + 1) & mask;
+        lfo += chorus->lfo_inc;
+    }
+    chorus->pos = pos;
+    chorus->lfo = lfo;
+    chorus->quiet = quiet;
+}
+
+void _WM_do_chorus(struct _chorus *chorus, int32_t *buffer, int32_t *send, int size) {
+    chorus_run(chorus, buffer, send, size, 2);
+}
+
+/* As _WM_do_chorus for WM_MO_MONO, buffer and send a channel only */
+void _WM_do_chorus_mono(struct _chorus *chorus, int32_t *buffer, int32_t *send, int size) {
+    chorus_run(chorus, buffer, send, size, 1);
+}
@@ -39,7 +39,7 @@
  Turns hmp file data into an event stream
  */
 struct _mdi *
-_WM_ParseNewHmi(uint8_t *hmi_data, uint32_t hmi_size) {
+_WM_ParseNewHmi(uint8_t *hmi_data, uint32_t hmi_size, struct _mdi *owner) {
     uint32_t hmi_tmp = 0;
     uint8_t *hmi_base = hmi_data;
     uint8_t *data_end = hmi_data + hmi_size;
@@ -64,12 +64,6 @@ _WM_ParseNewHmi(uint8_t *hmi_data, uint32_t hmi_size) {
     uint32_t smallest_delta = 0;
     uint32_t subtract_delta = 0;
 
-    uint32_t sample_count = 0;
-    float sample_count_f = 0;
-    float sample_remainder = 0;
-
-    float samples_per_delta_f = 0;
-
     struct _note {
         uint32_t length;
         uint8_t channel;
@@ -107,18 +101,22 @@ _WM_ParseNewHmi(uint8_t *hmi_data, uint32_t hmi_size) {
         return NULL;
     }
 
-    hmi_mdi = _WM_initMDI();
-
-    _WM_midi_setup_divisions(hmi_mdi, hmi_division);
+    hmi_mdi = _WM_initMDI(owner);
+    if (_WM_ReserveEvents(hmi_mdi, _WM_GuessEvents(hmi_size, 3)) == -1) {
+        _WM_discardMDI(hmi_mdi, owner);
+        return NULL;
+    }
 
     if ((_WM_MixerOptions & WM_MO_ROUNDTEMPO)) {
         tempo_f = (float) (60000000 / hmi_bpm) + 0.5f;
     } else {
         tempo_f = (float) (60000000 / hmi_bpm);
     }
-    samples_per_delta_f = _WM_GetSamplesPerTick(hmi_division, (uint32_t)tempo_f);
-
-    _WM_midi_setup_tempo(hmi_mdi, (uint32_t)tempo_f);
+    if ((_WM_midi_setup_divisions(hmi_mdi, hmi_division) == -1)
+     || (_WM_midi_setup_tempo(hmi_mdi, (uint32_t)tempo_f) == -1)) {
+        _WM_discardMDI(hmi_mdi, owner);
+        return NULL;
+    }
 
     hmi_track_offset = (uint32_t *) malloc(sizeof(uint32_t) * hmi_track_cnt);
     hmi_track_header_length = (uint32_t *) malloc(sizeof(uint32_t) * hmi_track_cnt);
@@ -200,22 +198,14 @@ _WM_ParseNewHmi(uint8_t *hmi_data, uint32_t hmi_size) {
         goto _hmi_end;
     }
 
-    if ((float)smallest_delta >= 0x7fffffff / samples_per_delta_f) {
-        //DEBUG
-        //fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n",
-        //        samples_per_delta_f, smallest_delta);
-        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, NULL, 0);
+    if (_WM_SetTempo(hmi_mdi, (uint32_t)tempo_f) < 0) {
         goto _hmi_end;
     }
 
     subtract_delta = smallest_delta;
-    sample_count_f= (((float) smallest_delta * samples_per_delta_f) + sample_remainder);
-
-    sample_count = (uint32_t) sample_count_f;
-    sample_remainder = sample_count_f - (float) sample_count;
-
-    hmi_mdi->events[hmi_mdi->event_count - 1].samples_to_next += sample_count;
-    hmi_mdi->extra_info.approx_total_samples += sample_count;
+    if (_WM_AdvanceTicks(hmi_mdi, smallest_delta) < 0) {
+        goto _hmi_end;
+    }
 
     while (hmi_tracks_ended < hmi_track_cnt) {
         smallest_delta = 0;
@@ -232,7 +222,9 @@ _WM_ParseNewHmi(uint8_t *hmi_data, uint32_t hmi_size) {
                             smallest_delta = note[hmi_tmp].length;
                         }
                     } else {
-                        _WM_midi_setup_noteoff(hmi_mdi, note[hmi_tmp].channel, j, 0);
+                        if (_WM_midi_setup_noteoff(hmi_mdi, note[hmi_tmp].channel, j, 0) == -1) {
+                            goto _hmi_end;
+                        }
                     }
                 }
             }
@@ -287,7 +279,9 @@ _WM_ParseNewHmi(uint8_t *hmi_data, uint32_t hmi_size) {
                         for(j = 0; j < 128; j++) {
                             hmi_tmp = (128 * i) + j;
                             if (note[hmi_tmp].length) {
-                                _WM_midi_setup_noteoff(hmi_mdi, note[hmi_tmp].channel, j, 0);
+                                if (_WM_midi_setup_noteoff(hmi_mdi, note[hmi_tmp].channel, j, 0) == -1) {
+                                    goto _hmi_end;
+                                }
                                 note[hmi_tmp].length = 0;
                             }
                         }
@@ -343,7 +337,9 @@ _WM_ParseNewHmi(uint8_t *hmi_data, uint32_t hmi_size) {
                                 smallest_delta = note[hmi_tmp].length;
                             }
                         } else {
-                            _WM_midi_setup_noteoff(hmi_mdi, note[hmi_tmp].channel, j, 0);
+                            if (_WM_midi_setup_noteoff(hmi_mdi, note[hmi_tmp].channel, j, 0) == -1) {
+                                goto _hmi_end;
+                            }
                         }
 
                     } else {
@@ -383,24 +379,16 @@ _WM_ParseNewHmi(uint8_t *hmi_data, uint32_t hmi_size) {
         }
 
         // convert smallest delta to samples till next
-        if ((float)smallest_delta >= 0x7fffffff / samples_per_delta_f) {
-            //DEBUG
-            //fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n",
-            //        samples_per_delta_f, smallest_delta);
-            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, NULL, 0);
+        subtract_delta = smallest_delta;
+        if (_WM_AdvanceTicks(hmi_mdi, smallest_delta) < 0) {
+            goto _hmi_end;
+        }
+        if (_WM_AsyncCancelled(owner)) {
             goto _hmi_end;
         }
-        subtract_delta = smallest_delta;
-        sample_count_f= (((float) smallest_delta * samples_per_delta_f) + sample_remainder);
-
-        sample_count = (uint32_t) sample_count_f;
-        sample_remainder = sample_count_f - (float) sample_count;
-
-        hmi_mdi->events[hmi_mdi->event_count - 1].samples_to_next += sample_count;
-        hmi_mdi->extra_info.approx_total_samples += sample_count;
     }
 
-    if ((hmi_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy)) == NULL) {
+    if ((hmi_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy, _WM_reverb_type)) == NULL) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
         goto _hmi_end;
     }
@@ -410,7 +398,11 @@ _WM_ParseNewHmi(uint8_t *hmi_data, uint32_t hmi_size) {
     hmi_mdi->samples_to_mix = 0;
     hmi_mdi->note = NULL;
 
-    _WM_ResetToStart(hmi_mdi);
+    _WM_ShrinkEvents(hmi_mdi);
+    if (_WM_ResetToStart(hmi_mdi) == -1) {
+        _WM_free_reverb(hmi_mdi->reverb);
+        hmi_mdi->reverb = NULL;
+    }
 
 _hmi_end:
     free(hmi_track_offset);
@@ -421,6 +413,6 @@ _hmi_end:
     free(hmi_running_event);
 
     if (hmi_mdi->reverb) return (hmi_mdi);
-    _WM_freeMDI(hmi_mdi);
+    _WM_discardMDI(hmi_mdi, owner);
     return 0;
 }
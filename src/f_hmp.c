@@ -39,7 +39,7 @@
  Turns hmp file data into an event stream
  */
 struct _mdi *
-_WM_ParseNewHmp(uint8_t *hmp_data, uint32_t hmp_size) {
+_WM_ParseNewHmp(uint8_t *hmp_data, uint32_t hmp_size, struct _mdi *owner) {
     uint8_t is_hmp2 = 0;
     uint32_t zero_cnt = 0;
     uint32_t i = 0;
@@ -63,11 +63,6 @@ _WM_ParseNewHmp(uint8_t *hmp_data, uint32_t hmp_size) {
     uint32_t var_len_shift = 0;
 
     float tempo_f = 500000.0f;
-    float samples_per_delta_f = 0;
-
-    uint32_t sample_count = 0;
-    float sample_count_f = 0;
-    float sample_remainder = 0;
 
     if (hmp_size < 776) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, "file too short", 0);
@@ -160,11 +155,6 @@ _WM_ParseNewHmp(uint8_t *hmp_data, uint32_t hmp_size) {
         tempo_f = (float) (60000000 / hmp_bpm);
     }
 
-    samples_per_delta_f = _WM_GetSamplesPerTick(hmp_divisions, (uint32_t) tempo_f);
-
-    //DEBUG
-    //fprintf(stderr, "DEBUG: Samples Per Delta Tick: %f\r\n",samples_per_delta_f);
-
     // FIXME: This value is incorrect
     hmp_song_time = *hmp_data++;
     hmp_song_time += (*hmp_data++ << 8);
@@ -185,10 +175,17 @@ _WM_ParseNewHmp(uint8_t *hmp_data, uint32_t hmp_size) {
         hmp_size -= 712;
     }
 
-    hmp_mdi = _WM_initMDI();
+    hmp_mdi = _WM_initMDI(owner);
+    if (_WM_ReserveEvents(hmp_mdi, _WM_GuessEvents(hmp_size, 3)) == -1) {
+        _WM_discardMDI(hmp_mdi, owner);
+        return NULL;
+    }
 
-    _WM_midi_setup_divisions(hmp_mdi, hmp_divisions);
-    _WM_midi_setup_tempo(hmp_mdi, (uint32_t)tempo_f);
+    if ((_WM_midi_setup_divisions(hmp_mdi, hmp_divisions) == -1)
+     || (_WM_midi_setup_tempo(hmp_mdi, (uint32_t)tempo_f) == -1)) {
+        _WM_discardMDI(hmp_mdi, owner);
+        return NULL;
+    }
 
     hmp_chunk = (uint8_t **) malloc(sizeof(uint8_t *) * hmp_chunks);
     chunk_length = (uint32_t *) malloc(sizeof(uint32_t) * hmp_chunks);
@@ -262,22 +259,15 @@ _WM_ParseNewHmp(uint8_t *hmp_data, uint32_t hmp_size) {
         goto _hmp_end;
     }
 
-    if ((float)smallest_delta >= 0x7fffffff / samples_per_delta_f) {
-        //DEBUG
-        //fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n",
-        //        samples_per_delta_f, smallest_delta);
-        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, NULL, 0);
+    /* tempo changes in the file don't change its timing */
+    if (_WM_SetTempo(hmp_mdi, (uint32_t)tempo_f) < 0) {
         goto _hmp_end;
     }
 
     subtract_delta = smallest_delta;
-    sample_count_f = (((float) smallest_delta * samples_per_delta_f) + sample_remainder);
-
-    sample_count = (uint32_t) sample_count_f;
-    sample_remainder = sample_count_f - (float) sample_count;
-
-    hmp_mdi->events[hmp_mdi->event_count - 1].samples_to_next += sample_count;
-    hmp_mdi->extra_info.approx_total_samples += sample_count;
+    if (_WM_AdvanceTicks(hmp_mdi, smallest_delta) < 0) {
+        goto _hmp_end;
+    }
 
     while (end_of_chunks < hmp_chunks) {
         smallest_delta = 0;
@@ -357,28 +347,19 @@ _WM_ParseNewHmp(uint8_t *hmp_data, uint32_t hmp_size) {
         NEXT_CHUNK: continue;
         }
 
-        if ((float)smallest_delta >= 0x7fffffff / samples_per_delta_f) {
-            //DEBUG
-            //fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n",
-            //        samples_per_delta_f, smallest_delta);
-            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, NULL, 0);
+        subtract_delta = smallest_delta;
+        if (_WM_AdvanceTicks(hmp_mdi, smallest_delta) < 0) {
+            goto _hmp_end;
+        }
+        if (_WM_AsyncCancelled(owner)) {
             goto _hmp_end;
         }
-
-        subtract_delta = smallest_delta;
-        sample_count_f= (((float) smallest_delta * samples_per_delta_f) + sample_remainder);
-
-        sample_count = (uint32_t) sample_count_f;
-        sample_remainder = sample_count_f - (float) sample_count;
-
-        hmp_mdi->events[hmp_mdi->event_count - 1].samples_to_next += sample_count;
-        hmp_mdi->extra_info.approx_total_samples += sample_count;
 
         // DEBUG
         // fprintf(stderr,"DEBUG: Sample Count %u\r\n",sample_count);
     }
 
-    if ((hmp_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy)) == NULL) {
+    if ((hmp_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy, _WM_reverb_type)) == NULL) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
         goto _hmp_end;
     }
@@ -388,7 +369,11 @@ _WM_ParseNewHmp(uint8_t *hmp_data, uint32_t hmp_size) {
     hmp_mdi->samples_to_mix = 0;
     hmp_mdi->note = NULL;
 
-    _WM_ResetToStart(hmp_mdi);
+    _WM_ShrinkEvents(hmp_mdi);
+    if (_WM_ResetToStart(hmp_mdi) == -1) {
+        _WM_free_reverb(hmp_mdi->reverb);
+        hmp_mdi->reverb = NULL;
+    }
 
 _hmp_end:
     free(hmp_chunk);
@@ -397,6 +382,6 @@ _hmp_end:
     free(chunk_ofs);
     free(chunk_end);
     if (hmp_mdi->reverb) return (hmp_mdi);
-    _WM_freeMDI(hmp_mdi);
+    _WM_discardMDI(hmp_mdi, owner);
     return NULL;
 }
@@ -33,34 +33,483 @@
 #include "f_midi.h"
 #include "wildmidi_lib.h"
 #include "internal_midi.h"
+#include "lock.h"
 #include "reverb.h"
 #include "sample.h"
+#include "thread.h"
 
 
+/*
+ * Type 1 tracks are first decoded into a list of events each, which
+ * is then merged in tick order. Only the byte level work is done while
+ * decoding, setting up the events themselves has to happen in merge
+ * order as it tracks channel and patch state across all tracks.
+ */
+struct _track_event {
+    uint32_t offset;        /* of the event within the track data */
+    uint32_t delta;         /* ticks until the next event on the track */
+    uint8_t running_event;  /* running status to set the event up with */
+    uint8_t flags;
+};
+
+/* the track ends before the delta following this event */
+#define TRACK_EVENT_SHORT 0x01
+
+struct _track_decode {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t pos;           /* where decoding carries on from */
+    uint8_t running_event;
+    struct _track_event *events;
+    uint32_t events_size;
+    uint32_t count;
+    uint32_t next;
+};
+
+struct _track_decode_job {
+    struct _track_decode *tracks;
+    uint32_t count;
+    uint32_t next;
+    int lock;
+    int failed;
+};
+
+/*
+ * State of a type 1 merge. It stays with the song while WM_MO_INCREMENTAL
+ * has the rest of the merge left for playback to catch up with.
+ */
+struct _midi_parse {
+    uint8_t *data;          /* our copy of the tracks when incremental */
+    struct _track_decode *decode;
+    uint32_t no_tracks;
+    uint32_t *track_tick;
+    uint32_t *track_heap;
+    uint32_t heap_count;
+    uint32_t current_tick;
+    struct _channel channel[16];
+    struct _mdi *owner;     /* handle of an async load, see _WM_AsyncCancelled */
+};
+
+/*
+ * Thread keeping a WM_MO_INCREMENTAL song parsed ahead of playback, so
+ * WildMidi_GetOutput() only has to play what is already there. It quits
+ * once the parse is done.
+ */
+struct _midi_parse_thread {
+    struct _WM_Thread *thread;
+    struct _WM_Signal *start;   /* more of the song is wanted */
+    struct _WM_Signal *done;    /* a step of the parse has finished */
+    struct _mdi *mdi;
+    uint32_t sample;            /* parse a second past this, under mdi->lock */
+    int quit;
+    int lock;                   /* for quit */
+};
+
+/* files at least this big have their tracks decoded on several threads */
+#define PARALLEL_DECODE_SIZE 0x20000
+#define MAX_DECODE_THREADS 16
+
+/* events decoded per track at a time when parsing incrementally */
+#define DECODE_CHUNK 64
+
+/*
+ * Walk a track the same way the merge used to, stopping at the end of
+ * track or at the first event _WM_SetupMidiEvent would reject, which is
+ * left for the merge to report. At most max events are decoded, the
+ * next call picks up from there once the merge has used them up.
+ */
+static int
+decode_track(struct _track_decode *track, uint32_t max) {
+    uint8_t *data = &track->data[track->pos];
+    uint32_t size = track->size - track->pos;
+    uint8_t running_event = track->running_event;
+    struct _track_event *event;
+    uint32_t event_size;
+    uint32_t delta;
+
+    track->count = 0;
+    track->next = 0;
+    if (track->events == NULL) {
+        track->events_size = (track->size / 3) + 4;
+        if (track->events_size > max) track->events_size = max;
+        track->events = (struct _track_event *) malloc(sizeof(struct _track_event) * track->events_size);
+        if (track->events == NULL) return (-1);
+    }
+
+    while (track->count < max) {
+        if (track->count == track->events_size) {
+            struct _track_event *events;
+            uint32_t events_size = track->events_size + (track->events_size >> 1) + 4;
+            events = (struct _track_event *) realloc(track->events, sizeof(struct _track_event) * events_size);
+            if (events == NULL) return (-1);
+            track->events = events;
+            track->events_size = events_size;
+        }
+        event = &track->events[track->count++];
+        event->offset = (uint32_t) (data - track->data);
+        event->delta = 0;
+        event->running_event = running_event;
+        event->flags = 0;
+
+        event_size = _WM_MidiEventLength(data, size, running_event);
+        if (event_size == 0) break;
+        if (data[0] > 0x7f) {
+            if (data[0] < 0xf0) {
+                /* Events 0x80 - 0xef set running event */
+                running_event = data[0];
+            } else if ((data[0] == 0xf0) || (data[0] == 0xf7)) {
+                /* Sysex resets running event */
+                running_event = 0;
+            } else if ((data[0] == 0xff) && (data[1] == 0x2f) && (data[2] == 0x00)) {
+                /* End of Track */
+                break;
+            }
+        }
+        data += event_size;
+        size -= event_size;
+
+        delta = 0;
+        while (size && (*data > 0x7f)) {
+            delta = (delta << 7) + (*data & 0x7F);
+            data++;
+            size--;
+        }
+        if (!size) {
+            event->flags |= TRACK_EVENT_SHORT;
+            break;
+        }
+        event->delta = (delta << 7) + (*data & 0x7F);
+        data++;
+        size--;
+    }
+    track->pos = (uint32_t) (data - track->data);
+    track->running_event = running_event;
+    return (0);
+}
+
+static void
+decode_tracks(void *arg) {
+    struct _track_decode_job *job = (struct _track_decode_job *) arg;
+    uint32_t i;
+
+    for (;;) {
+        _WM_Lock(&job->lock);
+        i = job->next;
+        if (i < job->count) job->next++;
+        _WM_Unlock(&job->lock);
+        if (i >= job->count) break;
+
+        if (decode_track(&job->tracks[i], 0xffffffff) < 0) {
+            _WM_Lock(&job->lock);
+            job->failed = 1;
+            _WM_Unlock(&job->lock);
+        }
+    }
+}
+
+/*
+ * Sift a type 1 track down the merge heap. Ticks are compared relative to
+ * the current tick so that the absolute tick counter is free to wrap.
+ */
+static void
+track_heap_down(uint32_t *heap, uint32_t count, uint32_t pos,
+                const uint32_t *tick, uint32_t now) {
+    uint32_t track = heap[pos];
+    uint32_t delta = tick[track] - now;
+    uint32_t child;
+    uint32_t child_delta;
+
+    while ((child = (pos << 1) + 1) < count) {
+        child_delta = tick[heap[child]] - now;
+        if (child + 1 < count) {
+            uint32_t right_delta = tick[heap[child + 1]] - now;
+            if ((right_delta < child_delta) ||
+                ((right_delta == child_delta) && (heap[child + 1] < heap[child]))) {
+                child++;
+                child_delta = right_delta;
+            }
+        }
+        if ((delta < child_delta) ||
+            ((delta == child_delta) && (track < heap[child]))) {
+            break;
+        }
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = track;
+}
+
+static void
+free_midi_parse(struct _midi_parse *parse) {
+    uint32_t i;
+
+    if (parse == NULL) return;
+    if (parse->decode) {
+        for (i = 0; i < parse->no_tracks; i++) {
+            free(parse->decode[i].events);
+        }
+        free(parse->decode);
+    }
+    free(parse->track_heap);
+    free(parse->track_tick);
+    free(parse->data);
+    free(parse);
+}
+
+/*
+ * Merge the tracks through a min-heap keyed on the tick of each track's
+ * next event, ties going to the lower track number so the events come
+ * out in the same order as a track-by-track scan.
+ *
+ * Stops at the first tick boundary past until samples.
+ * returns 1 if there is more to merge, 0 when done and -1 on error
+ * or when the async load it is for has been cancelled.
+ */
+static int
+midi_merge_tracks(struct _mdi *mdi, struct _midi_parse *parse, uint32_t until) {
+    struct _track_decode *track;
+    struct _track_event *event;
+    uint8_t *event_data;
+    uint32_t setup_ret;
+    uint32_t delta;
+    uint32_t smallest_delta;
+    uint32_t tempo;
+    uint32_t i;
+
+    while (parse->heap_count) {
+        i = parse->track_heap[0];
+        track = &parse->decode[i];
+        do {
+            if ((track->next == track->count) && (decode_track(track, DECODE_CHUNK) < 0)) {
+                _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
+                return (-1);
+            }
+            event = &track->events[track->next++];
+            event_data = &track->data[event->offset];
+            setup_ret = _WM_SetupMidiEvent(mdi, event_data, track->size - event->offset, event->running_event);
+            if (setup_ret == 0) {
+                return (-1);
+            }
+            if ((event_data[0] == 0xff) && (event_data[1] == 0x2f) && (event_data[2] == 0x00)) {
+                /* End of Track, its decoded events aren't needed any more */
+                free(track->events);
+                track->events = NULL;
+                parse->track_heap[0] = parse->track_heap[--parse->heap_count];
+                goto NEXT_TRACK;
+            } else if ((event_data[0] == 0xff) && (event_data[1] == 0x51) && (event_data[2] == 0x03)) {
+                /* Tempo */
+                tempo = (event_data[3] << 16) + (event_data[4] << 8)+ event_data[5];
+                if (!tempo)
+                    tempo = 500000;
+
+                if (_WM_SetTempo(mdi, tempo) < 0) {
+                    return (-1);
+                }
+            }
+            if (event->flags & TRACK_EVENT_SHORT) {
+                _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, "(too short)", 0);
+                return (-1);
+            }
+            delta = event->delta;
+        } while (!delta);
+        parse->track_tick[i] = parse->current_tick + delta;
+
+    NEXT_TRACK:
+        track_heap_down(parse->track_heap, parse->heap_count, 0, parse->track_tick, parse->current_tick);
+        if ((parse->heap_count) && (parse->track_tick[parse->track_heap[0]] == parse->current_tick)) {
+            /* another track has events on this tick */
+            continue;
+        }
+
+        smallest_delta = (parse->heap_count) ? (parse->track_tick[parse->track_heap[0]] - parse->current_tick) : 0;
+        if (_WM_AdvanceTicks(mdi, smallest_delta) < 0) {
+            return (-1);
+        }
+        parse->current_tick += smallest_delta;
+
+        if ((parse->heap_count) && (mdi->extra_info.approx_total_samples > until)) {
+            return (1);
+        }
+        if (_WM_AsyncCancelled(parse->owner)) {
+            return (-1);
+        }
+    }
+    return (0);
+}
+
+/*
+ * Carry on an incremental parse until the song is known a second past
+ * sample, or to the end. Anything the parse runs into ends the song at
+ * that point, the error is left for WildMidi_GetError().
+ *
+ * Must be called with the song locked, before anything has picked up
+ * pointers into the event or string pools.
+ */
+int
+_WM_ParseMidiAhead(struct _mdi *mdi, uint32_t sample) {
+    struct _midi_parse *parse = mdi->parse;
+    struct _channel channel[16];
+    uint32_t current_event;
+    uint32_t until;
+    int ret;
+
+    if (parse == NULL) return (0);
+    if (sample > (0xffffffff - _WM_SampleRate)) {
+        until = 0xffffffff;
+    } else {
+        until = sample + _WM_SampleRate;
+    }
+    if (mdi->extra_info.approx_total_samples > until) return (0);
+
+    current_event = (uint32_t) (mdi->current_event - mdi->events);
+
+    /* the parse keeps its own channel state, which playback must not see */
+    memcpy(channel, mdi->channel, sizeof(channel));
+    memcpy(mdi->channel, parse->channel, sizeof(channel));
+    ret = midi_merge_tracks(mdi, parse, until);
+    memcpy(parse->channel, mdi->channel, sizeof(channel));
+    memcpy(mdi->channel, channel, sizeof(channel));
+
+    /* Ensure last event is NULL, keeping only what fits if we can't */
+    if (_WM_ReserveEvents(mdi, mdi->event_count) == -1) {
+        mdi->event_count = mdi->events_size - 1;
+        ret = -1;
+    }
+    if (ret <= 0) {
+        free_midi_parse(parse);
+        mdi->parse = NULL;
+    }
+
+    mdi->events[mdi->event_count].evtype = ev_null;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = 0;
+    mdi->events[mdi->event_count].samples_to_next = 0;
+    if (mdi->parse == NULL) {
+        _WM_ShrinkEvents(mdi);
+    }
+
+    mdi->current_event = &mdi->events[current_event];
+
+    return ((ret < 0) ? -1 : 0);
+}
+
+static void
+midi_parse_thread(void *arg) {
+    struct _midi_parse_thread *parse_thread = (struct _midi_parse_thread *) arg;
+    struct _mdi *mdi = parse_thread->mdi;
+    int more = 1;
+
+    while (more) {
+        _WM_WaitSignal(parse_thread->start);
+        _WM_Lock(&parse_thread->lock);
+        more = !parse_thread->quit;
+        _WM_Unlock(&parse_thread->lock);
+        if (!more) break;
+        _WM_Lock(&mdi->lock);
+        _WM_ParseMidiAhead(mdi, parse_thread->sample);
+        more = (mdi->parse != NULL);
+        _WM_Unlock(&mdi->lock);
+        _WM_RaiseSignal(parse_thread->done);
+    }
+}
+
+static void
+free_midi_parse_thread(struct _midi_parse_thread *parse_thread) {
+    if (parse_thread == NULL) return;
+    if (parse_thread->thread) {
+        _WM_Lock(&parse_thread->lock);
+        parse_thread->quit = 1;
+        _WM_Unlock(&parse_thread->lock);
+        _WM_RaiseSignal(parse_thread->start);
+        _WM_JoinThread(parse_thread->thread);
+    }
+    _WM_FreeSignal(parse_thread->start);
+    _WM_FreeSignal(parse_thread->done);
+    free(parse_thread);
+}
+
+/*
+ * Returns a thread waiting to parse the rest of mdi, or NULL if there
+ * are no threads to be had.
+ */
+static struct _midi_parse_thread *
+new_midi_parse_thread(struct _mdi *mdi) {
+    struct _midi_parse_thread *parse_thread;
+
+    parse_thread = (struct _midi_parse_thread *) calloc(1, sizeof(struct _midi_parse_thread));
+    if (parse_thread == NULL) return (NULL);
+    parse_thread->mdi = mdi;
+    parse_thread->start = _WM_CreateSignal();
+    parse_thread->done = _WM_CreateSignal();
+    if ((parse_thread->start != NULL) && (parse_thread->done != NULL)) {
+        parse_thread->thread = _WM_CreateThread(midi_parse_thread, parse_thread);
+        if (parse_thread->thread != NULL) return (parse_thread);
+    }
+    free_midi_parse_thread(parse_thread);
+    return (NULL);
+}
+
+/*
+ * Has the parse thread carry on until the song is known a second past
+ * sample. Must be called with the song locked and still being parsed.
+ */
+void
+_WM_WantMidiParse(struct _mdi *mdi, uint32_t sample) {
+    mdi->parse_thread->sample = sample;
+    _WM_RaiseSignal(mdi->parse_thread->start);
+}
+
+/*
+ * Waits for the parse thread to finish a step, which it does for each
+ * _WM_WantMidiParse() while the song is being parsed. Must be called
+ * with the song unlocked.
+ */
+void
+_WM_WaitMidiParse(struct _mdi *mdi) {
+    _WM_WaitSignal(mdi->parse_thread->done);
+}
+
+/*
+ * Stops the parse thread. Must be called with the song unlocked, as the
+ * thread may be waiting for the lock.
+ */
+void
+_WM_StopMidiParse(struct _mdi *mdi) {
+    free_midi_parse_thread(mdi->parse_thread);
+    mdi->parse_thread = NULL;
+}
+
+void
+_WM_FreeMidiParse(struct _mdi *mdi) {
+    _WM_StopMidiParse(mdi);
+    free_midi_parse(mdi->parse);
+    mdi->parse = NULL;
+}
+
 struct _mdi *
-_WM_ParseNewMidi(uint8_t *midi_data, uint32_t midi_size) {
+_WM_ParseNewMidi(uint8_t *midi_data, uint32_t midi_size, struct _mdi *owner) {
     struct _mdi *mdi;
 
     uint32_t tmp_val;
     uint32_t midi_type;
     uint8_t **tracks;
     uint32_t *track_size;
-    uint32_t end_of_tracks = 0;
     uint32_t no_tracks;
     uint32_t i;
     uint32_t divisions = 96;
     uint32_t tempo = 500000;
-    float samples_per_delta_f = 0;
-
-    uint32_t sample_count = 0;
-    float sample_count_f = 0;
-    float sample_remainder = 0;
     uint8_t *sysex_store = NULL;
 
     uint32_t *track_delta;
     uint8_t *track_end;
+    struct _midi_parse *parse = NULL;
+    struct _midi_parse_thread *parse_thread = NULL;
+    struct _track_decode_job decode_job;
+    int decode_threads;
+    uint32_t decode_size = 0;
+    int incremental;
+    int merge_ret;
     uint32_t smallest_delta = 0;
-    uint32_t subtract_delta = 0;
     uint8_t *running_event;
     uint32_t setup_ret = 0;
 
@@ -141,10 +590,16 @@ _WM_ParseNewMidi(uint8_t *midi_data, uint32_t midi_size) {
         return (NULL);
     }
 
-    samples_per_delta_f = _WM_GetSamplesPerTick(divisions, tempo);
-
-    mdi = _WM_initMDI();
-    _WM_midi_setup_divisions(mdi,divisions);
+    mdi = _WM_initMDI(owner);
+    /* a delta and a running status event take at least 3 bytes */
+    if (_WM_ReserveEvents(mdi, _WM_GuessEvents(midi_size, 3)) == -1) {
+        _WM_discardMDI(mdi, owner);
+        return (NULL);
+    }
+    if (_WM_midi_setup_divisions(mdi,divisions) == -1) {
+        _WM_discardMDI(mdi, owner);
+        return (NULL);
+    }
 
     tracks = (uint8_t **) malloc(sizeof(uint8_t *) * no_tracks);
     track_size = (uint32_t *) malloc(sizeof(uint32_t) * no_tracks);
@@ -237,116 +692,122 @@ _WM_ParseNewMidi(uint8_t *midi_data, uint32_t midi_size) {
         goto _end;
     }
 
-    if ((float)smallest_delta >= 0x7fffffff / samples_per_delta_f) {
-        //DEBUG
-        //fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n",
-        //        samples_per_delta_f, smallest_delta);
-        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, NULL, 0);
+    if (_WM_AdvanceTicks(mdi, smallest_delta) < 0) {
         goto _end;
     }
 
-    subtract_delta = smallest_delta;
-    sample_count_f = (((float) smallest_delta * samples_per_delta_f) + sample_remainder);
-    sample_count = (uint32_t) sample_count_f;
-    sample_remainder = sample_count_f - (float) sample_count;
-
-    mdi->events[mdi->event_count - 1].samples_to_next += sample_count;
-    mdi->extra_info.approx_total_samples += sample_count;
-
     /*
      * Handle type 0 & 2 the same, but type 1 differently
      */
     if (midi_type == 1) {
         /* Type 1 */
-        while (end_of_tracks != no_tracks) {
-            smallest_delta = 0;
+        parse = (struct _midi_parse *) calloc(1, sizeof(struct _midi_parse));
+        if (parse == NULL) {
+            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
+            goto _end;
+        }
+        parse->no_tracks = no_tracks;
+        parse->owner = owner;
+        parse->decode = (struct _track_decode *) calloc(no_tracks, sizeof(struct _track_decode));
+        parse->track_tick = (uint32_t *) malloc(sizeof(uint32_t) * no_tracks);
+        parse->track_heap = (uint32_t *) malloc(sizeof(uint32_t) * no_tracks);
+        if ((parse->decode == NULL) || (parse->track_tick == NULL) || (parse->track_heap == NULL)) {
+            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
+            goto _end;
+        }
+        for (i = 0; i < no_tracks; i++) {
+            decode_size += track_size[i];
+        }
+
+        /*
+         * Stripping silence needs the whole song up front. Otherwise
+         * we only parse a little ahead of playback and keep a copy of
+         * the tracks, as the file is gone once we return.
+         */
+        incremental = ((mdi->extra_info.mixer_options & WM_MO_INCREMENTAL)
+                       && !(mdi->extra_info.mixer_options & WM_MO_STRIPSILENCE));
+        if (incremental) {
+            /* without a thread to parse on, the song is parsed up front */
+            parse_thread = new_midi_parse_thread(mdi);
+            incremental = (parse_thread != NULL);
+        }
+        if (incremental) {
+            parse->data = (uint8_t *) malloc(decode_size);
+            if (parse->data == NULL) {
+                _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
+                goto _end;
+            }
+            decode_size = 0;
             for (i = 0; i < no_tracks; i++) {
-                if (track_end[i])
-                    continue;
-                if (track_delta[i]) {
-                    track_delta[i] -= subtract_delta;
-                    if (track_delta[i]) {
-                        if (!smallest_delta || (smallest_delta > track_delta[i])) {
-                            smallest_delta = track_delta[i];
-                        }
-                        continue;
-                    }
-                }
-                do {
-                    setup_ret = _WM_SetupMidiEvent(mdi, tracks[i], track_size[i], running_event[i]);
-                    if (setup_ret == 0) {
-                        goto _end;
-                    }
-                    if (tracks[i][0] > 0x7f) {
-                        if (tracks[i][0] < 0xf0) {
-                            /* Events 0x80 - 0xef set running event */
-                            running_event[i] = tracks[i][0];
-                        } else if ((tracks[i][0] == 0xf0) || (tracks[i][0] == 0xf7)) {
-                            /* Sysex resets running event */
-                            running_event[i] = 0;
-                        } else if ((tracks[i][0] == 0xff) && (tracks[i][1] == 0x2f) && (tracks[i][2] == 0x00)) {
-                            /* End of Track */
-                            end_of_tracks++;
-                            track_end[i] = 1;
-                            tracks[i] += 3;
-                            track_size[i] -= 3;
-                            goto NEXT_TRACK;
-                        } else if ((tracks[i][0] == 0xff) && (tracks[i][1] == 0x51) && (tracks[i][2] == 0x03)) {
-                            /* Tempo */
-                            tempo = (tracks[i][3] << 16) + (tracks[i][4] << 8)+ tracks[i][5];
-                            if (!tempo)
-                                tempo = 500000;
-
-                            samples_per_delta_f = _WM_GetSamplesPerTick(divisions, tempo);
-                        }
-                    }
-                    tracks[i] += setup_ret;
-                    track_size[i] -= setup_ret;
-
-                    if (*tracks[i] > 0x7f) {
-                        do {
-                            if (!track_size[i]) break;
-                            track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
-                            tracks[i]++;
-                            track_size[i]--;
-                        } while (*tracks[i] > 0x7f);
-                    }
-                    if (!track_size[i]) {
-                        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, "(too short)", 0);
-                        goto _end;
-                    }
-                    track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
-                    tracks[i]++;
-                    track_size[i]--;
-                } while (!track_delta[i]);
-                if ((!smallest_delta) || (smallest_delta > track_delta[i])) {
-                    smallest_delta = track_delta[i];
-                }
-            NEXT_TRACK: continue;
+                memcpy(&parse->data[decode_size], tracks[i], track_size[i]);
+                parse->decode[i].data = &parse->data[decode_size];
+                parse->decode[i].size = track_size[i];
+                decode_size += track_size[i];
+            }
+        } else {
+            for (i = 0; i < no_tracks; i++) {
+                parse->decode[i].data = tracks[i];
+                parse->decode[i].size = track_size[i];
             }
 
-            if ((float)smallest_delta >= 0x7fffffff / samples_per_delta_f) {
-                //DEBUG
-                //fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n",
-                //        samples_per_delta_f, smallest_delta);
-                _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, NULL, 0);
+            /*
+             * The tracks are independent of each other until they are
+             * merged, so big files have them decoded on the thread pool,
+             * one thread per processor up to MAX_DECODE_THREADS. The
+             * calling thread takes its share too.
+             */
+            decode_job.tracks = parse->decode;
+            decode_job.count = no_tracks;
+            decode_job.next = 0;
+            decode_job.lock = 0;
+            decode_job.failed = 0;
+
+            decode_threads = 1;
+            if (decode_size >= PARALLEL_DECODE_SIZE) {
+                decode_threads = _WM_GetCPUCount();
+                if (decode_threads > MAX_DECODE_THREADS) decode_threads = MAX_DECODE_THREADS;
+                if ((uint32_t) decode_threads > no_tracks) decode_threads = (int) no_tracks;
+            }
+            _WM_RunOnPool(decode_tracks, &decode_job, decode_threads);
+            if (decode_job.failed) {
+                _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
                 goto _end;
             }
-            subtract_delta = smallest_delta;
-            sample_count_f = (((float) smallest_delta * samples_per_delta_f)
-                              + sample_remainder);
-            sample_count = (uint32_t) sample_count_f;
-            sample_remainder = sample_count_f - (float) sample_count;
+        }
 
-            mdi->events[mdi->event_count - 1].samples_to_next += sample_count;
-            mdi->extra_info.approx_total_samples += sample_count;
+        parse->current_tick = smallest_delta;
+        for (i = 0; i < no_tracks; i++) {
+            parse->track_tick[i] = track_delta[i];
+            parse->track_heap[i] = i;
+        }
+        parse->heap_count = no_tracks;
+        i = parse->heap_count >> 1;
+        while (i--) {
+            track_heap_down(parse->track_heap, parse->heap_count, i, parse->track_tick, parse->current_tick);
+        }
+
+        if (_WM_AsyncCancelled(owner)) {
+            goto _end;
+        }
+        merge_ret = midi_merge_tracks(mdi, parse, (incremental) ? _WM_SampleRate : 0xffffffff);
+        if (merge_ret < 0) {
+            goto _end;
+        }
+        if (merge_ret > 0) {
+            /* playback starts from a reset, the rest of the parse must not */
+            memcpy(parse->channel, mdi->channel, sizeof(parse->channel));
+            /* past the load, the rest is parsed on the song's lock */
+            parse->owner = NULL;
+            mdi->parse = parse;
+            parse = NULL;
+            mdi->parse_thread = parse_thread;
+            parse_thread = NULL;
         }
     } else {
         /* Type 0 & 2 */
         if (midi_type == 2) {
             mdi->is_type2 = 1;
         }
-        sample_remainder = 0;
         for (i = 0; i < no_tracks; i++) {
             running_event[i] = 0;
             do {
@@ -371,20 +832,19 @@ _WM_ParseNewMidi(uint8_t *midi_data, uint32_t midi_size) {
                         if (!tempo)
                             tempo = 500000;
 
-                        samples_per_delta_f = _WM_GetSamplesPerTick(divisions, tempo);
+                        if (_WM_SetTempo(mdi, tempo) < 0) {
+                            goto _end;
+                        }
                     }
                 }
                 tracks[i] += setup_ret;
                 track_size[i] -= setup_ret;
 
                 track_delta[i] = 0;
-                if (*tracks[i] > 0x7f) {
-                    do {
-                        if (!track_size[i]) break;
-                        track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
-                        tracks[i]++;
-                        track_size[i]--;
-                    } while (*tracks[i] > 0x7f);
+                while (track_size[i] && (*tracks[i] > 0x7f)) {
+                    track_delta[i] = (track_delta[i] << 7) + (*tracks[i] & 0x7F);
+                    tracks[i]++;
+                    track_size[i]--;
                 }
                 if (!track_size[i]) {
                     if (midi_type != 0) {
@@ -399,19 +859,12 @@ _WM_ParseNewMidi(uint8_t *midi_data, uint32_t midi_size) {
                 tracks[i]++;
                 track_size[i]--;
 
-                if ((float)smallest_delta >= 0x7fffffff / samples_per_delta_f) {
-                    //DEBUG
-                    //fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n",
-                    //        samples_per_delta_f, smallest_delta);
-                    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, NULL, 0);
+                if (_WM_AdvanceTicks(mdi, track_delta[i]) < 0) {
+                    goto _end;
+                }
+                if (_WM_AsyncCancelled(owner)) {
                     goto _end;
                 }
-                sample_count_f = (((float) track_delta[i] * samples_per_delta_f)
-                                  + sample_remainder);
-                sample_count = (uint32_t) sample_count_f;
-                sample_remainder = sample_count_f - (float) sample_count;
-                mdi->events[mdi->event_count - 1].samples_to_next += sample_count;
-                mdi->extra_info.approx_total_samples += sample_count;
             NEXT_TRACK2:
                 smallest_delta = track_delta[i]; /* Added just to keep Xcode happy */
                 WMIDI_UNUSED(smallest_delta); /* Added to just keep clang happy */
@@ -420,7 +873,8 @@ _WM_ParseNewMidi(uint8_t *midi_data, uint32_t midi_size) {
     }
 
     if ((mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width,
-            _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy))
+            _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy,
+            _WM_reverb_type))
           == NULL) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
         goto _end;
@@ -431,16 +885,24 @@ _WM_ParseNewMidi(uint8_t *midi_data, uint32_t midi_size) {
     mdi->samples_to_mix = 0;
     mdi->note = NULL;
 
-    _WM_ResetToStart(mdi);
+    if (mdi->parse == NULL) {
+        _WM_ShrinkEvents(mdi);
+    }
+    if (_WM_ResetToStart(mdi) == -1) {
+        _WM_free_reverb(mdi->reverb);
+        mdi->reverb = NULL;
+    }
 
 _end:   free(sysex_store);
+    free_midi_parse_thread(parse_thread);
+    free_midi_parse(parse);
     free(track_end);
     free(track_delta);
     free(running_event);
     free(tracks);
     free(track_size);
     if (mdi->reverb) return (mdi);
-    _WM_freeMDI(mdi);
+    _WM_discardMDI(mdi, owner);
     return (NULL);
 }
 
@@ -523,262 +985,292 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
         switch (event->evtype) {
         case ev_midi_divisions:
             // DEBUG
-            // fprintf(stderr,"Division: %u\r\n",event->event_data.data);
-            divisions = event->event_data.data.value;
+            // fprintf(stderr,"Division: %u\r\n",event->data);
+            divisions = event->data.value;
             (*out)[12] = (divisions >> 8) & 0xff;
             (*out)[13] = divisions & 0xff;
             samples_per_tick = _WM_GetSamplesPerTick(divisions, tempo);
             break;
         case ev_note_off:
             // DEBUG
-            // fprintf(stderr,"Note Off: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0x80 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0x80 | event->event_data.channel;
+            // fprintf(stderr,"Note Off: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0x80 | event->channel)) {
+                (*out)[out_ofs++] = 0x80 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = (event->event_data.data.value >> 8) & 0xff;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = (event->data.value >> 8) & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_note_on:
             // DEBUG
-            // fprintf(stderr,"Note On: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0x90 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0x90 | event->event_data.channel;
+            // fprintf(stderr,"Note On: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0x90 | event->channel)) {
+                (*out)[out_ofs++] = 0x90 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = (event->event_data.data.value >> 8) & 0xff;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = (event->data.value >> 8) & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_aftertouch:
             // DEBUG
-            // fprintf(stderr,"Aftertouch: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xa0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xa0 | event->event_data.channel;
+            // fprintf(stderr,"Aftertouch: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xa0 | event->channel)) {
+                (*out)[out_ofs++] = 0xa0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = (event->event_data.data.value >> 8) & 0xff;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = (event->data.value >> 8) & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_bank_select:
             // DEBUG
-            // fprintf(stderr,"Control Bank Select: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Bank Select: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 0;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_data_entry_course:
             // DEBUG
-            // fprintf(stderr,"Control Data Entry Course: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Data Entry Course: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 6;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_channel_volume:
             // DEBUG
-            // fprintf(stderr,"Control Channel Volume: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Channel Volume: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 7;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_channel_balance:
             // DEBUG
-            // fprintf(stderr,"Control Channel Balance: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Channel Balance: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 8;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_channel_pan:
             // DEBUG
-            // fprintf(stderr,"Control Channel Pan: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Channel Pan: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 10;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_channel_expression:
             // DEBUG
-            // fprintf(stderr,"Control Channel Expression: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Channel Expression: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 11;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_data_entry_fine:
             // DEBUG
-            // fprintf(stderr,"Control Data Entry Fine: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Data Entry Fine: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 38;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_channel_hold:
             // DEBUG
-            // fprintf(stderr,"Control Channel Hold: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Channel Hold: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 64;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_data_increment:
             // DEBUG
-            // fprintf(stderr,"Control Data Increment: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Data Increment: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 96;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_data_decrement:
             // DEBUG
-            //fprintf(stderr,"Control Data Decrement: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            //fprintf(stderr,"Control Data Decrement: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 97;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_non_registered_param_fine:
             // DEBUG
-            // fprintf(stderr,"Control Non Registered Param: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Non Registered Param: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 98;
-            (*out)[out_ofs++] = event->event_data.data.value & 0x7f;
+            (*out)[out_ofs++] = event->data.value & 0x7f;
             break;
         case ev_control_non_registered_param_course:
             // DEBUG
-            // fprintf(stderr,"Control Non Registered Param: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Non Registered Param: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 99;
-            (*out)[out_ofs++] = (event->event_data.data.value >> 7) & 0x7f;
+            (*out)[out_ofs++] = (event->data.value >> 7) & 0x7f;
             break;
         case ev_control_registered_param_fine:
             // DEBUG
-            // fprintf(stderr,"Control Registered Param Fine: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Registered Param Fine: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 100;
-            (*out)[out_ofs++] = event->event_data.data.value & 0x7f;
+            (*out)[out_ofs++] = event->data.value & 0x7f;
             break;
         case ev_control_registered_param_course:
             // DEBUG
-            // fprintf(stderr,"Control Registered Param Course: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Registered Param Course: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 101;
-            (*out)[out_ofs++] = (event->event_data.data.value >> 7) & 0x7f;
+            (*out)[out_ofs++] = (event->data.value >> 7) & 0x7f;
             break;
         case ev_control_channel_sound_off:
             // DEBUG
-            // fprintf(stderr,"Control Channel Sound Off: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Channel Sound Off: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 120;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_channel_controllers_off:
             // DEBUG
-            // fprintf(stderr,"Control Channel Controllers Off: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Channel Controllers Off: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 121;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_channel_notes_off:
             // DEBUG
-            // fprintf(stderr,"Control Channel Notes Off: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Channel Notes Off: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
             (*out)[out_ofs++] = 123;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
+            break;
+        case ev_control_channel_reverb:
+            // DEBUG
+            // fprintf(stderr,"Control Channel Reverb: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
+                running_event = (*out)[out_ofs - 1];
+            }
+            (*out)[out_ofs++] = 91;
+            (*out)[out_ofs++] = event->data.value & 0xff;
+            break;
+        case ev_control_channel_chorus:
+            // DEBUG
+            // fprintf(stderr,"Control Channel Chorus: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
+                running_event = (*out)[out_ofs - 1];
+            }
+            (*out)[out_ofs++] = 93;
+            (*out)[out_ofs++] = event->data.value & 0xff;
+            break;
+        case ev_control_channel_brightness:
+            // DEBUG
+            // fprintf(stderr,"Control Channel Brightness: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
+                running_event = (*out)[out_ofs - 1];
+            }
+            (*out)[out_ofs++] = 74;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_control_dummy:
             // DEBUG
-            // fprintf(stderr,"Control Dummy Event: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xb0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xb0 | event->event_data.channel;
+            // fprintf(stderr,"Control Dummy Event: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xb0 | event->channel)) {
+                (*out)[out_ofs++] = 0xb0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = (event->event_data.data.value >> 8) & 0xff;
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = (event->data.value >> 8) & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_patch:
             // DEBUG
-            // fprintf(stderr,"Patch: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xc0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xc0 | event->event_data.channel;
+            // fprintf(stderr,"Patch: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xc0 | event->channel)) {
+                (*out)[out_ofs++] = 0xc0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_channel_pressure:
             // DEBUG
-            // fprintf(stderr,"Channel Pressure: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xd0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xd0 | event->event_data.channel;
+            // fprintf(stderr,"Channel Pressure: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xd0 | event->channel)) {
+                (*out)[out_ofs++] = 0xd0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = event->event_data.data.value & 0xff;
+            (*out)[out_ofs++] = event->data.value & 0xff;
             break;
         case ev_pitch:
             // DEBUG
-            // fprintf(stderr,"Pitch: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
-            if (running_event != (0xe0 | event->event_data.channel)) {
-                (*out)[out_ofs++] = 0xe0 | event->event_data.channel;
+            // fprintf(stderr,"Pitch: %u %.4x\r\n",event->channel, event->data);
+            if (running_event != (0xe0 | event->channel)) {
+                (*out)[out_ofs++] = 0xe0 | event->channel;
                 running_event = (*out)[out_ofs - 1];
             }
-            (*out)[out_ofs++] = event->event_data.data.value & 0x7f;
-            (*out)[out_ofs++] = (event->event_data.data.value >> 7) & 0x7f;
+            (*out)[out_ofs++] = event->data.value & 0x7f;
+            (*out)[out_ofs++] = (event->data.value >> 7) & 0x7f;
             break;
         case ev_sysex_roland_drum_track: {
             // DEBUG
-            // fprintf(stderr,"Sysex Roland Drum Track: %u %.4x\r\n",event->event_data.channel, event->event_data.data);
+            // fprintf(stderr,"Sysex Roland Drum Track: %u %.4x\r\n",event->channel, event->data);
             uint8_t foo[] = {0xf0, 0x09, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x15, 0x00, 0xf7};
-            uint8_t foo_ch = event->event_data.channel;
+            uint8_t foo_ch = event->channel;
             if (foo_ch == 9) {
                 foo_ch = 0;
             } else if (foo_ch < 9) {
                 foo_ch++;
             }
             foo[7] = 0x10 | foo_ch;
-            foo[9] = event->event_data.data.value;
+            foo[9] = event->data.value;
             memcpy(&((*out)[out_ofs]),foo,11);
             out_ofs += 11;
             running_event = 0;
@@ -839,8 +1331,8 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
             goto NEXT_EVENT;
         case ev_meta_tempo:
             // DEBUG
-            // fprintf(stderr,"Tempo: %u\r\n",event->event_data.data);
-            tempo = event->event_data.data.value & 0xffffff;
+            // fprintf(stderr,"Tempo: %u\r\n",event->data);
+            tempo = event->data.value & 0xffffff;
 
             samples_per_tick = _WM_GetSamplesPerTick(divisions, tempo);
 
@@ -856,63 +1348,63 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
             break;
         case ev_meta_timesignature:
             // DEBUG
-            // fprintf(stderr,"Time Signature: %x\r\n",event->event_data.data);
+            // fprintf(stderr,"Time Signature: %x\r\n",event->data);
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x58;
             (*out)[out_ofs++] = 0x04;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff000000) >> 24;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff0000) >> 16;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff00) >> 8;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->data.value & 0xff000000) >> 24;
+            (*out)[out_ofs++] = (event->data.value & 0xff0000) >> 16;
+            (*out)[out_ofs++] = (event->data.value & 0xff00) >> 8;
+            (*out)[out_ofs++] = (event->data.value & 0xff);
             break;
         case ev_meta_keysignature:
             // DEBUG
-            // fprintf(stderr,"Key Signature: %x\r\n",event->event_data.data);
+            // fprintf(stderr,"Key Signature: %x\r\n",event->data);
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x59;
             (*out)[out_ofs++] = 0x02;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff00) >> 8;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->data.value & 0xff00) >> 8;
+            (*out)[out_ofs++] = (event->data.value & 0xff);
             break;
         case ev_meta_sequenceno:
             // DEBUG
-            // fprintf(stderr,"Sequence Number: %x\r\n",event->event_data.data);
+            // fprintf(stderr,"Sequence Number: %x\r\n",event->data);
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x00;
             (*out)[out_ofs++] = 0x02;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff00) >> 8;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->data.value & 0xff00) >> 8;
+            (*out)[out_ofs++] = (event->data.value & 0xff);
             break;
         case ev_meta_channelprefix:
             // DEBUG
-            // fprintf(stderr,"Channel Prefix: %x\r\n",event->event_data.data);
+            // fprintf(stderr,"Channel Prefix: %x\r\n",event->data);
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x20;
             (*out)[out_ofs++] = 0x01;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->data.value & 0xff);
             break;
         case ev_meta_portprefix:
             // DEBUG
-            // fprintf(stderr,"Port Prefix: %x\r\n",event->event_data.data);
+            // fprintf(stderr,"Port Prefix: %x\r\n",event->data);
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x21;
             (*out)[out_ofs++] = 0x01;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->data.value & 0xff);
             break;
         case ev_meta_smpteoffset:
             // DEBUG
-            // fprintf(stderr,"SMPTE Offset: %x\r\n",event->event_data.data);
+            // fprintf(stderr,"SMPTE Offset: %x\r\n",event->data);
             (*out)[out_ofs++] = 0xff;
             (*out)[out_ofs++] = 0x54;
             (*out)[out_ofs++] = 0x05;
             /*
              Remember because of the 5 bytes we stored it a little hacky.
              */
-            (*out)[out_ofs++] = (event->event_data.channel & 0xff);
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff000000) >> 24;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff0000) >> 16;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff00) >> 8;
-            (*out)[out_ofs++] = (event->event_data.data.value & 0xff);
+            (*out)[out_ofs++] = (event->channel & 0xff);
+            (*out)[out_ofs++] = (event->data.value & 0xff000000) >> 24;
+            (*out)[out_ofs++] = (event->data.value & 0xff0000) >> 16;
+            (*out)[out_ofs++] = (event->data.value & 0xff00) >> 8;
+            (*out)[out_ofs++] = (event->data.value & 0xff);
             break;
 
         case ev_meta_text:
@@ -956,7 +1448,7 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
             (*out)[out_ofs++] = 0x07;
 
             _WRITE_TEXT:
-            value = strlen(event->event_data.data.string);
+            value = strlen(&mdi->strings[event->data.string]);
             if (value > 0x0fffffff)
                 (*out)[out_ofs++] = (((value >> 28) &0x7f) | 0x80);
             if (value > 0x1fffff)
@@ -967,13 +1459,13 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
                 (*out)[out_ofs++] = (((value >> 7) & 0x7f) | 0x80);
             (*out)[out_ofs++] = (value & 0x7f);
 
-            memcpy(&(*out)[out_ofs], event->event_data.data.string, value);
+            memcpy(&(*out)[out_ofs], &mdi->strings[event->data.string], value);
             out_ofs += value;
             break;
 
         default:
             // DEBUG
-            // fprintf(stderr,"Unknown Event %.2x %.4x\n",event->event_data.channel, event->event_data.data.value);
+            // fprintf(stderr,"Unknown Event %.2x %.4x\n",event->channel, event->data.value);
             event++;
             continue;
         }
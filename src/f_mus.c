@@ -45,7 +45,7 @@
  Turns mus file data into an event stream.
  */
 struct _mdi *
-_WM_ParseNewMus(uint8_t *mus_data, uint32_t mus_size) {
+_WM_ParseNewMus(uint8_t *mus_data, uint32_t mus_size, struct _mdi *owner) {
     uint8_t mus_hdr[] = { 'M', 'U', 'S', 0x1A };
     uint32_t mus_song_ofs = 0;
     uint32_t mus_song_len = 0;
@@ -59,16 +59,12 @@ _WM_ParseNewMus(uint8_t *mus_data, uint32_t mus_size) {
     uint32_t mus_divisions = 60;
     float tempo_f = 0;
     uint16_t mus_freq = 0;
-    float samples_per_tick_f = 0;
 #define MUS_SZ 4
     uint8_t mus_event[MUS_SZ] = { 0, 0, 0, 0 };
     uint8_t mus_event_size = 0;
     uint8_t mus_prev_vol[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
     uint32_t setup_ret = 0;
     uint32_t mus_ticks = 0;
-    uint32_t sample_count = 0;
-    float sample_count_f = 0;
-    float sample_remainder = 0;
     uint16_t pitchbend_tmp = 0;
 
     if (mus_size < 18) {
@@ -125,12 +121,19 @@ _WM_ParseNewMus(uint8_t *mus_data, uint32_t mus_size) {
         tempo_f = (float) (60000000 / mus_freq);
     }
 
-    samples_per_tick_f = _WM_GetSamplesPerTick(mus_divisions, (uint32_t)tempo_f);
-
     // initialise the mdi structure
-    mus_mdi = _WM_initMDI();
-    _WM_midi_setup_divisions(mus_mdi, mus_divisions);
-    _WM_midi_setup_tempo(mus_mdi, (uint32_t)tempo_f);
+    mus_mdi = _WM_initMDI(owner);
+    /* mus events are mostly 2 bytes */
+    if (_WM_ReserveEvents(mus_mdi, _WM_GuessEvents(mus_size, 2)) == -1) {
+        goto _mus_end;
+    }
+    if ((_WM_midi_setup_divisions(mus_mdi, mus_divisions) == -1)
+     || (_WM_midi_setup_tempo(mus_mdi, (uint32_t)tempo_f) == -1)) {
+        goto _mus_end;
+    }
+    if (_WM_SetTempo(mus_mdi, (uint32_t)tempo_f) < 0) {
+        goto _mus_end;
+    }
 
     // lets do this
     do {
@@ -339,32 +342,38 @@ _WM_ParseNewMus(uint8_t *mus_data, uint32_t mus_size) {
             mus_ticks = (mus_ticks << 7) | (mus_data[mus_data_ofs++] & 0x7f);
         } while (mus_data[mus_data_ofs - 1] & 0x80);
 
-        sample_count_f = ((float)mus_ticks * samples_per_tick_f) + sample_remainder;
-        sample_count = (uint32_t)sample_count_f;
-        sample_remainder = sample_count_f - (float)sample_count;
-
-        mus_mdi->events[mus_mdi->event_count - 1].samples_to_next = sample_count;
-        mus_mdi->extra_info.approx_total_samples += sample_count;
+        if (_WM_AdvanceTicks(mus_mdi, mus_ticks) < 0) {
+            goto _mus_end;
+        }
+        if (_WM_AsyncCancelled(owner)) {
+            goto _mus_end;
+        }
 
     } while (mus_data_ofs < mus_size);
 
 _mus_end_of_song:
     // Finalise mdi structure
-    if ((mus_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy)) == NULL) {
+    if (_WM_midi_setup_endoftrack(mus_mdi) == -1) {
+        goto _mus_end;
+    }
+    if ((mus_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy, _WM_reverb_type)) == NULL) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
         goto _mus_end;
     }
-    _WM_midi_setup_endoftrack(mus_mdi);
     mus_mdi->extra_info.current_sample = 0;
     mus_mdi->current_event = &mus_mdi->events[0];
     mus_mdi->samples_to_mix = 0;
     mus_mdi->note = NULL;
 
-    _WM_ResetToStart(mus_mdi);
+    _WM_ShrinkEvents(mus_mdi);
+    if (_WM_ResetToStart(mus_mdi) == -1) {
+        _WM_free_reverb(mus_mdi->reverb);
+        mus_mdi->reverb = NULL;
+    }
 
 _mus_end:
     free(mus_mid_instr);
     if (mus_mdi->reverb) return (mus_mdi);
-    _WM_freeMDI(mus_mdi);
+    _WM_discardMDI(mus_mdi, owner);
     return NULL;
 }
@@ -36,7 +36,7 @@
 #include "f_xmidi.h"
 
 
-struct _mdi *_WM_ParseNewXmi(uint8_t *xmi_data, uint32_t xmi_size) {
+struct _mdi *_WM_ParseNewXmi(uint8_t *xmi_data, uint32_t xmi_size, struct _mdi *owner) {
     struct _mdi *xmi_mdi = NULL;
     uint32_t xmi_tmpdata = 0;
     uint8_t xmi_formcnt = 0;
@@ -48,10 +48,6 @@ struct _mdi *_WM_ParseNewXmi(uint8_t *xmi_data, uint32_t xmi_size) {
     uint32_t xmi_evntlen = 0;
     uint32_t xmi_divisions = 60;
     uint32_t xmi_tempo = 500000;
-    uint32_t xmi_sample_count = 0;
-    float xmi_sample_count_f = 0;
-    float xmi_sample_remainder = 0;
-    float xmi_samples_per_delta_f = 0;
     uint8_t xmi_ch = 0;
     uint8_t xmi_note = 0;
     uint32_t *xmi_notelen = NULL;
@@ -131,11 +127,18 @@ struct _mdi *_WM_ParseNewXmi(uint8_t *xmi_data, uint32_t xmi_size) {
     xmi_data += 4;
     xmi_size -= 4;
 
-    xmi_mdi = _WM_initMDI();
-    _WM_midi_setup_divisions(xmi_mdi, xmi_divisions);
-    _WM_midi_setup_tempo(xmi_mdi, xmi_tempo);
-
-    xmi_samples_per_delta_f = _WM_GetSamplesPerTick(xmi_divisions, xmi_tempo);
+    xmi_mdi = _WM_initMDI(owner);
+    /* xmi note ons carry their duration, giving two events each */
+    if (_WM_ReserveEvents(xmi_mdi, _WM_GuessEvents(xmi_size, 2)) == -1) {
+        goto _xmi_end;
+    }
+    if ((_WM_midi_setup_divisions(xmi_mdi, xmi_divisions) == -1)
+     || (_WM_midi_setup_tempo(xmi_mdi, xmi_tempo) == -1)) {
+        goto _xmi_end;
+    }
+    if (_WM_SetTempo(xmi_mdi, xmi_tempo) < 0) {
+        goto _xmi_end;
+    }
 
     xmi_notelen = (uint32_t *) malloc(sizeof(uint32_t) * 16 * 128);
     memset(xmi_notelen, 0, (sizeof(uint32_t) * 16 * 128));
@@ -228,21 +231,12 @@ struct _mdi *_WM_ParseNewXmi(uint8_t *xmi_data, uint32_t xmi_size) {
                                 xmi_tmpdata = xmi_delta;
                             }
 
-                            if ((float)xmi_tmpdata >= 0x7fffffff / xmi_samples_per_delta_f) {
-                                //DEBUG
-                                //fprintf(stderr,"INTEGER OVERFLOW (samples_per_delta: %f, smallest_delta: %u)\n",
-                                //        xmi_samples_per_delta_f, xmi_tmpdata);
-                                _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, NULL, 0);
+                            if (_WM_AdvanceTicks(xmi_mdi, xmi_tmpdata) < 0) {
+                                goto _xmi_end;
+                            }
+                            if (_WM_AsyncCancelled(owner)) {
                                 goto _xmi_end;
                             }
-
-                            xmi_sample_count_f= (((float) xmi_tmpdata * xmi_samples_per_delta_f) + xmi_sample_remainder);
-
-                            xmi_sample_count = (uint32_t) xmi_sample_count_f;
-                            xmi_sample_remainder = xmi_sample_count_f - (float) xmi_sample_count;
-
-                            xmi_mdi->events[xmi_mdi->event_count - 1].samples_to_next += xmi_sample_count;
-                            xmi_mdi->extra_info.approx_total_samples += xmi_sample_count;
 
                             xmi_lowestdelta = 0;
 
@@ -258,7 +252,9 @@ struct _mdi *_WM_ParseNewXmi(uint8_t *xmi_data, uint32_t xmi_size) {
                                 if (xmi_notelen[j] == 0) {
                                     xmi_ch = j / 128;
                                     xmi_note = j - (xmi_ch * 128);
-                                    _WM_midi_setup_noteoff(xmi_mdi, xmi_ch, xmi_note, 0);
+                                    if (_WM_midi_setup_noteoff(xmi_mdi, xmi_ch, xmi_note, 0) == -1) {
+                                        goto _xmi_end;
+                                    }
                                 } else {
                                     // otherwise work out new lowest delta
                                     if ((xmi_lowestdelta == 0) || (xmi_lowestdelta > xmi_notelen[j])) {
@@ -329,7 +325,7 @@ struct _mdi *_WM_ParseNewXmi(uint8_t *xmi_data, uint32_t xmi_size) {
     }
 
     // Finalise mdi structure
-    if ((xmi_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy)) == NULL) {
+    if ((xmi_mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width, _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy, _WM_reverb_type)) == NULL) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
         goto _xmi_end;
     }
@@ -341,11 +337,15 @@ struct _mdi *_WM_ParseNewXmi(uint8_t *xmi_data, uint32_t xmi_size) {
     if (xmi_evnt_cnt > 1) {
         xmi_mdi->is_type2 = 1;
     }
-    _WM_ResetToStart(xmi_mdi);
+    _WM_ShrinkEvents(xmi_mdi);
+    if (_WM_ResetToStart(xmi_mdi) == -1) {
+        _WM_free_reverb(xmi_mdi->reverb);
+        xmi_mdi->reverb = NULL;
+    }
 
 _xmi_end:
     if (xmi_notelen) free(xmi_notelen);
     if (xmi_mdi->reverb) return (xmi_mdi);
-    _WM_freeMDI(xmi_mdi);
+    _WM_discardMDI(xmi_mdi, owner);
     return NULL;
 }
@@ -61,6 +61,10 @@
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 #if !defined(O_BINARY)
 # if defined(_O_BINARY)
 #  define O_BINARY _O_BINARY
@@ -69,8 +73,10 @@
 # endif
 #endif
 
+#include "common.h"
 #include "wm_error.h"
 #include "file_io.h"
+#include "wildmidi_lib.h"
 void* (*_WM_BufferFile)(const char *, uint32_t *) = _WM_BufferFileImpl;
 void  (*_WM_FreeBufferFile)(void*)                = _WM_FreeBufferFileImpl;
 
@@ -111,32 +117,11 @@ static void AMIGA_close (BPTR fd) {
 }
 #endif
 
-void *_WM_BufferFileImpl(const char *filename, uint32_t *size) {
+#if !defined(__DJGPP__) && !defined(_WIN32) && !defined(__OS2__) && !defined(__EMX__) && !defined(WILDMIDI_AMIGA) && \
+    !defined(_3DS) && !defined(GEKKO) && !defined(__vita__) && !defined(__SWITCH__) && !defined(__riscos__)
+/* expand "~/" and relative paths of filename, returns a malloc'ed path */
+static char *WM_FullPath(const char *filename) {
     char *buffer_file = NULL;
-    uint8_t *data;
-#ifdef __DJGPP__
-    int buffer_fd;
-    struct ffblk f;
-#elif defined(_WIN32)
-    int buffer_fd;
-    HANDLE h;
-    WIN32_FIND_DATAA wfd;
-#elif defined(__OS2__) || defined(__EMX__)
-    int buffer_fd;
-    HDIR h = HDIR_CREATE;
-    FILEFINDBUF3 fb = {0};
-    ULONG cnt = 1;
-#elif defined(WILDMIDI_AMIGA)
-    BPTR buffer_fd;
-    long filsize;
-#elif defined(_3DS) || defined(GEKKO) || defined(__vita__) || defined(__SWITCH__) || defined(__riscos__)
-    int buffer_fd;
-    struct stat buffer_stat;
-#else /* unix builds */
-    int buffer_fd;
-    struct stat buffer_stat;
-
-/* for basedir of filename: */
     const char *home = NULL;
     struct passwd *pwd_ent;
     char buffer_dir[1024];
@@ -170,6 +155,48 @@ void *_WM_BufferFileImpl(const char *filename, uint32_t *size) {
             strcat(buffer_file, "/");
         strcat(buffer_file, filename);
     }
+
+    if (buffer_file == NULL) {
+        buffer_file = (char *) malloc(strlen(filename) + 1);
+        if (buffer_file == NULL) {
+            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
+            return NULL;
+        }
+        strcpy(buffer_file, filename);
+    }
+    return buffer_file;
+}
+#define WM_HAVE_FULLPATH
+#endif /* unix builds */
+
+void *_WM_BufferFileImpl(const char *filename, uint32_t *size) {
+    char *buffer_file = NULL;
+    uint8_t *data;
+#ifdef __DJGPP__
+    int buffer_fd;
+    struct ffblk f;
+#elif defined(_WIN32)
+    int buffer_fd;
+    HANDLE h;
+    WIN32_FIND_DATAA wfd;
+#elif defined(__OS2__) || defined(__EMX__)
+    int buffer_fd;
+    HDIR h = HDIR_CREATE;
+    FILEFINDBUF3 fb = {0};
+    ULONG cnt = 1;
+#elif defined(WILDMIDI_AMIGA)
+    BPTR buffer_fd;
+    long filsize;
+#elif defined(_3DS) || defined(GEKKO) || defined(__vita__) || defined(__SWITCH__) || defined(__riscos__)
+    int buffer_fd;
+    struct stat buffer_stat;
+#else /* unix builds */
+    int buffer_fd;
+    struct stat buffer_stat;
+
+    if ((buffer_file = WM_FullPath(filename)) == NULL) {
+        return NULL;
+    }
 #endif /* unix builds */
 
     if (buffer_file == NULL) {
@@ -281,3 +308,262 @@ void *_WM_BufferFileImpl(const char *filename, uint32_t *size) {
 void _WM_FreeBufferFileImpl(void *buf) {
     free(buf);
 }
+
+#if defined(HAVE_MMAP) && defined(WM_HAVE_FULLPATH)
+/*
+ * Map a file privately for loaders that only read through their buffer.
+ * The mapping is copy-on-write, so the odd loader that patches its input
+ * in place still works. Like _WM_BufferFile() there is a nul byte after
+ * the data: size + 1 bytes are mapped anonymously and the file is mapped
+ * over the start, so that byte is in the zero filled end of the file's
+ * last page or in the anonymous page after it. Files that can't be mapped
+ * are read into the anonymous mapping instead, so both cases are released
+ * with munmap().
+ *
+ * The file must not be truncated while it is mapped. Touching a page that
+ * is no longer backed by the file raises SIGBUS, which ends the program
+ * rather than failing the load. The mapping only lives as long as the one
+ * load, so only files cut short by something else during it are a worry.
+ */
+static void *WM_MapFile(const char *filename, uint32_t *size) {
+    char *buffer_file;
+    int buffer_fd;
+    struct stat buffer_stat;
+    size_t map_size;
+    void *data;
+
+    if ((buffer_file = WM_FullPath(filename)) == NULL) {
+        return NULL;
+    }
+    if ((buffer_fd = open(buffer_file, (O_RDONLY | O_BINARY))) == -1) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_OPEN, filename, errno);
+        free(buffer_file);
+        return NULL;
+    }
+    free(buffer_file);
+    if (fstat(buffer_fd, &buffer_stat)) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_STAT, filename, errno);
+        close(buffer_fd);
+        return NULL;
+    }
+    if (buffer_stat.st_size > WM_MAXFILESIZE) {
+        /* don't bother loading suspiciously long files */
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_LONGFIL, filename, 0);
+        close(buffer_fd);
+        return NULL;
+    }
+    *size = buffer_stat.st_size;
+    map_size = (size_t) *size + 1;
+
+    data = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
+        close(buffer_fd);
+        return NULL;
+    }
+    if ((*size != 0) && (mmap(data, *size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_FIXED, buffer_fd, 0) != MAP_FAILED)) {
+        madvise(data, *size, MADV_SEQUENTIAL);
+        close(buffer_fd);
+        return data;
+    }
+
+    if (*size != 0) {
+        /* a failed MAP_FIXED can leave a hole, so start again */
+        munmap(data, map_size);
+        data = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
+            close(buffer_fd);
+            return NULL;
+        }
+    }
+    if (read(buffer_fd, data, *size) != (long) *size) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_READ, filename, errno);
+        munmap(data, map_size);
+        close(buffer_fd);
+        return NULL;
+    }
+    close(buffer_fd);
+    return data;
+}
+#endif
+
+/*
+ * Load a file that is only read by the caller, which is the case for
+ * patches and midi files. As with _WM_BufferFile() the data is followed
+ * by a nul byte. *mapped says how the buffer was made and has to be
+ * passed back with it to _WM_FreeBufferFileRO().
+ */
+void *_WM_BufferFileRO(const char *filename, uint32_t *size, int *mapped) {
+#if defined(HAVE_MMAP) && defined(WM_HAVE_FULLPATH)
+    if (_WM_BufferFile == _WM_BufferFileImpl) {
+        *mapped = 1;
+        return WM_MapFile(filename, size);
+    }
+#endif
+    *mapped = 0;
+    return _WM_BufferFile(filename, size);
+}
+
+void _WM_FreeBufferFileRO(void *buf, uint32_t size, int mapped) {
+#if defined(HAVE_MMAP) && defined(WM_HAVE_FULLPATH)
+    if (mapped) {
+        munmap(buf, (size_t) size + 1);
+        return;
+    }
+#endif
+    WMIDI_UNUSED(size);
+    WMIDI_UNUSED(mapped);
+    _WM_FreeBufferFile(buf);
+}
+
+/* streaming VIO */
+
+static struct _WM_VIO_Stream WM_Stream;
+static int WM_StreamEnabled = 0;
+
+void _WM_SetStreamVIO(const struct _WM_VIO_Stream *callbacks) {
+    if (callbacks) {
+        WM_Stream = *callbacks;
+        WM_StreamEnabled = 1;
+    } else {
+        WM_StreamEnabled = 0;
+    }
+}
+
+/* read exactly len bytes from a stream, returns -1 on error or short read */
+static int WM_StreamRead(void *stream, uint8_t *buf, uint32_t len) {
+    int32_t bytes_read;
+
+    while (len) {
+        bytes_read = WM_Stream.read_file(stream, buf, len);
+        if (bytes_read <= 0) {
+            return -1;
+        }
+        buf += bytes_read;
+        len -= bytes_read;
+    }
+    return 0;
+}
+
+static void *WM_StreamOpen(const char *filename, uint32_t *size) {
+    void *stream;
+    int32_t stream_size;
+
+    if ((stream = WM_Stream.open_file(filename)) == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_OPEN, filename, ENOENT);
+        return NULL;
+    }
+    if ((stream_size = WM_Stream.size_file(stream)) < 0) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_STAT, filename, EIO);
+        WM_Stream.close_file(stream);
+        return NULL;
+    }
+    if (stream_size > WM_MAXFILESIZE) {
+        /* don't bother loading suspiciously long files */
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_LONGFIL, filename, 0);
+        WM_Stream.close_file(stream);
+        return NULL;
+    }
+    *size = stream_size;
+    return stream;
+}
+
+/* _WM_BufferFile() for streaming VIO, used where the whole file is needed */
+void *_WM_BufferFileStream(const char *filename, uint32_t *size) {
+    void *stream;
+    uint8_t *data;
+
+    if ((stream = WM_StreamOpen(filename, size)) == NULL) {
+        return NULL;
+    }
+
+    /* +1 needed for parsing text files without a newline at the end */
+    data = (uint8_t *) malloc(*size + 1);
+    if (data == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
+        WM_Stream.close_file(stream);
+        return NULL;
+    }
+    if (WM_StreamRead(stream, data, *size) != 0) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_READ, filename, EIO);
+        free(data);
+        WM_Stream.close_file(stream);
+        return NULL;
+    }
+    WM_Stream.close_file(stream);
+
+    data[*size] = '\0';
+    return data;
+}
+
+/*
+ * Sequential reader.
+ * With streaming VIO only the chunk being worked on is held in memory,
+ * otherwise the file is loaded with _WM_BufferFileRO() and chunks are
+ * handed out straight from that buffer.
+ */
+int _WM_ReaderOpen(struct _WM_Reader *rdr, const char *filename) {
+    memset(rdr, 0, sizeof(struct _WM_Reader));
+    rdr->filename = filename;
+
+    if (WM_StreamEnabled) {
+        if ((rdr->stream = WM_StreamOpen(filename, &rdr->size)) == NULL) {
+            return -1;
+        }
+        return 0;
+    }
+
+    if ((rdr->data = (uint8_t *) _WM_BufferFileRO(filename, &rdr->size, &rdr->mapped)) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Returns the next len bytes of the file, or NULL if the file is too short.
+ * For streams the returned data is only valid until the next call.
+ */
+uint8_t *_WM_ReaderGet(struct _WM_Reader *rdr, uint32_t len) {
+    uint8_t *ret;
+
+    if ((len > rdr->size) || (rdr->pos > rdr->size - len)) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, rdr->filename, 0);
+        return NULL;
+    }
+
+    if (rdr->stream == NULL) {
+        ret = rdr->data + rdr->pos;
+        rdr->pos += len;
+        return ret;
+    }
+
+    if ((len > rdr->data_size) || (rdr->data == NULL)) {
+        ret = (uint8_t *) realloc(rdr->data, (len ? len : 1));
+        if (ret == NULL) {
+            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
+            return NULL;
+        }
+        rdr->data = ret;
+        rdr->data_size = len;
+    }
+    if (WM_StreamRead(rdr->stream, rdr->data, len) != 0) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_READ, rdr->filename, EIO);
+        return NULL;
+    }
+    rdr->pos += len;
+    return rdr->data;
+}
+
+void _WM_ReaderClose(struct _WM_Reader *rdr) {
+    if (rdr->stream) {
+        WM_Stream.close_file(rdr->stream);
+        free(rdr->data);
+    } else if (rdr->data) {
+        _WM_FreeBufferFileRO(rdr->data, rdr->size, rdr->mapped);
+    }
+    memset(rdr, 0, sizeof(struct _WM_Reader));
+}
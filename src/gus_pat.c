@@ -53,701 +53,193 @@
 #define GUSPAT_END_DEBUG()
 #endif
 
-/* sample data conversion functions
+/* sample data conversion
  * convert data to signed shorts
+ *
+ * Ping pong loops are stored once and left flagged with SAMPLE_PINGPONG,
+ * the mixer bounces between the loop points itself.
+ *
+ * Conversion is done in a single pass that also records the peak levels of
+ * the sample for auto_amp, using SSE2 or NEON where available.
  */
 
-/* 8bit signed */
-static int convert_8s(uint8_t *data, struct _sample *gus_sample) {
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->data_length;
-    int16_t *write_data = NULL;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc((gus_sample->data_length + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        do {
-            *write_data++ = (*read_data++) << 8;
-        } while (read_data != read_end);
-        return 0;
-    }
-
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-
-    return -1;
-}
-
-/* 8bit signed ping pong */
-static int convert_8sp(uint8_t *data, struct _sample *gus_sample) {
-    uint32_t loop_length = gus_sample->loop_end
-            - gus_sample->loop_start;
-    uint32_t dloop_length = loop_length * 2;
-    uint32_t new_length = gus_sample->data_length + dloop_length;
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->loop_start;
-    int16_t *write_data = NULL;
-    int16_t *write_data_a = NULL;
-    int16_t *write_data_b = NULL;
+#if defined(WM_SSE2)
+#include <emmintrin.h>
+#elif defined(WM_NEON)
+#include <arm_neon.h>
+#endif
 
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc((new_length + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        while (read_data < read_end) {
-            *write_data++ = (*read_data++) << 8;
-        }
+static void convert_data(uint8_t *data, int16_t *write_data, uint32_t samples,
+                         uint8_t modes, int16_t *peak_min, int16_t *peak_max) {
+    uint16_t flip = (modes & SAMPLE_UNSIGNED) ? 0x8000 : 0;
+    int is16 = modes & SAMPLE_16BIT;
+    int reverse = modes & SAMPLE_REVERSE;
+    int16_t samp_min = 0;
+    int16_t samp_max = 0;
+    int16_t samp;
+    uint32_t i = 0;
 
-        *write_data = (*read_data++ << 8);
-        write_data_a = write_data + dloop_length;
-        *write_data_a-- = *write_data;
-        write_data++;
-        write_data_b = write_data + dloop_length;
-        read_end = data + gus_sample->loop_end;
-        do {
-            *write_data = (*read_data++) << 8;
-            *write_data_a-- = *write_data;
-            *write_data_b++ = *write_data;
-            write_data++;
-        } while (read_data != read_end);
-
-        *write_data = (*read_data++ << 8);
-        *write_data_b++ = *write_data;
-        read_end = data + gus_sample->data_length;
-        while (read_data < read_end) {
-            *write_data_b++ = (*read_data++) << 8;
+#if defined(WM_SSE2)
+    if (samples >= 8) {
+        __m128i vflip = _mm_set1_epi16((int16_t)flip);
+        __m128i vmin = _mm_setzero_si128();
+        __m128i vmax = _mm_setzero_si128();
+        __m128i v;
+        int16_t tmp[8];
+        int j;
+
+        for (; i + 8 <= samples; i += 8) {
+            if (is16) {
+                v = _mm_loadu_si128((const __m128i *) (data + (i << 1)));
+            } else {
+                v = _mm_unpacklo_epi8(_mm_setzero_si128(),
+                        _mm_loadl_epi64((const __m128i *) (data + i)));
+            }
+            v = _mm_xor_si128(v, vflip);
+            vmin = _mm_min_epi16(vmin, v);
+            vmax = _mm_max_epi16(vmax, v);
+            if (reverse) {
+                v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+                v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+                v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+                _mm_storeu_si128((__m128i *) (write_data + samples - 8 - i), v);
+            } else {
+                _mm_storeu_si128((__m128i *) (write_data + i), v);
+            }
         }
-        gus_sample->loop_start += loop_length;
-        gus_sample->loop_end += dloop_length;
-        gus_sample->data_length = new_length;
-        gus_sample->modes ^= SAMPLE_PINGPONG;
-        return 0;
-    }
-
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 8bit signed reverse */
-static int convert_8sr(uint8_t *data, struct _sample *gus_sample) {
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->data_length;
-    int16_t *write_data = NULL;
-    uint32_t tmp_loop = 0;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc((gus_sample->data_length + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data + gus_sample->data_length - 1;
-        do {
-            *write_data-- = (*read_data++) << 8;
-        } while (read_data != read_end);
-        tmp_loop = gus_sample->loop_end;
-        gus_sample->loop_end = gus_sample->data_length - gus_sample->loop_start;
-        gus_sample->loop_start = gus_sample->data_length - tmp_loop;
-        gus_sample->loop_fraction = ((gus_sample->loop_fraction & 0x0f) << 4)
-                | ((gus_sample->loop_fraction & 0xf0) >> 4);
-        gus_sample->modes ^= SAMPLE_REVERSE;
-        return 0;
-    }
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 8bit signed reverse ping pong */
-static int convert_8srp(uint8_t *data, struct _sample *gus_sample) {
-    uint32_t loop_length = gus_sample->loop_end
-            - gus_sample->loop_start;
-    uint32_t dloop_length = loop_length * 2;
-    uint32_t new_length = gus_sample->data_length + dloop_length;
-    uint8_t *read_data = data + gus_sample->data_length - 1;
-    uint8_t *read_end = data + gus_sample->loop_end;
-    int16_t *write_data = NULL;
-    int16_t *write_data_a = NULL;
-    int16_t *write_data_b = NULL;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc((new_length + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        do {
-            *write_data++ = (*read_data--) << 8;
-        } while (read_data != read_end);
-
-        *write_data = (*read_data-- << 8);
-        write_data_a = write_data + dloop_length;
-        *write_data_a-- = *write_data;
-        write_data++;
-        write_data_b = write_data + dloop_length;
-        read_end = data + gus_sample->loop_start;
-        do {
-            *write_data = (*read_data--) << 8;
-            *write_data_a-- = *write_data;
-            *write_data_b++ = *write_data;
-            write_data++;
-        } while (read_data != read_end);
-
-        *write_data = (*read_data-- << 8);
-        *write_data_b++ = *write_data;
-        read_end = data - 1;
-        do {
-            *write_data_b++ = (*read_data--) << 8;
-            write_data_b++;
-        } while (read_data != read_end);
-        gus_sample->loop_start += loop_length;
-        gus_sample->loop_end += dloop_length;
-        gus_sample->data_length = new_length;
-        gus_sample->modes ^= SAMPLE_PINGPONG | SAMPLE_REVERSE;
-        return 0;
+        _mm_storeu_si128((__m128i *) tmp, vmin);
+        for (j = 0; j < 8; j++)
+            if (tmp[j] < samp_min) samp_min = tmp[j];
+        _mm_storeu_si128((__m128i *) tmp, vmax);
+        for (j = 0; j < 8; j++)
+            if (tmp[j] > samp_max) samp_max = tmp[j];
     }
-
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 8bit unsigned */
-static int convert_8u(uint8_t *data, struct _sample *gus_sample) {
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->data_length;
-    int16_t *write_data = NULL;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc((gus_sample->data_length + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        do {
-            *write_data++ = ((*read_data++) ^ 0x80) << 8;
-        } while (read_data != read_end);
-        gus_sample->modes ^= SAMPLE_UNSIGNED;
-        return 0;
+#elif defined(WM_NEON)
+    if (samples >= 8) {
+        int16x8_t vflip = vdupq_n_s16((int16_t)flip);
+        int16x8_t vmin = vdupq_n_s16(0);
+        int16x8_t vmax = vdupq_n_s16(0);
+        int16x8_t v;
+        int16x4_t vpair;
+
+        for (; i + 8 <= samples; i += 8) {
+            if (is16) {
+                v = vreinterpretq_s16_u8(vld1q_u8(data + (i << 1)));
+            } else {
+                v = vreinterpretq_s16_u16(vshll_n_u8(vld1_u8(data + i), 8));
+            }
+            v = veorq_s16(v, vflip);
+            vmin = vminq_s16(vmin, v);
+            vmax = vmaxq_s16(vmax, v);
+            if (reverse) {
+                v = vrev64q_s16(v);
+                v = vcombine_s16(vget_high_s16(v), vget_low_s16(v));
+                vst1q_s16(write_data + samples - 8 - i, v);
+            } else {
+                vst1q_s16(write_data + i, v);
+            }
+        }
+        vpair = vpmin_s16(vget_low_s16(vmin), vget_high_s16(vmin));
+        vpair = vpmin_s16(vpair, vpair);
+        vpair = vpmin_s16(vpair, vpair);
+        samp_min = vget_lane_s16(vpair, 0);
+        vpair = vpmax_s16(vget_low_s16(vmax), vget_high_s16(vmax));
+        vpair = vpmax_s16(vpair, vpair);
+        vpair = vpmax_s16(vpair, vpair);
+        samp_max = vget_lane_s16(vpair, 0);
     }
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 8bit unsigned ping pong */
-static int convert_8up(uint8_t *data, struct _sample *gus_sample) {
-    uint32_t loop_length = gus_sample->loop_end
-            - gus_sample->loop_start;
-    uint32_t dloop_length = loop_length * 2;
-    uint32_t new_length = gus_sample->data_length + dloop_length;
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->loop_start;
-    int16_t *write_data = NULL;
-    int16_t *write_data_a = NULL;
-    int16_t *write_data_b = NULL;
+#endif
 
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc((new_length + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        while (read_data < read_end) {
-            *write_data++ = ((*read_data++) ^ 0x80) << 8;
+    for (; i < samples; i++) {
+        if (is16) {
+            samp = (int16_t) ((data[i << 1] | (data[(i << 1) + 1] << 8)) ^ flip);
+        } else {
+            samp = (int16_t) ((data[i] << 8) ^ flip);
         }
-
-        *write_data = ((*read_data++) ^ 0x80) << 8;
-        write_data_a = write_data + dloop_length;
-        *write_data_a-- = *write_data;
-        write_data++;
-        write_data_b = write_data + dloop_length;
-        read_end = data + gus_sample->loop_end;
-        do {
-            *write_data = ((*read_data++) ^ 0x80) << 8;
-            *write_data_a-- = *write_data;
-            *write_data_b++ = *write_data;
-            write_data++;
-        } while (read_data != read_end);
-
-        *write_data = ((*read_data++) ^ 0x80) << 8;
-        *write_data_b++ = *write_data;
-        read_end = data + gus_sample->data_length;
-        while (read_data < read_end) {
-            *write_data_b++ = ((*read_data++) ^ 0x80) << 8;
+        if (samp < samp_min) samp_min = samp;
+        if (samp > samp_max) samp_max = samp;
+        if (reverse) {
+            write_data[samples - 1 - i] = samp;
+        } else {
+            write_data[i] = samp;
         }
-
-        gus_sample->loop_start += loop_length;
-        gus_sample->loop_end += dloop_length;
-        gus_sample->data_length = new_length;
-        gus_sample->modes ^= SAMPLE_PINGPONG | SAMPLE_UNSIGNED;
-        return 0;
     }
 
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
+    *peak_min = samp_min;
+    *peak_max = samp_max;
 }
 
-/* 8bit unsigned reverse */
-static int convert_8ur(uint8_t *data, struct _sample *gus_sample) {
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->data_length;
-    int16_t *write_data = NULL;
+static int convert_sample(uint8_t *data, struct _sample *gus_sample) {
+    uint32_t samples = gus_sample->data_length;
     uint32_t tmp_loop = 0;
 
     SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc((gus_sample->data_length + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data + gus_sample->data_length - 1;
-        do {
-            *write_data-- = ((*read_data++) ^ 0x80) << 8;
-        } while (read_data != read_end);
-        tmp_loop = gus_sample->loop_end;
-        gus_sample->loop_end = gus_sample->data_length - gus_sample->loop_start;
-        gus_sample->loop_start = gus_sample->data_length - tmp_loop;
-        gus_sample->loop_fraction = ((gus_sample->loop_fraction & 0x0f) << 4)
-                | ((gus_sample->loop_fraction & 0xf0) >> 4);
-        gus_sample->modes ^= SAMPLE_REVERSE | SAMPLE_UNSIGNED;
-        return 0;
-    }
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 8bit unsigned reverse ping pong */
-static int convert_8urp(uint8_t *data, struct _sample *gus_sample) {
-    uint32_t loop_length = gus_sample->loop_end
-            - gus_sample->loop_start;
-    uint32_t dloop_length = loop_length * 2;
-    uint32_t new_length = gus_sample->data_length + dloop_length;
-    uint8_t *read_data = data + gus_sample->data_length - 1;
-    uint8_t *read_end = data + gus_sample->loop_end;
-    int16_t *write_data = NULL;
-    int16_t *write_data_a = NULL;
-    int16_t *write_data_b = NULL;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc((new_length + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        do {
-            *write_data++ = ((*read_data--) ^ 0x80) << 8;
-        } while (read_data != read_end);
-
-        *write_data = ((*read_data--) ^ 0x80) << 8;
-        write_data_a = write_data + dloop_length;
-        *write_data_a-- = *write_data;
-        write_data++;
-        write_data_b = write_data + dloop_length;
-        read_end = data + gus_sample->loop_start;
-        do {
-            *write_data = ((*read_data--) ^ 0x80) << 8;
-            *write_data_a-- = *write_data;
-            *write_data_b++ = *write_data;
-            write_data++;
-        } while (read_data != read_end);
-
-        *write_data = ((*read_data--) ^ 0x80) << 8;
-        *write_data_b++ = *write_data;
-        read_end = data - 1;
-        do {
-            *write_data_b++ = ((*read_data--) ^ 0x80) << 8;
-        } while (read_data != read_end);
-        gus_sample->loop_start += loop_length;
-        gus_sample->loop_end += dloop_length;
-        gus_sample->data_length = new_length;
-        gus_sample->modes ^= SAMPLE_PINGPONG | SAMPLE_REVERSE | SAMPLE_UNSIGNED;
-        return 0;
-    }
-
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 16bit signed */
-static int convert_16s(uint8_t *data, struct _sample *gus_sample) {
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->data_length;
-    int16_t *write_data = NULL;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc(((gus_sample->data_length >> 1) + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        do {
-            *write_data = *read_data++;
-            *write_data++ |= (*read_data++) << 8;
-        } while (read_data < read_end);
-
-        gus_sample->loop_start >>= 1;
-        gus_sample->loop_end >>= 1;
-        gus_sample->data_length >>= 1;
-        return 0;
+    if (gus_sample->modes & SAMPLE_16BIT) {
+        samples >>= 1;
     }
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 16bit signed ping pong */
-static int convert_16sp(uint8_t *data, struct _sample *gus_sample) {
-    uint32_t loop_length = gus_sample->loop_end
-            - gus_sample->loop_start;
-    uint32_t dloop_length = loop_length * 2;
-    uint32_t new_length = gus_sample->data_length + dloop_length;
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->loop_start;
-    int16_t *write_data = NULL;
-    int16_t *write_data_a = NULL;
-    int16_t *write_data_b = NULL;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc(((new_length >> 1) + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        do {
-            *write_data = (*read_data++);
-            *write_data++ |= (*read_data++) << 8;
-        } while (read_data < read_end);
-
-        *write_data = (*read_data++);
-        *write_data |= (*read_data++) << 8;
-        write_data_a = write_data + (dloop_length >> 1);
-        *write_data_a-- = *write_data;
-        write_data++;
-        write_data_b = write_data + (dloop_length >> 1);
-        read_end = data + gus_sample->loop_end;
-        do {
-            *write_data = (*read_data++);
-            *write_data |= (*read_data++) << 8;
-            *write_data_a-- = *write_data;
-            *write_data_b++ = *write_data;
-            write_data++;
-        } while (read_data < read_end);
-
-        *write_data = *(read_data++);
-        *write_data |= (*read_data++) << 8;
-        *write_data_b++ = *write_data;
-        read_end = data + gus_sample->data_length;
-        if (__builtin_expect((read_data != read_end), 1)) {
-            do {
-                *write_data_b = *(read_data++);
-                *write_data_b++ |= (*read_data++) << 8;
-            } while (read_data < read_end);
-        }
-        gus_sample->loop_start += loop_length;
-        gus_sample->loop_end += dloop_length;
-        gus_sample->data_length = new_length;
-        gus_sample->modes ^= SAMPLE_PINGPONG;
-        gus_sample->loop_start >>= 1;
-        gus_sample->loop_end >>= 1;
-        gus_sample->data_length >>= 1;
-        return 0;
+    gus_sample->data = (int16_t *) calloc((samples + 2), sizeof(int16_t));
+    if (__builtin_expect((gus_sample->data == NULL), 0)) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
+        return -1;
     }
 
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 16bit signed reverse */
-static int convert_16sr(uint8_t *data, struct _sample *gus_sample) {
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->data_length;
-    int16_t *write_data = NULL;
-    uint32_t tmp_loop = 0;
+    convert_data(data, gus_sample->data, samples, gus_sample->modes,
+                 &gus_sample->peak_min, &gus_sample->peak_max);
 
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc(((gus_sample->data_length >> 1) + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data + (gus_sample->data_length >> 1) - 1;
-        do {
-            *write_data = *read_data++;
-            *write_data-- |= (*read_data++) << 8;
-        } while (read_data < read_end);
+    if (gus_sample->modes & SAMPLE_REVERSE) {
         tmp_loop = gus_sample->loop_end;
         gus_sample->loop_end = gus_sample->data_length - gus_sample->loop_start;
         gus_sample->loop_start = gus_sample->data_length - tmp_loop;
         gus_sample->loop_fraction = ((gus_sample->loop_fraction & 0x0f) << 4)
                 | ((gus_sample->loop_fraction & 0xf0) >> 4);
-        gus_sample->loop_start >>= 1;
-        gus_sample->loop_end >>= 1;
-        gus_sample->data_length >>= 1;
-        gus_sample->modes ^= SAMPLE_REVERSE;
-        return 0;
-    }
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 16bit signed reverse ping pong */
-static int convert_16srp(uint8_t *data, struct _sample *gus_sample) {
-    uint32_t loop_length = gus_sample->loop_end
-            - gus_sample->loop_start;
-    uint32_t dloop_length = loop_length * 2;
-    uint32_t new_length = gus_sample->data_length + dloop_length;
-    uint8_t *read_data = data + gus_sample->data_length - 1;
-    uint8_t *read_end = data + gus_sample->loop_end;
-    int16_t *write_data = NULL;
-    int16_t *write_data_a = NULL;
-    int16_t *write_data_b = NULL;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc(((new_length >> 1) + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        do {
-            *write_data = (*read_data--) << 8;
-            *write_data++ |= *read_data--;
-        } while (read_data < read_end);
-
-        *write_data = (*read_data-- << 8);
-        *write_data |= *read_data--;
-        write_data_a = write_data + (dloop_length >> 1);
-        *write_data_a-- = *write_data;
-        write_data++;
-        write_data_b = write_data + (dloop_length >> 1);
-        read_end = data + gus_sample->loop_start;
-        do {
-            *write_data = (*read_data--) << 8;
-            *write_data |= *read_data--;
-            *write_data_a-- = *write_data;
-            *write_data_b++ = *write_data;
-            write_data++;
-        } while (read_data < read_end);
-
-        *write_data = ((*read_data--) << 8);
-        *write_data |= *read_data--;
-        *write_data_b++ = *write_data;
-        read_end = data - 1;
-        do {
-            *write_data_b = (*read_data--) << 8;
-            *write_data_b++ |= *read_data--;
-        } while (read_data < read_end);
-        gus_sample->loop_start += loop_length;
-        gus_sample->loop_end += dloop_length;
-        gus_sample->data_length = new_length;
-        gus_sample->modes ^= SAMPLE_PINGPONG | SAMPLE_REVERSE;
-        return 0;
-    }
-
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 16bit unsigned */
-static int convert_16u(uint8_t *data, struct _sample *gus_sample) {
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->data_length;
-    int16_t *write_data = NULL;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc(((gus_sample->data_length >> 1) + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        do {
-            *write_data = *read_data++;
-            *write_data++ |= ((*read_data++) ^ 0x80) << 8;
-        } while (read_data < read_end);
-        gus_sample->loop_start >>= 1;
-        gus_sample->loop_end >>= 1;
-        gus_sample->data_length >>= 1;
-        gus_sample->modes ^= SAMPLE_UNSIGNED;
-        return 0;
     }
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 16bit unsigned ping pong */
-static int convert_16up(uint8_t *data, struct _sample *gus_sample) {
-    uint32_t loop_length = gus_sample->loop_end
-            - gus_sample->loop_start;
-    uint32_t dloop_length = loop_length * 2;
-    uint32_t new_length = gus_sample->data_length + dloop_length;
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->loop_start;
-    int16_t *write_data = NULL;
-    int16_t *write_data_a = NULL;
-    int16_t *write_data_b = NULL;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc(((new_length >> 1) + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        do {
-            *write_data = (*read_data++);
-            *write_data++ |= ((*read_data++) ^ 0x80) << 8;
-        } while (read_data < read_end);
-
-        *write_data = (*read_data++);
-        *write_data |= ((*read_data++) ^ 0x80) << 8;
-        write_data_a = write_data + (dloop_length >> 1);
-        *write_data_a-- = *write_data;
-        write_data++;
-        write_data_b = write_data + (dloop_length >> 1);
-        read_end = data + gus_sample->loop_end;
-        do {
-            *write_data = (*read_data++);
-            *write_data |= ((*read_data++) ^ 0x80) << 8;
-            *write_data_a-- = *write_data;
-            *write_data_b++ = *write_data;
-            write_data++;
-        } while (read_data < read_end);
-
-        *write_data = (*read_data++);
-        *write_data |= ((*read_data++) ^ 0x80) << 8;
-        *write_data_b++ = *write_data;
-        read_end = data + gus_sample->data_length;
-        if (__builtin_expect((read_data != read_end), 1)) {
-            do {
-                *write_data_b = (*read_data++);
-                *write_data_b++ |= ((*read_data++) ^ 0x80) << 8;
-            } while (read_data < read_end);
-        }
-        gus_sample->loop_start += loop_length;
-        gus_sample->loop_end += dloop_length;
-        gus_sample->data_length = new_length;
-        gus_sample->modes ^= SAMPLE_PINGPONG;
+    if (gus_sample->modes & SAMPLE_16BIT) {
         gus_sample->loop_start >>= 1;
         gus_sample->loop_end >>= 1;
         gus_sample->data_length >>= 1;
-        return 0;
     }
-
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 16bit unsigned reverse */
-static int convert_16ur(uint8_t *data, struct _sample *gus_sample) {
-    uint8_t *read_data = data;
-    uint8_t *read_end = data + gus_sample->data_length;
-    int16_t *write_data = NULL;
-    uint32_t tmp_loop = 0;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc(((gus_sample->data_length >> 1) + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data + (gus_sample->data_length >> 1) - 1;
-        do {
-            *write_data = *read_data++;
-            *write_data-- |= ((*read_data++) ^ 0x80) << 8;
-        } while (read_data < read_end);
-        tmp_loop = gus_sample->loop_end;
-        gus_sample->loop_end = gus_sample->data_length - gus_sample->loop_start;
-        gus_sample->loop_start = gus_sample->data_length - tmp_loop;
-        gus_sample->loop_fraction = ((gus_sample->loop_fraction & 0x0f) << 4)
-                | ((gus_sample->loop_fraction & 0xf0) >> 4);
-        gus_sample->loop_start >>= 1;
-        gus_sample->loop_end >>= 1;
-        gus_sample->data_length >>= 1;
-        gus_sample->modes ^= SAMPLE_REVERSE | SAMPLE_UNSIGNED;
-        return 0;
-    }
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
-}
-
-/* 16bit unsigned reverse ping pong */
-static int convert_16urp(uint8_t *data, struct _sample *gus_sample) {
-    uint32_t loop_length = gus_sample->loop_end
-            - gus_sample->loop_start;
-    uint32_t dloop_length = loop_length * 2;
-    uint32_t new_length = gus_sample->data_length + dloop_length;
-    uint8_t *read_data = data + gus_sample->data_length - 1;
-    uint8_t *read_end = data + gus_sample->loop_end;
-    int16_t *write_data = NULL;
-    int16_t *write_data_a = NULL;
-    int16_t *write_data_b = NULL;
-
-    SAMPLE_CONVERT_DEBUG(__FUNCTION__);
-    gus_sample->data = (int16_t *) calloc(((new_length >> 1) + 2), sizeof(int16_t));
-    if (__builtin_expect((gus_sample->data != NULL), 1)) {
-        write_data = gus_sample->data;
-        do {
-            *write_data = ((*read_data--) ^ 0x80) << 8;
-            *write_data++ |= *read_data--;
-        } while (read_data < read_end);
-
-        *write_data = ((*read_data--) ^ 0x80) << 8;
-        *write_data |= *read_data--;
-        write_data_a = write_data + (dloop_length >> 1);
-        *write_data_a-- = *write_data;
-        write_data++;
-        write_data_b = write_data + (dloop_length >> 1);
-        read_end = data + gus_sample->loop_start;
-        do {
-            *write_data = ((*read_data--) ^ 0x80) << 8;
-            *write_data |= *read_data--;
-            *write_data_a-- = *write_data;
-            *write_data_b++ = *write_data;
-            write_data++;
-        } while (read_data < read_end);
-
-        *write_data = ((*read_data--) ^ 0x80) << 8;
-        *write_data |= *read_data--;
-        *write_data_b++ = *write_data;
-        read_end = data - 1;
-        do {
-            *write_data_b = ((*read_data--) ^ 0x80) << 8;
-            *write_data_b++ |= *read_data--;
-        } while (read_data < read_end);
-        gus_sample->loop_start += loop_length;
-        gus_sample->loop_end += dloop_length;
-        gus_sample->data_length = new_length;
-        gus_sample->modes ^= SAMPLE_PINGPONG | SAMPLE_REVERSE | SAMPLE_UNSIGNED;
-        return 0;
-    }
-
-    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
-    return -1;
+    gus_sample->modes &= ~(SAMPLE_REVERSE | SAMPLE_UNSIGNED);
+    return 0;
 }
 
 /* sample loading */
 
 struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
+    struct _WM_Reader gus_file;
     uint8_t *gus_patch;
-    uint32_t gus_size;
-    uint32_t gus_ptr;
     uint8_t no_of_samples;
     uint8_t envsusreltime, envreltime;
     struct _sample *gus_sample = NULL;
     struct _sample *first_gus_sample = NULL;
     uint32_t i = 0;
 
-    int (*do_convert[])(uint8_t *data, struct _sample *gus_sample) = {
-        convert_8s,
-        convert_16s,
-        convert_8u,
-        convert_16u,
-        convert_8sp,
-        convert_16sp,
-        convert_8up,
-        convert_16up,
-        convert_8sr,
-        convert_16sr,
-        convert_8ur,
-        convert_16ur,
-        convert_8srp,
-        convert_16srp,
-        convert_8urp,
-        convert_16urp
-    };
     uint32_t tmp_loop;
 
     WMIDI_UNUSED(fix_release);
 
     SAMPLE_CONVERT_DEBUG(__FUNCTION__); SAMPLE_CONVERT_DEBUG(filename);
 
-    if ((gus_patch = (uint8_t *) _WM_BufferFile(filename, &gus_size)) == NULL) {
+    if (_WM_ReaderOpen(&gus_file, filename) == -1) {
         return NULL;
     }
-    if (gus_size < 239) {
-        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, filename, 0);
-        _WM_FreeBufferFile(gus_patch);
+    if ((gus_patch = _WM_ReaderGet(&gus_file, 239)) == NULL) {
+        _WM_ReaderClose(&gus_file);
         return NULL;
     }
     if (memcmp(gus_patch, "GF1PATCH110\0ID#000002", 22)
             && memcmp(gus_patch, "GF1PATCH100\0ID#000002", 22)) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID, filename, 0);
-        _WM_FreeBufferFile(gus_patch);
+        _WM_ReaderClose(&gus_file);
         return NULL;
     }
     if (gus_patch[82] > 1) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID, filename, 0);
-        _WM_FreeBufferFile(gus_patch);
+        _WM_ReaderClose(&gus_file);
         return NULL;
     }
     if (gus_patch[151] > 1) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID, filename, 0);
-        _WM_FreeBufferFile(gus_patch);
+        _WM_ReaderClose(&gus_file);
         return NULL;
     }
 
@@ -755,9 +247,7 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
     GUSPAT_INT_DEBUG("voices",gus_patch[83]);
 
     no_of_samples = gus_patch[198];
-    gus_ptr = 239;
     while (no_of_samples) {
-        uint32_t tmp_cnt;
         if (first_gus_sample == NULL) {
             first_gus_sample = (struct _sample *) malloc(sizeof(struct _sample));
             gus_sample = first_gus_sample;
@@ -767,38 +257,42 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
         }
         if (gus_sample == NULL) {
             _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
-            _WM_FreeBufferFile(gus_patch);
+            _WM_ReaderClose(&gus_file);
             return NULL;
         }
 
         gus_sample->next = NULL;
-        gus_sample->loop_fraction = gus_patch[gus_ptr + 7];
-        gus_sample->data_length = (gus_patch[gus_ptr + 11] << 24)
-                                | (gus_patch[gus_ptr + 10] << 16)
-                                | (gus_patch[gus_ptr + 9]  <<  8)
-                                |  gus_patch[gus_ptr + 8];
-        gus_sample->loop_start  = (gus_patch[gus_ptr + 15] << 24)
-                                | (gus_patch[gus_ptr + 14] << 16)
-                                | (gus_patch[gus_ptr + 13] <<  8)
-                                |  gus_patch[gus_ptr + 12];
-        gus_sample->loop_end    = (gus_patch[gus_ptr + 19] << 24)
-                                | (gus_patch[gus_ptr + 18] << 16)
-                                | (gus_patch[gus_ptr + 17] <<  8)
-                                |  gus_patch[gus_ptr + 16];
-        gus_sample->rate        = (gus_patch[gus_ptr + 21] << 8)
-                                |  gus_patch[gus_ptr + 20];
-        gus_sample->freq_low    = (gus_patch[gus_ptr + 25] << 24)
-                                | (gus_patch[gus_ptr + 24] << 16)
-                                | (gus_patch[gus_ptr + 23] <<  8)
-                                |  gus_patch[gus_ptr + 22];
-        gus_sample->freq_high   = (gus_patch[gus_ptr + 29] << 24)
-                                | (gus_patch[gus_ptr + 28] << 16)
-                                | (gus_patch[gus_ptr + 27] <<  8)
-                                |  gus_patch[gus_ptr + 26];
-        gus_sample->freq_root   = (gus_patch[gus_ptr + 33] << 24)
-                                | (gus_patch[gus_ptr + 32] << 16)
-                                | (gus_patch[gus_ptr + 31] <<  8)
-                                |  gus_patch[gus_ptr + 30];
+        if ((gus_patch = _WM_ReaderGet(&gus_file, 96)) == NULL) {
+            _WM_ReaderClose(&gus_file);
+            return NULL;
+        }
+        gus_sample->loop_fraction = gus_patch[7];
+        gus_sample->data_length = (gus_patch[11] << 24)
+                                | (gus_patch[10] << 16)
+                                | (gus_patch[9]  <<  8)
+                                |  gus_patch[8];
+        gus_sample->loop_start  = (gus_patch[15] << 24)
+                                | (gus_patch[14] << 16)
+                                | (gus_patch[13] <<  8)
+                                |  gus_patch[12];
+        gus_sample->loop_end    = (gus_patch[19] << 24)
+                                | (gus_patch[18] << 16)
+                                | (gus_patch[17] <<  8)
+                                |  gus_patch[16];
+        gus_sample->rate        = (gus_patch[21] << 8)
+                                |  gus_patch[20];
+        gus_sample->freq_low    = (gus_patch[25] << 24)
+                                | (gus_patch[24] << 16)
+                                | (gus_patch[23] <<  8)
+                                |  gus_patch[22];
+        gus_sample->freq_high   = (gus_patch[29] << 24)
+                                | (gus_patch[28] << 16)
+                                | (gus_patch[27] <<  8)
+                                |  gus_patch[26];
+        gus_sample->freq_root   = (gus_patch[33] << 24)
+                                | (gus_patch[32] << 16)
+                                | (gus_patch[31] <<  8)
+                                |  gus_patch[30];
 
         /* This is done this way instead of ((freq * 1024) / rate) to avoid 32bit overflow. */
         /* Result is 0.001% inacurate */
@@ -807,12 +301,12 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
 #if 0
         /* We dont use this info at this time, kept in here for info */
         printf("\rTremolo Sweep: %i, Rate: %i, Depth %i\n",
-                gus_patch[gus_ptr+49], gus_patch[gus_ptr+50], gus_patch[gus_ptr+51]);
+                gus_patch[49], gus_patch[50], gus_patch[51]);
         printf("\rVibrato Sweep: %i, Rate: %i, Depth %i\n",
-                gus_patch[gus_ptr+52], gus_patch[gus_ptr+53], gus_patch[gus_ptr+54]);
+                gus_patch[52], gus_patch[53], gus_patch[54]);
 #endif
-        gus_sample->modes = gus_patch[gus_ptr + 55];
-        GUSPAT_START_DEBUG(); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_16BIT, "16bit "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_UNSIGNED, "Unsigned "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_LOOP, "Loop "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_PINGPONG, "PingPong "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_REVERSE, "Reverse "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_SUSTAIN, "Sustain "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_ENVELOPE, "Envelope "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_CLAMPED, "Clamped "); GUSPAT_END_DEBUG();
+        gus_sample->modes = gus_patch[55];
+        GUSPAT_START_DEBUG(); GUSPAT_MODE_DEBUG(gus_patch[55], SAMPLE_16BIT, "16bit "); GUSPAT_MODE_DEBUG(gus_patch[55], SAMPLE_UNSIGNED, "Unsigned "); GUSPAT_MODE_DEBUG(gus_patch[55], SAMPLE_LOOP, "Loop "); GUSPAT_MODE_DEBUG(gus_patch[55], SAMPLE_PINGPONG, "PingPong "); GUSPAT_MODE_DEBUG(gus_patch[55], SAMPLE_REVERSE, "Reverse "); GUSPAT_MODE_DEBUG(gus_patch[55], SAMPLE_SUSTAIN, "Sustain "); GUSPAT_MODE_DEBUG(gus_patch[55], SAMPLE_ENVELOPE, "Envelope "); GUSPAT_MODE_DEBUG(gus_patch[55], SAMPLE_CLAMPED, "Clamped "); GUSPAT_END_DEBUG();
 
         if (gus_sample->loop_start > gus_sample->loop_end) {
             tmp_loop = gus_sample->loop_end;
@@ -826,27 +320,27 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
         // All sorts of annoying things happen with pat files.
         // One of them is that the sustained release time and
         // normal release time gets mixed up because software got muddled
-        envsusreltime = env_time_table[gus_patch[gus_ptr + 40]];
-        envreltime = env_time_table[gus_patch[gus_ptr + 41]];
+        envsusreltime = env_time_table[gus_patch[40]];
+        envreltime = env_time_table[gus_patch[41]];
         if (envsusreltime < envreltime) {
             // EXPERIMENTAL
-            gus_patch[gus_ptr + 40] = gus_patch[gus_ptr + 41];
+            gus_patch[40] = gus_patch[41];
             // timidity does this:
-            gus_patch[gus_ptr + 41] = 0x3f;
-            gus_patch[gus_ptr + 42] = 0x3f;
+            gus_patch[41] = 0x3f;
+            gus_patch[42] = 0x3f;
 
-            gus_patch[gus_ptr + 46] = gus_patch[gus_ptr + 47];
-            gus_patch[gus_ptr + 47] = 0;
-            gus_patch[gus_ptr + 48] = 0;
+            gus_patch[46] = gus_patch[47];
+            gus_patch[47] = 0;
+            gus_patch[48] = 0;
         }
 
         // lets set up the envelope data
         for (i = 0; i < 6; i++) {
             GUSPAT_INT_DEBUG("Envelope #",i);
             if (gus_sample->modes & SAMPLE_ENVELOPE) {
-                uint8_t env_rate = gus_patch[gus_ptr + 37 + i];
-                gus_sample->env_target[i] = 16448 * gus_patch[gus_ptr + 43 + i];
-                GUSPAT_INT_DEBUG("Envelope Level",gus_patch[gus_ptr+43+i]); GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[env_rate]);
+                uint8_t env_rate = gus_patch[37 + i];
+                gus_sample->env_target[i] = 16448 * gus_patch[43 + i];
+                GUSPAT_INT_DEBUG("Envelope Level",gus_patch[43+i]); GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[env_rate]);
                 gus_sample->env_rate[i] = (int32_t) (4194303.0f
                         / ((float) _WM_SampleRate * env_time_table[env_rate]));
                 GUSPAT_INT_DEBUG("Envelope Rate",gus_sample->env_rate[i]); GUSPAT_INT_DEBUG("GUSPAT Rate",env_rate);
@@ -869,13 +363,12 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
         gus_sample->env_rate[6] = (int32_t) (4194303.0f
                 / ((float) _WM_SampleRate * env_time_table[63]));
 
-        gus_ptr += 96;
-        tmp_cnt = gus_sample->data_length;
-
-        if (do_convert[(((gus_sample->modes & 0x18) >> 1)
-                | (gus_sample->modes & 0x03))](&gus_patch[gus_ptr], gus_sample)
-                == -1) {
-            _WM_FreeBufferFile(gus_patch);
+        if ((gus_patch = _WM_ReaderGet(&gus_file, gus_sample->data_length)) == NULL) {
+            _WM_ReaderClose(&gus_file);
+            return NULL;
+        }
+        if (convert_sample(gus_patch, gus_sample) == -1) {
+            _WM_ReaderClose(&gus_file);
             return NULL;
         }
 
@@ -905,7 +398,6 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
             gus_sample->note_off_decay = gus_sample->data_length * _WM_SampleRate / gus_sample->rate;
         }
 
-        gus_ptr += tmp_cnt;
         gus_sample->loop_start = (gus_sample->loop_start << 10)
                 | (((gus_sample->loop_fraction & 0x0f) << 10) / 16);
         gus_sample->loop_end = (gus_sample->loop_end << 10)
@@ -914,6 +406,6 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
         gus_sample->data_length = gus_sample->data_length << 10;
         no_of_samples--;
     }
-    _WM_FreeBufferFile(gus_patch);
+    _WM_ReaderClose(&gus_file);
     return first_gus_sample;
 }
@@ -24,6 +24,7 @@
 #include "config.h"
 
 #include <stdint.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -33,13 +34,19 @@
 #include "lock.h"
 #include "wm_error.h"
 #include "reverb.h"
+#include "chorus.h"
+#include "upsample.h"
 #include "sample.h"
 #include "wildmidi_lib.h"
 #include "patches.h"
 #include "internal_midi.h"
+#include "f_midi.h"
 
 #define HOLD_OFF 0x02
 
+/* seconds of playback between seek checkpoints */
+#define CHECKPOINT_INTERVAL 10
+
 //#define DEBUG_MIDI
 
 #ifdef DEBUG_MIDI
@@ -506,8 +513,33 @@ void _WM_AdjustNoteVolumes(struct _mdi *mdi, uint8_t ch, struct _note *nte) {
         premix_left = premix_lin * pow(10.0, (premix_dBm_left / 20)) * volume_adj;
         premix_right = premix_lin * pow(10.0, (premix_dBm_right / 20)) * volume_adj;
     }
+    if (_WM_MixerOptions & WM_MO_MONO) {
+        /*
+         the mixers only play the left. The pan law keeps the power of the
+         two sides at that of the note unpanned, so play it unpanned
+         rather than 3dB down in the middle as an average would be.
+         */
+        if (mdi->extra_info.mixer_options & WM_MO_LOG_VOLUME) {
+            premix_left = pow(10.0, (dBm_volume[vol_ofs] / 20.0)) * volume_adj;
+        } else {
+            premix_left = ((double)(_WM_lin_volume[vol_ofs]) / 1024.0) * volume_adj;
+        }
+        premix_right = 0.0;
+    }
     nte->left_mix_volume = (int32_t)(premix_left * 1024.0);
     nte->right_mix_volume = (int32_t)(premix_right * 1024.0);
+    /* out of 1024, so a send of 127 sends all of the note */
+    nte->reverb_send = ((mdi->channel[ch].reverb * 1024) + 63) / 127;
+    nte->chorus_send = ((mdi->channel[ch].chorus * 1024) + 63) / 127;
+
+    if (mdi->channel[ch].lpf_b0 && !nte->lpf_b0) {
+        /* was open, start from rest */
+        nte->lpf_x[0] = nte->lpf_x[1] = 0;
+        nte->lpf_y[0] = nte->lpf_y[1] = 0;
+    }
+    nte->lpf_b0 = mdi->channel[ch].lpf_b0;
+    nte->lpf_a1 = mdi->channel[ch].lpf_a1;
+    nte->lpf_a2 = mdi->channel[ch].lpf_a2;
 }
 
 /* Should be called in any function that effects channel volumes */
@@ -545,12 +577,257 @@ float _WM_GetSamplesPerTick(uint32_t divisions, uint32_t tempo) {
     return (samples_per_tick);
 }
 
-static void _WM_CheckEventMemoryPool(struct _mdi *mdi) {
-    if ((mdi->event_count + 1) >= mdi->events_size) {
-        mdi->events_size += MEM_CHUNK;
-        mdi->events = (struct _event *) realloc(mdi->events,
-                              (mdi->events_size * sizeof(struct _event)));
+/* until the song sets one */
+static struct _tempo_change default_tempo = { 0, 500000, 0, 0 };
+
+/*
+ * Sample position of a tick at or after the tempo change, whole samples
+ * returned and the fraction left in frac. All in integers so long songs
+ * don't drift.
+ */
+static uint64_t tempo_tick_to_sample(struct _mdi *mdi, struct _tempo_change *tempo, uint32_t tick, uint64_t *frac) {
+    uint64_t per_sample = (uint64_t) mdi->divisions * 1000000;
+    uint64_t time = (uint64_t) (tick - tempo->tick) * tempo->tempo;
+    uint64_t part = (time % per_sample) * _WM_SampleRate + tempo->frac;
+
+    if (frac != NULL) *frac = part % per_sample;
+    return (tempo->sample + ((time / per_sample) * _WM_SampleRate) + (part / per_sample));
+}
+
+/* the last tempo change at or before tick */
+static struct _tempo_change *find_tempo_by_tick(struct _mdi *mdi, uint32_t tick) {
+    uint32_t lo = 0;
+    uint32_t hi = mdi->tempo_count;
+    uint32_t mid;
+
+    if (!hi) return (&default_tempo);
+    while ((hi - lo) > 1) {
+        mid = (lo + hi) >> 1;
+        if (mdi->tempo_map[mid].tick <= tick) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (&mdi->tempo_map[lo]);
+}
+
+/* the last tempo change at or before sample */
+static struct _tempo_change *find_tempo_by_sample(struct _mdi *mdi, uint32_t sample) {
+    uint32_t lo = 0;
+    uint32_t hi = mdi->tempo_count;
+    uint32_t mid;
+
+    if (!hi) return (&default_tempo);
+    while ((hi - lo) > 1) {
+        mid = (lo + hi) >> 1;
+        if (mdi->tempo_map[mid].sample <= sample) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (&mdi->tempo_map[lo]);
+}
+
+/*
+ * Change tempo where the parsed song so far ends. Parsers call this
+ * instead of working out samples per tick themselves so the tempo map
+ * is what the song is actually timed by.
+ */
+int _WM_SetTempo(struct _mdi *mdi, uint32_t tempo) {
+    struct _tempo_change *tempo_change;
+    uint64_t frac = 0;
+    uint32_t sample = 0;
+
+    if (mdi->tempo_count) {
+        tempo_change = &mdi->tempo_map[mdi->tempo_count - 1];
+        if (tempo_change->tick == mdi->tempo_tick) {
+            /* nothing was timed by the old one */
+            tempo_change->tempo = tempo;
+            return (0);
+        }
+        sample = (uint32_t) tempo_tick_to_sample(mdi, tempo_change, mdi->tempo_tick, &frac);
+    }
+
+    if (mdi->tempo_count == mdi->tempo_size) {
+        uint32_t size = mdi->tempo_size + (mdi->tempo_size >> 1) + 16;
+
+        tempo_change = (struct _tempo_change *) realloc(mdi->tempo_map,
+                           (size * sizeof(struct _tempo_change)));
+        if (tempo_change == NULL) {
+            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
+            return (-1);
+        }
+        mdi->tempo_map = tempo_change;
+        mdi->tempo_size = size;
+    }
+
+    tempo_change = &mdi->tempo_map[mdi->tempo_count++];
+    tempo_change->tick = mdi->tempo_tick;
+    tempo_change->tempo = tempo;
+    tempo_change->sample = sample;
+    tempo_change->frac = frac;
+    return (0);
+}
+
+/*
+ * Move the end of the parsed song on by ticks, the samples they take
+ * going to the last event.
+ */
+int _WM_AdvanceTicks(struct _mdi *mdi, uint32_t ticks) {
+    struct _tempo_change *tempo_change;
+    uint64_t start;
+    uint64_t end;
+
+    if ((mdi->divisions == 0) || (ticks > (0xffffffff - mdi->tempo_tick))) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, NULL, 0);
+        return (-1);
+    }
+    if (!ticks) return (0);
+    if ((!mdi->tempo_count) && (_WM_SetTempo(mdi, 500000) < 0)) {
+        return (-1);
     }
+
+    tempo_change = &mdi->tempo_map[mdi->tempo_count - 1];
+    start = tempo_tick_to_sample(mdi, tempo_change, mdi->tempo_tick, NULL);
+    end = tempo_tick_to_sample(mdi, tempo_change, mdi->tempo_tick + ticks, NULL);
+    if (((end - start) >= 0x7fffffff) || (end > 0xffffffff)) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, NULL, 0);
+        return (-1);
+    }
+
+    mdi->tempo_tick += ticks;
+    mdi->events[mdi->event_count - 1].samples_to_next += (uint32_t) (end - start);
+    mdi->extra_info.approx_total_samples += (uint32_t) (end - start);
+    return (0);
+}
+
+/*
+ * Where tick falls in the song as parsed, in samples from the start of
+ * the song before any silence was stripped. Ticks past the end carry on
+ * at the last tempo.
+ */
+uint32_t _WM_TickToSample(struct _mdi *mdi, uint32_t tick) {
+    uint64_t sample;
+
+    if (mdi->divisions == 0) return (0);
+    sample = tempo_tick_to_sample(mdi, find_tempo_by_tick(mdi, tick), tick, NULL);
+    return ((sample > 0xffffffff) ? 0xffffffff : (uint32_t) sample);
+}
+
+/*
+ * The last tick falling on or before sample, so that
+ * _WM_SampleToTick(_WM_TickToSample(tick)) is tick whenever
+ * ticks are at least a sample long.
+ */
+uint32_t _WM_SampleToTick(struct _mdi *mdi, uint32_t sample) {
+    struct _tempo_change *tempo_change;
+    uint64_t per_sample;
+    uint64_t last;
+    uint64_t tick;
+    double tick_f;
+
+    if (mdi->divisions == 0) return (0);
+    tempo_change = find_tempo_by_sample(mdi, sample);
+    if ((tempo_change == &default_tempo)
+        || (tempo_change == &mdi->tempo_map[mdi->tempo_count - 1])) {
+        last = 0xffffffff;
+    } else {
+        last = tempo_change[1].tick - 1;
+    }
+
+    /* close enough to only be a tick or so out, which is put right below */
+    per_sample = (uint64_t) mdi->divisions * 1000000;
+    tick_f = ((double) (sample - tempo_change->sample + 1) * (double) per_sample
+              - (double) tempo_change->frac)
+             / ((double) tempo_change->tempo * (double) _WM_SampleRate);
+    if (tick_f >= (double) (last - tempo_change->tick)) {
+        tick = last;
+    } else {
+        tick = tempo_change->tick + (uint64_t) tick_f;
+    }
+
+    while ((tick > tempo_change->tick)
+           && (tempo_tick_to_sample(mdi, tempo_change, (uint32_t) tick, NULL) > sample)) {
+        tick--;
+    }
+    while ((tick < last)
+           && (tempo_tick_to_sample(mdi, tempo_change, (uint32_t) (tick + 1), NULL) <= sample)) {
+        tick++;
+    }
+    return ((uint32_t) tick);
+}
+
+/*
+ * Make sure there is room for one more event and the terminator.
+ * Failing to grow leaves the pool as it was.
+ */
+static int _WM_CheckEventMemoryPool(struct _mdi *mdi) {
+    struct _event *events;
+    uint32_t events_size;
+
+    if ((mdi->event_count + 1) < mdi->events_size) return (0);
+    /* grow by half so huge files don't spend their time in realloc */
+    events_size = mdi->events_size + (mdi->events_size >> 1) + MEM_CHUNK;
+    events = (struct _event *) realloc(mdi->events,
+                              (events_size * sizeof(struct _event)));
+    if (events == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, "to grow events", 0);
+        return (-1);
+    }
+    mdi->events = events;
+    mdi->events_size = events_size;
+    return (0);
+}
+
+/*
+ * Guess how many events size bytes of song data hold at per_event
+ * bytes each, keeping the guess to about 4 times the data itself so
+ * a bad guess can't reserve far more than the file could need.
+ */
+uint32_t _WM_GuessEvents(uint32_t size, uint32_t per_event) {
+    uint32_t count = size / per_event;
+    uint32_t limit = (uint32_t) (((uint64_t) size * 4) / sizeof(struct _event));
+
+    return ((count < limit) ? count : limit);
+}
+
+/*
+ * Make room for count events plus the terminating ev_null up front,
+ * parsers call this with _WM_GuessEvents() on the size of their data.
+ * Guessing wrong is harmless, _WM_CheckEventMemoryPool still grows
+ * the pool and _WM_ShrinkEvents trims it once parsing is done.
+ */
+int _WM_ReserveEvents(struct _mdi *mdi, uint32_t count) {
+    struct _event *events;
+
+    if (count < mdi->events_size) return (0);
+    events = (struct _event *) realloc(mdi->events,
+                              ((count + 1) * sizeof(struct _event)));
+    if (events == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, "to reserve events", 0);
+        return (-1);
+    }
+    mdi->events = events;
+    mdi->events_size = count + 1;
+    return (0);
+}
+
+/*
+ * Release whatever the pool has left over, keeping the terminator.
+ * Failing to shrink leaves the pool as it was, so there is nothing
+ * to report.
+ */
+void _WM_ShrinkEvents(struct _mdi *mdi) {
+    struct _event *events;
+
+    if ((mdi->event_count + 1) >= mdi->events_size) return;
+    events = (struct _event *) realloc(mdi->events,
+                              ((mdi->event_count + 1) * sizeof(struct _event)));
+    if (events == NULL) return;
+    mdi->events = events;
+    mdi->events_size = mdi->event_count + 1;
 }
 
 void _WM_do_note_off_extra(struct _note *nte) {
@@ -597,7 +874,7 @@ void _WM_do_note_off_extra(struct _note *nte) {
 }
 
 
-void _WM_do_midi_divisions(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_midi_divisions(struct _mdi *mdi, struct _event *data) {
     // placeholder function so we can record divisions in the event stream
     // for conversion function _WM_Event2Midi()
     WMIDI_UNUSED(mdi);
@@ -605,7 +882,7 @@ void _WM_do_midi_divisions(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_note_off(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_note_off(struct _mdi *mdi, struct _event *data) {
     struct _note *nte;
     uint8_t ch = data->channel;
 
@@ -654,7 +931,7 @@ static inline uint32_t get_inc(struct _mdi *mdi, struct _note *nte) {
              / nte->sample->inc_div));
 }
 
-void _WM_do_note_on(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_note_on(struct _mdi *mdi, struct _event *data) {
     struct _note *nte;
     struct _note *prev_nte;
     struct _note *nte_array;
@@ -741,14 +1018,16 @@ void _WM_do_note_on(struct _mdi *mdi, struct _event_data *data) {
     nte->env_inc = nte->sample->env_rate[0];
     nte->env_level = 0;
     nte->modes = sample->modes;
+    nte->loop_reverse = 0;
     nte->hold = mdi->channel[ch].hold;
     nte->replay = NULL;
     nte->is_off = 0;
     nte->ignore_chan_events = 0;
+    nte->lpf_b0 = 0;
     _WM_AdjustNoteVolumes(mdi, ch, nte);
 }
 
-void _WM_do_aftertouch(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_aftertouch(struct _mdi *mdi, struct _event *data) {
     struct _note *nte;
     uint8_t ch = data->channel;
 
@@ -770,14 +1049,14 @@ void _WM_do_aftertouch(struct _mdi *mdi, struct _event_data *data) {
     }
 }
 
-void _WM_do_control_bank_select(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_control_bank_select(struct _mdi *mdi, struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
     mdi->channel[ch].bank = data->data.value;
 }
 
 void _WM_do_control_data_entry_course(struct _mdi *mdi,
-                                         struct _event_data *data) {
+                                         struct _event *data) {
     uint8_t ch = data->channel;
     int data_tmp;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
@@ -792,7 +1071,7 @@ void _WM_do_control_data_entry_course(struct _mdi *mdi,
 }
 
 void _WM_do_control_channel_volume(struct _mdi *mdi,
-                                      struct _event_data *data) {
+                                      struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
 
@@ -801,7 +1080,7 @@ void _WM_do_control_channel_volume(struct _mdi *mdi,
 }
 
 void _WM_do_control_channel_balance(struct _mdi *mdi,
-                                       struct _event_data *data) {
+                                       struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
 
@@ -809,7 +1088,7 @@ void _WM_do_control_channel_balance(struct _mdi *mdi,
     _WM_AdjustChannelVolumes(mdi, ch);
 }
 
-void _WM_do_control_channel_pan(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_control_channel_pan(struct _mdi *mdi, struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
 
@@ -818,7 +1097,7 @@ void _WM_do_control_channel_pan(struct _mdi *mdi, struct _event_data *data) {
 }
 
 void _WM_do_control_channel_expression(struct _mdi *mdi,
-                                          struct _event_data *data) {
+                                          struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
 
@@ -827,7 +1106,7 @@ void _WM_do_control_channel_expression(struct _mdi *mdi,
 }
 
 void _WM_do_control_data_entry_fine(struct _mdi *mdi,
-                                       struct _event_data *data) {
+                                       struct _event *data) {
     uint8_t ch = data->channel;
     int data_tmp;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
@@ -841,7 +1120,7 @@ void _WM_do_control_data_entry_fine(struct _mdi *mdi,
     }
 }
 
-void _WM_do_control_channel_hold(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_control_channel_hold(struct _mdi *mdi, struct _event *data) {
     struct _note *note_data = mdi->note;
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
@@ -908,7 +1187,7 @@ void _WM_do_control_channel_hold(struct _mdi *mdi, struct _event_data *data) {
 }
 
 void _WM_do_control_data_increment(struct _mdi *mdi,
-                                      struct _event_data *data) {
+                                      struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
 
@@ -920,7 +1199,7 @@ void _WM_do_control_data_increment(struct _mdi *mdi,
 }
 
 void _WM_do_control_data_decrement(struct _mdi *mdi,
-                                      struct _event_data *data) {
+                                      struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
 
@@ -931,7 +1210,7 @@ void _WM_do_control_data_decrement(struct _mdi *mdi,
     }
 }
 void _WM_do_control_non_registered_param_fine(struct _mdi *mdi,
-                                            struct _event_data *data) {
+                                            struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
     mdi->channel[ch].reg_data = (mdi->channel[ch].reg_data & 0x3F80)
@@ -940,7 +1219,7 @@ void _WM_do_control_non_registered_param_fine(struct _mdi *mdi,
 }
 
 void _WM_do_control_non_registered_param_course(struct _mdi *mdi,
-                                     struct _event_data *data) {
+                                     struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
     mdi->channel[ch].reg_data = (mdi->channel[ch].reg_data & 0x7F)
@@ -949,7 +1228,7 @@ void _WM_do_control_non_registered_param_course(struct _mdi *mdi,
 }
 
 void _WM_do_control_registered_param_fine(struct _mdi *mdi,
-                                          struct _event_data *data) {
+                                          struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
     mdi->channel[ch].reg_data = (mdi->channel[ch].reg_data & 0x3F80)
@@ -958,7 +1237,7 @@ void _WM_do_control_registered_param_fine(struct _mdi *mdi,
 }
 
 void _WM_do_control_registered_param_course(struct _mdi *mdi,
-                                            struct _event_data *data) {
+                                            struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
     mdi->channel[ch].reg_data = (mdi->channel[ch].reg_data & 0x7F)
@@ -967,7 +1246,7 @@ void _WM_do_control_registered_param_course(struct _mdi *mdi,
 }
 
 void _WM_do_control_channel_sound_off(struct _mdi *mdi,
-                                      struct _event_data *data) {
+                                      struct _event *data) {
     struct _note *note_data = mdi->note;
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
@@ -986,7 +1265,7 @@ void _WM_do_control_channel_sound_off(struct _mdi *mdi,
 }
 
 void _WM_do_control_channel_controllers_off(struct _mdi *mdi,
-                                            struct _event_data *data) {
+                                            struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
 
@@ -1002,7 +1281,7 @@ void _WM_do_control_channel_controllers_off(struct _mdi *mdi,
 }
 
 void _WM_do_control_channel_notes_off(struct _mdi *mdi,
-                                      struct _event_data *data) {
+                                      struct _event *data) {
     struct _note *note_data = mdi->note;
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
@@ -1035,7 +1314,66 @@ void _WM_do_control_channel_notes_off(struct _mdi *mdi,
     }
 }
 
-void _WM_do_control_dummy(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_control_channel_reverb(struct _mdi *mdi, struct _event *data) {
+    uint8_t ch = data->channel;
+    MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
+
+    mdi->channel[ch].reverb = data->data.value;
+    _WM_AdjustChannelVolumes(mdi, ch);
+}
+
+void _WM_do_control_channel_chorus(struct _mdi *mdi, struct _event *data) {
+    uint8_t ch = data->channel;
+    MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
+
+    mdi->channel[ch].chorus = data->data.value;
+    _WM_AdjustChannelVolumes(mdi, ch);
+}
+
+/*
+ Brightness below 64 closes a resonant low pass on the channel, an octave
+ for every 10 or so steps down from 16kHz. 64 and over leave it open.
+ */
+static void set_channel_lpf(struct _mdi *mdi, uint8_t ch) {
+    double freq;
+    double w0;
+    double alpha;
+    double a0;
+
+    if (mdi->channel[ch].brightness >= 64) {
+        mdi->channel[ch].lpf_b0 = 0;
+        mdi->channel[ch].lpf_a1 = 0;
+        mdi->channel[ch].lpf_a2 = 0;
+        return;
+    }
+
+    freq = 16000.0 * pow(2.0, ((double)(mdi->channel[ch].brightness - 64) * 6.0 / 64.0));
+    if (freq > (double)_WM_SampleRate * 0.45) {
+        freq = (double)_WM_SampleRate * 0.45;
+    }
+    w0 = 2.0 * M_PI * freq / (double)_WM_SampleRate;
+    alpha = sin(w0) / (2.0 * 1.414); /* Q of 1.414, a small peak at the cutoff */
+    a0 = 1.0 + alpha;
+
+    /* b1 is 2 * b0 and b2 is b0, so only b0 is kept */
+    mdi->channel[ch].lpf_b0 = (int32_t)(((1.0 - cos(w0)) / 2.0 / a0) * (1 << LPF_BITS));
+    if (mdi->channel[ch].lpf_b0 == 0) {
+        mdi->channel[ch].lpf_b0 = 1;
+    }
+    mdi->channel[ch].lpf_a1 = (int32_t)((-2.0 * cos(w0) / a0) * (1 << LPF_BITS));
+    mdi->channel[ch].lpf_a2 = (int32_t)(((1.0 - alpha) / a0) * (1 << LPF_BITS));
+}
+
+void _WM_do_control_channel_brightness(struct _mdi *mdi, struct _event *data) {
+    uint8_t ch = data->channel;
+    MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
+
+    mdi->channel[ch].brightness = data->data.value;
+    set_channel_lpf(mdi, ch);
+    _WM_AdjustChannelVolumes(mdi, ch);
+}
+
+void _WM_do_control_dummy(struct _mdi *mdi, struct _event *data) {
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__, ch, data->data.value);
@@ -1045,7 +1383,7 @@ void _WM_do_control_dummy(struct _mdi *mdi, struct _event_data *data) {
     WMIDI_UNUSED(mdi);
 }
 
-void _WM_do_patch(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_patch(struct _mdi *mdi, struct _event *data) {
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
     if (!mdi->channel[ch].isdrum) {
@@ -1056,7 +1394,7 @@ void _WM_do_patch(struct _mdi *mdi, struct _event_data *data) {
     }
 }
 
-void _WM_do_channel_pressure(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_channel_pressure(struct _mdi *mdi, struct _event *data) {
     uint8_t ch = data->channel;
     struct _note *note_data = mdi->note;
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
@@ -1078,7 +1416,7 @@ void _WM_do_channel_pressure(struct _mdi *mdi, struct _event_data *data) {
     }
 }
 
-void _WM_do_pitch(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_pitch(struct _mdi *mdi, struct _event *data) {
     struct _note *note_data = mdi->note;
     uint8_t ch = data->channel;
 
@@ -1103,7 +1441,7 @@ void _WM_do_pitch(struct _mdi *mdi, struct _event_data *data) {
     }
 }
 
-void _WM_do_sysex_roland_drum_track(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_sysex_roland_drum_track(struct _mdi *mdi, struct _event *data) {
     uint8_t ch = data->channel;
 
     MIDI_EVENT_DEBUG(__FUNCTION__,ch, data->data.value);
@@ -1117,7 +1455,7 @@ void _WM_do_sysex_roland_drum_track(struct _mdi *mdi, struct _event_data *data)
     }
 }
 
-void _WM_do_sysex_gm_reset(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_sysex_gm_reset(struct _mdi *mdi, struct _event *data) {
     int i;
 
     if (data != NULL) {
@@ -1137,11 +1475,19 @@ void _WM_do_sysex_gm_reset(struct _mdi *mdi, struct _event_data *data) {
         mdi->channel[i].volume = 100;
         mdi->channel[i].pressure = 127;
         mdi->channel[i].expression = 127;
+        mdi->channel[i].reverb = 127;
+        mdi->channel[i].chorus = 0;
+        mdi->channel[i].brightness = 64;
+        mdi->channel[i].lpf_b0 = 0;
+        mdi->channel[i].lpf_a1 = 0;
+        mdi->channel[i].lpf_a2 = 0;
         mdi->channel[i].balance = 64;
         mdi->channel[i].pan = 64;
         mdi->channel[i].pitch = 0;
         mdi->channel[i].pitch_range = 200;
+        mdi->channel[i].pitch_adjust = 0;
         mdi->channel[i].reg_data = 0xFFFF;
+        mdi->channel[i].reg_non = 0;
         mdi->channel[i].isdrum = 0;
     }
     /* I would not expect notes to be active when this event
@@ -1151,7 +1497,7 @@ void _WM_do_sysex_gm_reset(struct _mdi *mdi, struct _event_data *data) {
     mdi->channel[9].isdrum = 1;
 }
 
-void _WM_do_sysex_roland_reset(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_sysex_roland_reset(struct _mdi *mdi, struct _event *data) {
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__, ch, data->data.value);
@@ -1161,7 +1507,7 @@ void _WM_do_sysex_roland_reset(struct _mdi *mdi, struct _event_data *data) {
     _WM_do_sysex_gm_reset(mdi,data);
 }
 
-void _WM_do_sysex_yamaha_reset(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_sysex_yamaha_reset(struct _mdi *mdi, struct _event *data) {
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
     MIDI_EVENT_DEBUG(__FUNCTION__, ch, data->data.value);
@@ -1207,7 +1553,7 @@ void _WM_Release_Allowance(struct _mdi *mdi) {
     return;
 }
 
-void _WM_do_meta_endoftrack(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_endoftrack(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record eot in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
@@ -1221,7 +1567,7 @@ void _WM_do_meta_endoftrack(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_tempo(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_tempo(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
@@ -1234,7 +1580,7 @@ void _WM_do_meta_tempo(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_timesignature(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_timesignature(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
@@ -1247,7 +1593,7 @@ void _WM_do_meta_timesignature(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_keysignature(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_keysignature(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
@@ -1260,7 +1606,7 @@ void _WM_do_meta_keysignature(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_sequenceno(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_sequenceno(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
@@ -1273,7 +1619,7 @@ void _WM_do_meta_sequenceno(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_channelprefix(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_channelprefix(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
@@ -1286,7 +1632,7 @@ void _WM_do_meta_channelprefix(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_portprefix(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_portprefix(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
@@ -1299,7 +1645,7 @@ void _WM_do_meta_portprefix(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_smpteoffset(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_smpteoffset(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
@@ -1312,12 +1658,12 @@ void _WM_do_meta_smpteoffset(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_text(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_text(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
-    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, data->data.string);
+    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, &mdi->strings[data->data.string]);
 #endif
     if (mdi->extra_info.mixer_options & WM_MO_TEXTASLYRIC) {
         mdi->lyric = data->data.string;
@@ -1326,12 +1672,12 @@ void _WM_do_meta_text(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_copyright(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_copyright(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
-    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, data->data.string);
+    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, &mdi->strings[data->data.string]);
 #else
     WMIDI_UNUSED(data);
 #endif
@@ -1339,12 +1685,12 @@ void _WM_do_meta_copyright(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_trackname(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_trackname(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
-    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, data->data.string);
+    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, &mdi->strings[data->data.string]);
 #else
     WMIDI_UNUSED(data);
 #endif
@@ -1352,12 +1698,12 @@ void _WM_do_meta_trackname(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_instrumentname(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_instrumentname(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
-    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, data->data.string);
+    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, &mdi->strings[data->data.string]);
 #else
     WMIDI_UNUSED(data);
 #endif
@@ -1365,12 +1711,12 @@ void _WM_do_meta_instrumentname(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_lyric(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_lyric(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
-    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, data->data.string);
+    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, &mdi->strings[data->data.string]);
 #endif
     if (!(mdi->extra_info.mixer_options & WM_MO_TEXTASLYRIC)) {
         mdi->lyric = data->data.string;
@@ -1378,12 +1724,12 @@ void _WM_do_meta_lyric(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_marker(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_marker(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
-    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, data->data.string);
+    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, &mdi->strings[data->data.string]);
 #else
     WMIDI_UNUSED(data);
 #endif
@@ -1391,12 +1737,12 @@ void _WM_do_meta_marker(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_do_meta_cuepoint(struct _mdi *mdi, struct _event_data *data) {
+void _WM_do_meta_cuepoint(struct _mdi *mdi, struct _event *data) {
 /* placeholder function so we can record tempo in the event stream
  * for conversion function _WM_Event2Midi */
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
-    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, data->data.string);
+    MIDI_EVENT_SDEBUG(__FUNCTION__, ch, &mdi->strings[data->data.string]);
 #else
     WMIDI_UNUSED(data);
 #endif
@@ -1404,23 +1750,76 @@ void _WM_do_meta_cuepoint(struct _mdi *mdi, struct _event_data *data) {
     return;
 }
 
-void _WM_ResetToStart(struct _mdi *mdi) {
+/* indexed by enum _event_type, ev_null has no handler */
+const _WM_do_event_t _WM_do_event[] = {
+    _WM_do_midi_divisions,
+    _WM_do_note_off,
+    _WM_do_note_on,
+    _WM_do_aftertouch,
+    _WM_do_control_bank_select,
+    _WM_do_control_data_entry_course,
+    _WM_do_control_channel_volume,
+    _WM_do_control_channel_balance,
+    _WM_do_control_channel_pan,
+    _WM_do_control_channel_expression,
+    _WM_do_control_data_entry_fine,
+    _WM_do_control_channel_hold,
+    _WM_do_control_data_increment,
+    _WM_do_control_data_decrement,
+    _WM_do_control_non_registered_param_fine,
+    _WM_do_control_non_registered_param_course,
+    _WM_do_control_registered_param_fine,
+    _WM_do_control_registered_param_course,
+    _WM_do_control_channel_sound_off,
+    _WM_do_control_channel_controllers_off,
+    _WM_do_control_channel_notes_off,
+    _WM_do_control_channel_reverb,
+    _WM_do_control_channel_chorus,
+    _WM_do_control_channel_brightness,
+    _WM_do_control_dummy,
+    _WM_do_patch,
+    _WM_do_channel_pressure,
+    _WM_do_pitch,
+    _WM_do_sysex_roland_drum_track,
+    _WM_do_sysex_gm_reset,
+    _WM_do_sysex_roland_reset,
+    _WM_do_sysex_yamaha_reset,
+    _WM_do_meta_endoftrack,
+    _WM_do_meta_tempo,
+    _WM_do_meta_timesignature,
+    _WM_do_meta_keysignature,
+    _WM_do_meta_sequenceno,
+    _WM_do_meta_channelprefix,
+    _WM_do_meta_portprefix,
+    _WM_do_meta_smpteoffset,
+    _WM_do_meta_text,
+    _WM_do_meta_copyright,
+    _WM_do_meta_trackname,
+    _WM_do_meta_instrumentname,
+    _WM_do_meta_lyric,
+    _WM_do_meta_marker,
+    _WM_do_meta_cuepoint
+};
+
+int _WM_ResetToStart(struct _mdi *mdi) {
     struct _event * event = NULL;
 
+    /* Ensure last event is NULL */
+    if (_WM_ReserveEvents(mdi, mdi->event_count) == -1) {
+        return (-1);
+    }
+    mdi->events[mdi->event_count].evtype = ev_null;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = 0;
+    mdi->events[mdi->event_count].samples_to_next = 0;
+
     mdi->current_event = mdi->events;
     mdi->samples_to_mix = 0;
+    mdi->tempo_scale_pos = 0;
     mdi->extra_info.current_sample = 0;
 
     _WM_do_sysex_gm_reset(mdi, NULL);
 
-    /* Ensure last event is NULL */
-    _WM_CheckEventMemoryPool(mdi);
-    mdi->events[mdi->event_count].evtype = ev_null;
-    mdi->events[mdi->event_count].do_event = NULL;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = 0;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-
     if (_WM_MixerOptions & WM_MO_STRIPSILENCE) {
         event = mdi->events;
         /* Scan for first note on removing any samples as we go */
@@ -1428,6 +1827,7 @@ void _WM_ResetToStart(struct _mdi *mdi) {
             do {
                 if (event->samples_to_next != 0) {
                     mdi->extra_info.approx_total_samples -= event->samples_to_next;
+                    mdi->samples_stripped += event->samples_to_next;
                     event->samples_to_next = 0;
                 }
                 event++;
@@ -1448,29 +1848,252 @@ void _WM_ResetToStart(struct _mdi *mdi) {
         mdi->extra_info.approx_total_samples -= event->samples_to_next;
         event->samples_to_next = 0;
     }
+    return (0);
+}
+
+/*
+ * Keep a copy of the sounding notes for checkpoint,
+ * their replays included.
+ */
+static void save_checkpoint_notes(struct _mdi *mdi, struct _checkpoint *checkpoint) {
+    struct _checkpoint_note *checkpoint_note;
+    struct _note *note_data;
+    uint32_t count = 0;
+
+    checkpoint->note = mdi->checkpoint_note_count;
+    checkpoint->note_count = 0xffffffff;
+
+    for (note_data = mdi->note; note_data != NULL; note_data = note_data->next) {
+        count += (note_data->replay != NULL) ? 2 : 1;
+    }
+    if ((mdi->checkpoint_note_count + count) > mdi->checkpoint_note_size) {
+        uint32_t size = mdi->checkpoint_note_size + (mdi->checkpoint_note_size >> 1) + count + 64;
+
+        checkpoint_note = (struct _checkpoint_note *) realloc(mdi->checkpoint_notes,
+                              (size * sizeof(struct _checkpoint_note)));
+        if (checkpoint_note == NULL) return;
+        mdi->checkpoint_notes = checkpoint_note;
+        mdi->checkpoint_note_size = size;
+    }
+
+    /* in list order, so the first one is the head of mdi->note */
+    checkpoint_note = &mdi->checkpoint_notes[mdi->checkpoint_note_count];
+    for (note_data = mdi->note; note_data != NULL; note_data = note_data->next) {
+        checkpoint_note->slot = note_data;
+        checkpoint_note->note = *note_data;
+        checkpoint_note++;
+        if (note_data->replay != NULL) {
+            checkpoint_note->slot = note_data->replay;
+            checkpoint_note->note = *note_data->replay;
+            checkpoint_note++;
+        }
+    }
+    mdi->checkpoint_note_count += count;
+    checkpoint->note_count = count;
+}
+
+/*
+ * Work out when the next checkpoint is due, first being the first
+ * checkpoint past where playback is. One without notes is due again,
+ * so playing through it can replace it with one that has them.
+ */
+static void set_checkpoint_next(struct _mdi *mdi, uint32_t first) {
+    uint32_t next;
+    uint32_t i;
+
+    for (i = first; i < mdi->checkpoint_count; i++) {
+        if (mdi->checkpoints[i].note_count == 0xffffffff) {
+            mdi->checkpoint_next = mdi->checkpoints[i].sample;
+            return;
+        }
+    }
+
+    next = mdi->extra_info.current_sample;
+    if ((mdi->checkpoint_count) && (mdi->checkpoints[mdi->checkpoint_count - 1].sample > next)) {
+        next = mdi->checkpoints[mdi->checkpoint_count - 1].sample;
+    }
+    mdi->checkpoint_next = next + (_WM_SampleRate * CHECKPOINT_INTERVAL);
+    if (mdi->checkpoint_next < next) {
+        mdi->checkpoint_next = 0xffffffff;
+    }
+}
+
+/*
+ * Called with the handle locked right before event is played with
+ * nothing left to mix, once current_sample has reached checkpoint_next.
+ * Pass notes as 0 when the notes haven't been mixed up to here.
+ * A checkpoint with notes takes the place of the first one without
+ * them at or after event, others are only added past the last one.
+ * Checkpoints are an optimisation only, failing to store one is fine.
+ */
+void _WM_SaveCheckpoint(struct _mdi *mdi, struct _event *event, uint8_t notes) {
+    struct _checkpoint *checkpoint;
+    uint32_t index = (uint32_t) (event - mdi->events);
+    uint32_t sample = 0;
+    uint32_t lyric_event = 0xffffffff;
+    uint32_t low = 0;
+    uint32_t high = mdi->checkpoint_count;
+    uint32_t middle;
+    uint32_t i = 0;
+
+    /* the first checkpoint at or after event */
+    while (low < high) {
+        middle = (low + high) >> 1;
+        if (mdi->checkpoints[middle].event < index) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low < mdi->checkpoint_count) {
+        checkpoint = &mdi->checkpoints[low];
+        if ((!notes) || (checkpoint->note_count != 0xffffffff)) {
+            set_checkpoint_next(mdi, (checkpoint->event == index) ? (low + 1) : low);
+            return;
+        }
+    }
+    set_checkpoint_next(mdi, low + 1);
+
+    if (low) {
+        checkpoint = &mdi->checkpoints[low - 1];
+        sample = checkpoint->sample;
+        lyric_event = checkpoint->lyric_event;
+        i = checkpoint->event;
+    }
+
+    if ((low == mdi->checkpoint_count) && (mdi->checkpoint_count == mdi->checkpoint_size)) {
+        uint32_t size = mdi->checkpoint_size + (mdi->checkpoint_size >> 1) + 16;
+
+        checkpoint = (struct _checkpoint *) realloc(mdi->checkpoints,
+                              (size * sizeof(struct _checkpoint)));
+        if (checkpoint == NULL) return;
+        mdi->checkpoints = checkpoint;
+        mdi->checkpoint_size = size;
+    }
+
+    /*
+     * Work out where event sits in the song and what replaying up to it
+     * would leave in mdi->lyric. current_sample can't be trusted for the
+     * former, it runs ahead of the events while an end of track is mixed.
+     */
+    for (; i < index; i++) {
+        sample += mdi->events[i].samples_to_next;
+        if (mdi->events[i].evtype == ev_meta_lyric) {
+            if (!(mdi->extra_info.mixer_options & WM_MO_TEXTASLYRIC)) {
+                lyric_event = i;
+            }
+        } else if (mdi->events[i].evtype == ev_meta_text) {
+            if (mdi->extra_info.mixer_options & WM_MO_TEXTASLYRIC) {
+                lyric_event = i;
+            }
+        }
+    }
+
+    checkpoint = &mdi->checkpoints[low];
+    if (low == mdi->checkpoint_count) {
+        mdi->checkpoint_count++;
+    }
+    checkpoint->event = index;
+    checkpoint->sample = sample;
+    checkpoint->lyric_event = lyric_event;
+    memcpy(checkpoint->channel, mdi->channel, sizeof(mdi->channel));
+    if (notes) {
+        save_checkpoint_notes(mdi, checkpoint);
+    } else {
+        checkpoint->note = mdi->checkpoint_note_count;
+        checkpoint->note_count = 0xffffffff;
+    }
+}
+
+/*
+ * Last checkpoint at or before both sample and event,
+ * NULL if there is none and playback has to start from the top.
+ */
+struct _checkpoint *_WM_FindCheckpoint(struct _mdi *mdi, uint32_t sample, uint32_t event) {
+    uint32_t low = 0;
+    uint32_t high = mdi->checkpoint_count;
+    uint32_t middle;
+
+    while (low < high) {
+        middle = (low + high) >> 1;
+        if ((mdi->checkpoints[middle].sample <= sample)
+            && (mdi->checkpoints[middle].event <= event)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return ((low) ? &mdi->checkpoints[low - 1] : NULL);
+}
+
+/*
+ * Put playback where checkpoint was taken, as if the events from
+ * "from" up to it had just been played. The notes playing now are
+ * dropped, and replaced by the checkpoint's if it has them. With no
+ * checkpoint this is _WM_ResetToStart(). Returns the next event to play,
+ * or NULL if the reset failed.
+ */
+struct _event *_WM_RestoreCheckpoint(struct _mdi *mdi, struct _checkpoint *checkpoint, struct _event *from) {
+    struct _checkpoint_note *checkpoint_note;
+    struct _note *note_data;
+    uint32_t i;
+
+    for (note_data = mdi->note; note_data != NULL; note_data = note_data->next) {
+        note_data->active = 0;
+        note_data->replay = NULL;
+    }
+    mdi->note = NULL;
+
+    if (checkpoint == NULL) {
+        if (_WM_ResetToStart(mdi) == -1) {
+            return (NULL);
+        }
+        set_checkpoint_next(mdi, 0);
+        return (mdi->events);
+    }
+
+    if ((checkpoint->note_count != 0xffffffff) && (checkpoint->note_count != 0)) {
+        checkpoint_note = &mdi->checkpoint_notes[checkpoint->note];
+        for (i = 0; i < checkpoint->note_count; i++) {
+            *checkpoint_note[i].slot = checkpoint_note[i].note;
+        }
+        mdi->note = checkpoint_note[0].slot;
+    }
+
+    if ((checkpoint->lyric_event != 0xffffffff)
+        && (checkpoint->lyric_event >= (uint32_t) (from - mdi->events))) {
+        mdi->lyric = mdi->events[checkpoint->lyric_event].data.string;
+    }
+    memcpy(mdi->channel, checkpoint->channel, sizeof(mdi->channel));
+    mdi->current_event = &mdi->events[checkpoint->event];
+    mdi->samples_to_mix = 0;
+    mdi->tempo_scale_pos = 0;
+    mdi->extra_info.current_sample = checkpoint->sample;
+    set_checkpoint_next(mdi, (uint32_t) (checkpoint - mdi->checkpoints) + 1);
+    return (mdi->current_event);
 }
 
 int _WM_midi_setup_divisions(struct _mdi *mdi, uint32_t divisions) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0,0);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_midi_divisions;
-    mdi->events[mdi->event_count].do_event = _WM_do_midi_divisions;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = divisions;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = divisions;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
+    mdi->divisions = divisions;
     return (0);
 }
 
 int _WM_midi_setup_noteoff(struct _mdi *mdi, uint8_t channel,
                            uint8_t note, uint8_t velocity) {
     MIDI_EVENT_DEBUG(__FUNCTION__,channel, note);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     note &= 0x7f; /* silently bound note to 0..127 (github bug #180) */
     mdi->events[mdi->event_count].evtype = ev_note_off;
-    mdi->events[mdi->event_count].do_event = _WM_do_note_off;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = (note << 8) | velocity;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].data.value = (note << 8) | velocity;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1479,12 +2102,11 @@ int _WM_midi_setup_noteoff(struct _mdi *mdi, uint8_t channel,
 static int midi_setup_noteon(struct _mdi *mdi, uint8_t channel,
                              uint8_t note, uint8_t velocity) {
     MIDI_EVENT_DEBUG(__FUNCTION__,channel, note);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     note &= 0x7f; /* silently bound note to 0..127 (github bug #180) */
     mdi->events[mdi->event_count].evtype = ev_note_on;
-    mdi->events[mdi->event_count].do_event = _WM_do_note_on;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = (note << 8) | velocity;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].data.value = (note << 8) | velocity;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
 
@@ -1496,12 +2118,11 @@ static int midi_setup_noteon(struct _mdi *mdi, uint8_t channel,
 static int midi_setup_aftertouch(struct _mdi *mdi, uint8_t channel,
                                  uint8_t note, uint8_t pressure) {
     MIDI_EVENT_DEBUG(__FUNCTION__,channel, note);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     note &= 0x7f; /* silently bound note to 0..127 (github bug #180) */
     mdi->events[mdi->event_count].evtype = ev_aftertouch;
-    mdi->events[mdi->event_count].do_event = _WM_do_aftertouch;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = (note << 8) | pressure;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].data.value = (note << 8) | pressure;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1509,7 +2130,6 @@ static int midi_setup_aftertouch(struct _mdi *mdi, uint8_t channel,
 
 static int midi_setup_control(struct _mdi *mdi, uint8_t channel,
                               uint8_t controller, uint8_t setting) {
-    void (*tmp_event)(struct _mdi *mdi, struct _event_data *data);
     enum _event_type ev;
 
     MIDI_EVENT_DEBUG(__FUNCTION__,channel, controller);
@@ -1524,88 +2144,87 @@ static int midi_setup_control(struct _mdi *mdi, uint8_t channel,
          */
         case 0:
             ev = ev_control_bank_select;
-            tmp_event = _WM_do_control_bank_select;
             mdi->channel[channel].bank = setting;
             break;
         case 6:
             ev = ev_control_data_entry_course;
-            tmp_event = _WM_do_control_data_entry_course;
             break;
         case 7:
             ev = ev_control_channel_volume;
-            tmp_event = _WM_do_control_channel_volume;
             mdi->channel[channel].volume = setting;
             break;
         case 8:
             ev = ev_control_channel_balance;
-            tmp_event = _WM_do_control_channel_balance;
             break;
         case 10:
             ev = ev_control_channel_pan;
-            tmp_event = _WM_do_control_channel_pan;
             break;
         case 11:
             ev = ev_control_channel_expression;
-            tmp_event = _WM_do_control_channel_expression;
             break;
         case 38:
             ev = ev_control_data_entry_fine;
-            tmp_event = _WM_do_control_data_entry_fine;
             break;
         case 64:
             ev = ev_control_channel_hold;
-            tmp_event = _WM_do_control_channel_hold;
+            break;
+        case 74:
+            ev = ev_control_channel_brightness;
+            break;
+        case 91:
+            ev = ev_control_channel_reverb;
+            break;
+        case 93:
+            ev = ev_control_channel_chorus;
+            /* only songs that use the chorus pay for it */
+            if ((setting) && (mdi->chorus == NULL)) {
+                if ((mdi->chorus = _WM_init_chorus(_WM_SampleRate)) == NULL) {
+                    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, "to init chorus", 0);
+                    return (-1);
+                }
+                /* an incremental parse can get here mid song */
+                _WM_seek_chorus(mdi->chorus, mdi->extra_info.current_sample, mdi->tempo_scale);
+            }
             break;
         case 96:
             ev = ev_control_data_increment;
-            tmp_event = _WM_do_control_data_increment;
             break;
         case 97:
             ev = ev_control_data_decrement;
-            tmp_event = _WM_do_control_data_decrement;
             break;
         case 98:
             ev = ev_control_non_registered_param_fine;
-            tmp_event = _WM_do_control_non_registered_param_fine;
             break;
         case 99:
             ev = ev_control_non_registered_param_course;
-            tmp_event = _WM_do_control_non_registered_param_course;
             break;
         case 100:
             ev = ev_control_registered_param_fine;
-            tmp_event = _WM_do_control_registered_param_fine;
             break;
         case 101:
             ev = ev_control_registered_param_course;
-            tmp_event = _WM_do_control_registered_param_course;
             break;
         case 120:
             ev = ev_control_channel_sound_off;
-            tmp_event = _WM_do_control_channel_sound_off;
             break;
         case 121:
             ev = ev_control_channel_controllers_off;
-            tmp_event = _WM_do_control_channel_controllers_off;
             break;
         case 123:
             ev = ev_control_channel_notes_off;
-            tmp_event = _WM_do_control_channel_notes_off;
             break;
         default:
             ev = ev_control_dummy;
-            tmp_event = _WM_do_control_dummy;
             break;
     }
 
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev;
-    mdi->events[mdi->event_count].do_event = tmp_event;
-    mdi->events[mdi->event_count].event_data.channel = channel;
+    mdi->events[mdi->event_count].channel = channel;
     if (ev != ev_control_dummy) {
-        mdi->events[mdi->event_count].event_data.data.value = setting;
+        mdi->events[mdi->event_count].data.value = setting;
     } else {
-        mdi->events[mdi->event_count].event_data.data.value = (controller << 8) | setting;
+        mdi->events[mdi->event_count].data.value = (controller << 8) | setting;
     }
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
@@ -1614,11 +2233,10 @@ static int midi_setup_control(struct _mdi *mdi, uint8_t channel,
 
 static int midi_setup_patch(struct _mdi *mdi, uint8_t channel, uint8_t patch) {
     MIDI_EVENT_DEBUG(__FUNCTION__,channel, patch);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_patch;
-    mdi->events[mdi->event_count].do_event = _WM_do_patch;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = patch;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].data.value = patch;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
 
@@ -1635,11 +2253,10 @@ static int midi_setup_patch(struct _mdi *mdi, uint8_t channel, uint8_t patch) {
 static int midi_setup_channel_pressure(struct _mdi *mdi, uint8_t channel,
                                        uint8_t pressure) {
     MIDI_EVENT_DEBUG(__FUNCTION__,channel, pressure);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_channel_pressure;
-    mdi->events[mdi->event_count].do_event = _WM_do_channel_pressure;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = pressure;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].data.value = pressure;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1647,11 +2264,10 @@ static int midi_setup_channel_pressure(struct _mdi *mdi, uint8_t channel,
 
 static int midi_setup_pitch(struct _mdi *mdi, uint8_t channel, uint16_t pitch) {
     MIDI_EVENT_DEBUG(__FUNCTION__,channel, pitch);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_pitch;
-    mdi->events[mdi->event_count].do_event = _WM_do_pitch;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = pitch;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].data.value = pitch;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1660,11 +2276,10 @@ static int midi_setup_pitch(struct _mdi *mdi, uint8_t channel, uint16_t pitch) {
 static int midi_setup_sysex_roland_drum_track(struct _mdi *mdi,
                                               uint8_t channel, uint16_t setting) {
     MIDI_EVENT_DEBUG(__FUNCTION__,channel, setting);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_sysex_roland_drum_track;
-    mdi->events[mdi->event_count].do_event = _WM_do_sysex_roland_drum_track;
-    mdi->events[mdi->event_count].event_data.channel = channel;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = channel;
+    mdi->events[mdi->event_count].data.value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
 
@@ -1679,11 +2294,10 @@ static int midi_setup_sysex_roland_drum_track(struct _mdi *mdi,
 static int midi_setup_sysex_gm_reset(struct _mdi *mdi) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0,0);
 
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_sysex_roland_reset;
-    mdi->events[mdi->event_count].do_event = _WM_do_sysex_roland_reset;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = 0;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = 0;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1691,11 +2305,10 @@ static int midi_setup_sysex_gm_reset(struct _mdi *mdi) {
 
 static int midi_setup_sysex_roland_reset(struct _mdi *mdi) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0,0);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_sysex_roland_reset;
-    mdi->events[mdi->event_count].do_event = _WM_do_sysex_roland_reset;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = 0;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = 0;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1703,11 +2316,10 @@ static int midi_setup_sysex_roland_reset(struct _mdi *mdi) {
 
 static int midi_setup_sysex_yamaha_reset(struct _mdi *mdi) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0,0);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_sysex_roland_reset;
-    mdi->events[mdi->event_count].do_event = _WM_do_sysex_roland_reset;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = 0;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = 0;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1715,11 +2327,10 @@ static int midi_setup_sysex_yamaha_reset(struct _mdi *mdi) {
 
 int _WM_midi_setup_endoftrack(struct _mdi *mdi) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0,0);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_endoftrack;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_endoftrack;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = 0;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = 0;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1727,11 +2338,10 @@ int _WM_midi_setup_endoftrack(struct _mdi *mdi) {
 
 int _WM_midi_setup_tempo(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0,setting);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_tempo;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_tempo;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1739,11 +2349,10 @@ int _WM_midi_setup_tempo(struct _mdi *mdi, uint32_t setting) {
 
 static int midi_setup_timesignature(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0, setting);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_timesignature;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_timesignature;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1751,11 +2360,10 @@ static int midi_setup_timesignature(struct _mdi *mdi, uint32_t setting) {
 
 static int midi_setup_keysignature(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0, setting);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_keysignature;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_keysignature;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1763,11 +2371,10 @@ static int midi_setup_keysignature(struct _mdi *mdi, uint32_t setting) {
 
 static int midi_setup_sequenceno(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0, setting);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_sequenceno;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_sequenceno;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1775,11 +2382,10 @@ static int midi_setup_sequenceno(struct _mdi *mdi, uint32_t setting) {
 
 static int midi_setup_channelprefix(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0, setting);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_channelprefix;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_channelprefix;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1787,11 +2393,10 @@ static int midi_setup_channelprefix(struct _mdi *mdi, uint32_t setting) {
 
 static int midi_setup_portprefix(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0, setting);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_portprefix;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_portprefix;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1799,11 +2404,10 @@ static int midi_setup_portprefix(struct _mdi *mdi, uint32_t setting) {
 
 static int midi_setup_smpteoffset(struct _mdi *mdi, uint32_t setting) {
     MIDI_EVENT_DEBUG(__FUNCTION__,0, setting);
-    _WM_CheckEventMemoryPool(mdi);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
     mdi->events[mdi->event_count].evtype = ev_meta_smpteoffset;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_smpteoffset;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.value = setting;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = setting;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
@@ -1824,103 +2428,50 @@ static void strip_text(char * text) {
     }
 }
 
-static int midi_setup_text(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(__FUNCTION__,0, text);
-    strip_text(text);
-    _WM_CheckEventMemoryPool(mdi);
-    mdi->events[mdi->event_count].evtype = ev_meta_text;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_text;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
-
-static int midi_setup_copyright(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(__FUNCTION__,0, text);
-    strip_text(text);
-    _WM_CheckEventMemoryPool(mdi);
-    mdi->events[mdi->event_count].evtype = ev_meta_copyright;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_copyright;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
-
-static int midi_setup_trackname(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(__FUNCTION__,0, text);
-    strip_text(text);
-    _WM_CheckEventMemoryPool(mdi);
-    mdi->events[mdi->event_count].evtype = ev_meta_trackname;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_trackname;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
+static int midi_setup_string(struct _mdi *mdi, enum _event_type ev,
+                             const uint8_t *text, uint32_t length) {
+    uint32_t offset = mdi->strings_count;
 
-static int midi_setup_instrumentname(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(__FUNCTION__,0, text);
-    strip_text(text);
-    _WM_CheckEventMemoryPool(mdi);
-    mdi->events[mdi->event_count].evtype = ev_meta_instrumentname;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_instrumentname;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
-
-static int midi_setup_lyric(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(__FUNCTION__,0, text);
-    strip_text(text);
-    _WM_CheckEventMemoryPool(mdi);
-    mdi->events[mdi->event_count].evtype = ev_meta_lyric;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_lyric;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
-
-static int midi_setup_marker(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(__FUNCTION__,0, text);
-    strip_text(text);
-    _WM_CheckEventMemoryPool(mdi);
-    mdi->events[mdi->event_count].evtype = ev_meta_marker;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_marker;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
-    mdi->events[mdi->event_count].samples_to_next = 0;
-    mdi->event_count++;
-    return (0);
-}
+    if ((offset + length + 1) > mdi->strings_size) {
+        uint32_t size = mdi->strings_size + (mdi->strings_size >> 1) + length + 1;
+        char *strings = (char *) realloc(mdi->strings, size);
+        if (strings == NULL) {
+            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
+            return (-1);
+        }
+        mdi->strings = strings;
+        mdi->strings_size = size;
+    }
+    memcpy(&mdi->strings[offset], text, length);
+    mdi->strings[offset + length] = '\0';
+    mdi->strings_count += length + 1;
 
-static int midi_setup_cuepoint(struct _mdi *mdi, char * text) {
-    MIDI_EVENT_SDEBUG(__FUNCTION__,0, text);
-    strip_text(text);
-    _WM_CheckEventMemoryPool(mdi);
-    mdi->events[mdi->event_count].evtype = ev_meta_cuepoint;
-    mdi->events[mdi->event_count].do_event = _WM_do_meta_cuepoint;
-    mdi->events[mdi->event_count].event_data.channel = 0;
-    mdi->events[mdi->event_count].event_data.data.string = text;
+    MIDI_EVENT_SDEBUG(__FUNCTION__,0, &mdi->strings[offset]);
+    strip_text(&mdi->strings[offset]);
+    if (_WM_CheckEventMemoryPool(mdi) == -1) return (-1);
+    mdi->events[mdi->event_count].evtype = ev;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.string = offset;
     mdi->events[mdi->event_count].samples_to_next = 0;
     mdi->event_count++;
     return (0);
 }
 
+/*
+ * Sets up a song to parse into. owner is the still empty handle given
+ * out by WildMidi_OpenAsync(), which is filled in where it is so its
+ * lock and load state are left alone, or NULL for a new one.
+ */
 struct _mdi *
-_WM_initMDI(void) {
+_WM_initMDI(struct _mdi *owner) {
     struct _mdi *mdi;
 
-    mdi = (struct _mdi *) malloc(sizeof(struct _mdi));
-    memset(mdi, 0, (sizeof(struct _mdi)));
+    if (owner) {
+        mdi = owner;
+    } else {
+        mdi = (struct _mdi *) malloc(sizeof(struct _mdi));
+        memset(mdi, 0, (sizeof(struct _mdi)));
+    }
 
     mdi->extra_info.copyright = NULL;
     mdi->extra_info.mixer_options = _WM_MixerOptions;
@@ -1929,10 +2480,13 @@ _WM_initMDI(void) {
 
     mdi->events_size = MEM_CHUNK;
     mdi->events = (struct _event *) malloc(mdi->events_size * sizeof(struct _event));
+    /* an empty pool is grown by the first event */
+    if (mdi->events == NULL) mdi->events_size = 0;
     mdi->event_count = 0;
     mdi->current_event = mdi->events;
 
     mdi->samples_to_mix = 0;
+    mdi->tempo_scale = TEMPO_SCALE_ONE;
     mdi->extra_info.current_sample = 0;
     mdi->extra_info.total_midi_time = 0;
     mdi->extra_info.approx_total_samples = 0;
@@ -1944,14 +2498,17 @@ _WM_initMDI(void) {
 
     mdi->is_type2 = 0;
 
-    mdi->lyric = NULL;
+    mdi->lyric = 0xffffffff;
+
+    mdi->checkpoint_next = _WM_SampleRate * CHECKPOINT_INTERVAL;
 
     _WM_do_sysex_gm_reset(mdi, NULL);
 
     return (mdi);
 }
 
-void _WM_freeMDI(struct _mdi *mdi) {
+/* frees what the song holds, leaving the pointers NULL */
+static void free_mdi_data(struct _mdi *mdi) {
     struct _sample *tmp_sample;
     uint32_t i;
 
@@ -1972,37 +2529,177 @@ void _WM_freeMDI(struct _mdi *mdi) {
         }
         _WM_Unlock(&_WM_patch_lock);
         free(mdi->patches);
+        mdi->patches = NULL;
+        mdi->patch_count = 0;
     }
 
-    if (mdi->event_count != 0) {
-        for (i = 0; i < mdi->event_count; i++) {
-            /* Free up the string event storage */
-            switch (mdi->events[i].evtype) {
-            case ev_meta_text:
-            case ev_meta_copyright:
-            case ev_meta_trackname:
-            case ev_meta_instrumentname:
-            case ev_meta_lyric:
-            case ev_meta_marker:
-            case ev_meta_cuepoint:
-                free(mdi->events[i].event_data.data.string);
-                break;
-            default:
-                break;
-            }
-        }
-    }
-
+    _WM_FreeMidiParse(mdi);
+    free(mdi->lyric_copy);
+    mdi->lyric_copy = NULL;
+    free(mdi->checkpoints);
+    mdi->checkpoints = NULL;
+    free(mdi->checkpoint_notes);
+    mdi->checkpoint_notes = NULL;
+    free(mdi->tempo_map);
+    mdi->tempo_map = NULL;
+    free(mdi->live);
+    mdi->live = NULL;
     free(mdi->events);
+    mdi->events = NULL;
+    mdi->event_count = 0;
+    mdi->events_size = 0;
+    mdi->current_event = NULL;
+    free(mdi->strings);
+    mdi->strings = NULL;
+    mdi->lyric = 0xffffffff;
     _WM_free_reverb(mdi->reverb);
+    mdi->reverb = NULL;
     free(mdi->mix_buffer);
+    mdi->mix_buffer = NULL;
+    mdi->mix_buffer_size = 0;
+    free(mdi->reverb_buffer);
+    mdi->reverb_buffer = NULL;
+    _WM_free_chorus(mdi->chorus);
+    mdi->chorus = NULL;
+    _WM_free_upsample(mdi->upsample);
+    mdi->upsample = NULL;
+    free(mdi->chorus_buffer);
+    mdi->chorus_buffer = NULL;
     if (mdi->tmp_info) {
         free(mdi->tmp_info->copyright);
         free(mdi->tmp_info);
+        mdi->tmp_info = NULL;
     }
+    free(mdi->extra_info.copyright);
+    mdi->extra_info.copyright = NULL;
+}
+
+void _WM_freeMDI(struct _mdi *mdi) {
+    free_mdi_data(mdi);
     free(mdi);
 }
 
+/*
+ * Gives up on a parse set up with _WM_initMDI(owner). The handle of an
+ * async load is only emptied, as WildMidi_Close() still has to free it.
+ */
+void _WM_discardMDI(struct _mdi *mdi, struct _mdi *owner) {
+    if (mdi == owner) {
+        free_mdi_data(mdi);
+    } else {
+        _WM_freeMDI(mdi);
+    }
+}
+
+/*
+ * For a load run by WildMidi_OpenAsync(), where owner is the handle
+ * given out, tells whether WildMidi_Close() has given up on it.
+ */
+int _WM_AsyncCancelled(struct _mdi *owner) {
+    int cancelled;
+
+    if (owner == NULL) return (0);
+    _WM_Lock(&owner->lock);
+    cancelled = (owner->async_state == WM_ASYNC_CANCELLED);
+    _WM_Unlock(&owner->lock);
+    return (cancelled);
+}
+
+/*
+ Works out how many bytes the event at event_data takes, the one place
+ both _WM_SetupMidiEvent and _WM_MidiEventLength take this from so the
+ two can't disagree. Returns 0 where input_length is too short or the
+ event isn't one we know. Text, unsupported meta and sysex events end
+ with data whose length is put in *data_length, it is 0 for the rest.
+ */
+static uint32_t midi_event_length(const uint8_t *event_data, uint32_t input_length, uint8_t running_event, uint32_t *data_length) {
+    uint32_t ret_cnt = 0;
+    uint32_t tmp_length = 0;
+    uint8_t command = 0;
+    uint8_t channel = 0;
+
+    *data_length = 0;
+    if (!input_length) return 0;
+
+    if (event_data[0] >= 0x80) {
+        command = *event_data & 0xf0;
+        channel = *event_data++ & 0x0f;
+        ret_cnt++;
+        if (--input_length == 0) return 0;
+    } else {
+        command = running_event & 0xf0;
+        channel = running_event & 0x0f;
+    }
+
+    switch(command) {
+        case 0x80:
+        case 0x90:
+        case 0xa0:
+        case 0xb0:
+        case 0xe0:
+            if (input_length < 2) return 0;
+            return (ret_cnt + 2);
+        case 0xc0:
+        case 0xd0:
+            return (ret_cnt + 1);
+        case 0xf0:
+            break;
+        default:
+            return 0;
+    }
+
+    if (channel == 0x0f) {
+        /* MIDI Meta Events */
+        if (input_length < 2) return 0;
+        if ((event_data[0] == 0x00) && (event_data[1] == 0x02)) {
+            return ((input_length < 4) ? 0 : (ret_cnt + 4));
+        } else if (((event_data[0] == 0x20) || (event_data[0] == 0x21)) && (event_data[1] == 0x01)) {
+            return ((input_length < 3) ? 0 : (ret_cnt + 3));
+        } else if ((event_data[0] == 0x2F) && (event_data[1] == 0x00)) {
+            return (ret_cnt + 2);
+        } else if ((event_data[0] == 0x51) && (event_data[1] == 0x03)) {
+            return ((input_length < 5) ? 0 : (ret_cnt + 5));
+        } else if ((event_data[0] == 0x54) && (event_data[1] == 0x05)) {
+            return ((input_length < 7) ? 0 : (ret_cnt + 7));
+        } else if ((event_data[0] == 0x58) && (event_data[1] == 0x04)) {
+            return ((input_length < 6) ? 0 : (ret_cnt + 6));
+        } else if ((event_data[0] == 0x59) && (event_data[1] == 0x02)) {
+            return ((input_length < 4) ? 0 : (ret_cnt + 4));
+        }
+        /* Text and Unsupported Meta Events */
+        event_data++;
+        ret_cnt++;
+        input_length--;
+        while (input_length && (*event_data > 0x7f)) {
+            tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
+            event_data++;
+            input_length--;
+            ret_cnt++;
+        }
+        if (!input_length) return 0;
+        tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
+        ret_cnt++;
+        if (--input_length < tmp_length) return 0;
+        *data_length = tmp_length;
+        return (ret_cnt + tmp_length);
+    } else if ((channel == 0) || (channel == 7)) {
+        /* Sysex Events */
+        while (input_length && (*event_data > 0x7f)) {
+            tmp_length = (tmp_length << 7) + (*event_data & 0x7F);
+            event_data++;
+            input_length--;
+            ret_cnt++;
+        }
+        if (!input_length) return 0;
+        tmp_length = (tmp_length << 7) + (*event_data & 0x7F);
+        ret_cnt++;
+        if (--input_length < tmp_length) return 0;
+        *data_length = tmp_length;
+        return (ret_cnt + tmp_length);
+    }
+    return 0;
+}
+
 uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, uint8_t * event_data, uint32_t input_length, uint8_t running_event) {
     /*
      Only add standard MIDI and Sysex events in here.
@@ -2012,409 +2709,168 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, uint8_t * event_data, uint32_t inp
      TODO:
      Add value limit checks
      */
+    static const enum _event_type text_events[] = {
+        ev_meta_text, ev_meta_copyright, ev_meta_trackname,
+        ev_meta_instrumentname, ev_meta_lyric, ev_meta_marker,
+        ev_meta_cuepoint
+    };
     uint32_t ret_cnt = 0;
+    uint32_t data_length = 0;
+    uint8_t *data = NULL;
     uint8_t command = 0;
     uint8_t channel = 0;
-    uint8_t data_1 = 0;
-    uint8_t data_2 = 0;
-    char *text = NULL;
+    int setup = 0;
 
     if (!input_length) goto shortbuf;
 
     if (event_data[0] >= 0x80) {
-        command = *event_data & 0xf0;
-        channel = *event_data++ & 0x0f;
-        ret_cnt++;
-        if (--input_length == 0) goto shortbuf;
+        command = event_data[0] & 0xf0;
+        channel = event_data[0] & 0x0f;
     } else {
         command = running_event & 0xf0;
         channel = running_event & 0x0f;
     }
 
+    /* From here on the whole event is known to be in event_data */
+    ret_cnt = midi_event_length(event_data, input_length, running_event, &data_length);
+    if (ret_cnt == 0) {
+        if (command < 0x80) {
+            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, "(missing event)", 0);
+            return 0;
+        }
+        if ((command == 0xf0) && (channel != 0x0f) && (channel != 0) && (channel != 7)) {
+            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, "(unrecognized meta type event)", 0);
+            return 0;
+        }
+        goto shortbuf;
+    }
+    data = &event_data[ret_cnt - data_length];
+    if (event_data[0] >= 0x80) event_data++;
+
     switch(command) {
         case 0x80:
         _SETUP_NOTEOFF:
-            if (input_length < 2) goto shortbuf;
-            data_1 = *event_data++;
-            data_2 = *event_data++;
-            _WM_midi_setup_noteoff(mdi, channel, data_1, data_2);
-            ret_cnt += 2;
+            setup = _WM_midi_setup_noteoff(mdi, channel, event_data[0], event_data[1]);
             break;
         case 0x90:
             if (event_data[1] == 0) goto _SETUP_NOTEOFF; /* A velocity of 0 in a note on is actually a note off */
-            if (input_length < 2) goto shortbuf;
-            data_1 = *event_data++;
-            data_2 = *event_data++;
-            midi_setup_noteon(mdi, channel, data_1, data_2);
-            ret_cnt += 2;
+            setup = midi_setup_noteon(mdi, channel, event_data[0], event_data[1]);
             break;
         case 0xa0:
-            if (input_length < 2) goto shortbuf;
-            data_1 = *event_data++;
-            data_2 = *event_data++;
-            midi_setup_aftertouch(mdi, channel, data_1, data_2);
-            ret_cnt += 2;
+            setup = midi_setup_aftertouch(mdi, channel, event_data[0], event_data[1]);
             break;
         case 0xb0:
-            if (input_length < 2) goto shortbuf;
-            data_1 = *event_data++;
-            data_2 = *event_data++;
-            midi_setup_control(mdi, channel, data_1, data_2);
-            ret_cnt += 2;
+            setup = midi_setup_control(mdi, channel, event_data[0], event_data[1]);
             break;
         case 0xc0:
-            data_1 = *event_data++;
-            midi_setup_patch(mdi, channel, data_1);
-            ret_cnt++;
+            setup = midi_setup_patch(mdi, channel, event_data[0]);
             break;
         case 0xd0:
-            data_1 = *event_data++;
-            midi_setup_channel_pressure(mdi, channel, data_1);
-            ret_cnt++;
+            setup = midi_setup_channel_pressure(mdi, channel, event_data[0]);
             break;
         case 0xe0:
-            if (input_length < 2) goto shortbuf;
-            data_1 = *event_data++;
-            data_2 = *event_data++;
-            midi_setup_pitch(mdi, channel, ((data_2 << 7) | (data_1 & 0x7f)));
-            ret_cnt += 2;
+            setup = midi_setup_pitch(mdi, channel, ((event_data[1] << 7) | (event_data[0] & 0x7f)));
             break;
         case 0xf0:
             if (channel == 0x0f) {
                 /*
                  MIDI Meta Events
                  */
-                uint32_t tmp_length = 0;
-
-                if (input_length < 2)
-                    goto shortbuf;
                 if ((event_data[0] == 0x00) && (event_data[1] == 0x02)) {
                     /*
                      Sequence Number
                      We only setting this up here for WM_Event2Midi function
                      */
-                    if (input_length < 4) goto shortbuf;
-                    midi_setup_sequenceno(mdi, ((event_data[2] << 8) + event_data[3]));
-                    ret_cnt += 4;
-                } else if (event_data[0] == 0x01) {
-                    /* Text Event */
-                    /* Get Length */
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length && *event_data > 0x7f) {
-                        do {
-                            if (!input_length) break;
-                            tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                            event_data++;
-                            input_length--;
-                            ret_cnt++;
-                        } while (*event_data > 0x7f);
-                    }
-                    if (!input_length) goto shortbuf;
-                    tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length < tmp_length) goto shortbuf;
-                    if (!tmp_length) break;/* broken file? */
-
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_text(mdi, text);
-
-                    ret_cnt += tmp_length;
-
-                } else if (event_data[0] == 0x02) {
-                    /* Copyright Event */
-                    /* Get Length */
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length && *event_data > 0x7f) {
-                        do {
-                            if (!input_length) break;
-                            tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                            event_data++;
-                            input_length--;
-                            ret_cnt++;
-                        } while (*event_data > 0x7f);
-                    }
-                    if (!input_length) goto shortbuf;
-                    tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length < tmp_length) goto shortbuf;
-                    if (!tmp_length) break;/* broken file? */
-
-                    /* Copy copyright info in the getinfo struct */
-                    if (mdi->extra_info.copyright) {
-                        mdi->extra_info.copyright = (char *) realloc(mdi->extra_info.copyright,(strlen(mdi->extra_info.copyright) + 1 + tmp_length + 1));
-                        memcpy(&mdi->extra_info.copyright[strlen(mdi->extra_info.copyright) + 1], event_data, tmp_length);
-                        mdi->extra_info.copyright[strlen(mdi->extra_info.copyright) + 1 + tmp_length] = '\0';
-                        mdi->extra_info.copyright[strlen(mdi->extra_info.copyright)] = '\n';
-                    } else {
-                        mdi->extra_info.copyright = (char *) malloc(tmp_length + 1);
-                        memcpy(mdi->extra_info.copyright, event_data, tmp_length);
-                        mdi->extra_info.copyright[tmp_length] = '\0';
-                    }
-
-                    /* NOTE: free'd when events are cleared during closure of mdi */
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_copyright(mdi, text);
-
-                    ret_cnt += tmp_length;
-
-                } else if (event_data[0] == 0x03) {
-                    /* Track Name Event */
-                    /* Get Length */
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length && *event_data > 0x7f) {
-                        do {
-                            if (!input_length) break;
-                            tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                            event_data++;
-                            input_length--;
-                            ret_cnt++;
-                        } while (*event_data > 0x7f);
-                    }
-                    if (!input_length) goto shortbuf;
-                    tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length < tmp_length) goto shortbuf;
-                    if (!tmp_length) break;/* broken file? */
-
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_trackname(mdi, text);
-
-                    ret_cnt += tmp_length;
-
-                } else if (event_data[0] == 0x04) {
-                    /* Instrument Name Event */
-                    /* Get Length */
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length && *event_data > 0x7f) {
-                        do {
-                            if (!input_length) break;
-                            tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                            event_data++;
-                            input_length--;
-                            ret_cnt++;
-                        } while (*event_data > 0x7f);
-                    }
-                    if (!input_length) goto shortbuf;
-                    tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length < tmp_length) goto shortbuf;
-                    if (!tmp_length) break;/* broken file? */
-
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_instrumentname(mdi, text);
-
-                    ret_cnt += tmp_length;
-
-                } else if (event_data[0] == 0x05) {
-                    /* Lyric Event */
-                    /* Get Length */
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length && *event_data > 0x7f) {
-                        do {
-                            if (!input_length) break;
-                            tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                            event_data++;
-                            input_length--;
-                            ret_cnt++;
-                        } while (*event_data > 0x7f);
-                    }
-                    if (!input_length) goto shortbuf;
-                    tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length < tmp_length) goto shortbuf;
-                    if (!tmp_length) break;/* broken file? */
-
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_lyric(mdi, text);
-
-                    ret_cnt += tmp_length;
-
-                } else if (event_data[0] == 0x06) {
-                    /* Marker Event */
-                    /* Get Length */
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length && *event_data > 0x7f) {
-                        do {
-                            if (!input_length) break;
-                            tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                            event_data++;
-                            input_length--;
-                            ret_cnt++;
-                        } while (*event_data > 0x7f);
-                    }
-                    if (!input_length) goto shortbuf;
-                    tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length < tmp_length) goto shortbuf;
-                    if (!tmp_length) break;/* broken file? */
-
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_marker(mdi, text);
-
-                    ret_cnt += tmp_length;
-
-                } else if (event_data[0] == 0x07) {
-                    /* Cue Point Event */
-                    /* Get Length */
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length && *event_data > 0x7f) {
-                        do {
-                            if (!input_length) break;
-                            tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                            event_data++;
-                            input_length--;
-                            ret_cnt++;
-                        } while (*event_data > 0x7f);
+                    setup = midi_setup_sequenceno(mdi, ((event_data[2] << 8) + event_data[3]));
+                } else if ((event_data[0] >= 0x01) && (event_data[0] <= 0x07)) {
+                    /*
+                     Text, Copyright, Track Name, Instrument Name, Lyric,
+                     Marker and Cue Point Events
+                     */
+                    if (!data_length) break;/* broken file? */
+
+                    if (event_data[0] == 0x02) {
+                        /* Copy copyright info in the getinfo struct */
+                        if (mdi->extra_info.copyright) {
+                            mdi->extra_info.copyright = (char *) realloc(mdi->extra_info.copyright,(strlen(mdi->extra_info.copyright) + 1 + data_length + 1));
+                            memcpy(&mdi->extra_info.copyright[strlen(mdi->extra_info.copyright) + 1], data, data_length);
+                            mdi->extra_info.copyright[strlen(mdi->extra_info.copyright) + 1 + data_length] = '\0';
+                            mdi->extra_info.copyright[strlen(mdi->extra_info.copyright)] = '\n';
+                        } else {
+                            mdi->extra_info.copyright = (char *) malloc(data_length + 1);
+                            memcpy(mdi->extra_info.copyright, data, data_length);
+                            mdi->extra_info.copyright[data_length] = '\0';
+                        }
                     }
-                    if (!input_length) goto shortbuf;
-                    tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length < tmp_length) goto shortbuf;
-                    if (!tmp_length) break;/* broken file? */
-
-                    text = (char *) malloc(tmp_length + 1);
-                    memcpy(text, event_data, tmp_length);
-                    text[tmp_length] = '\0';
-                    midi_setup_cuepoint(mdi, text);
-
-                    ret_cnt += tmp_length;
 
+                    setup = midi_setup_string(mdi, text_events[event_data[0] - 1], data, data_length);
                 } else if ((event_data[0] == 0x20) && (event_data[1] == 0x01)) {
                     /*
                      Channel Prefix
                      We only setting this up here for WM_Event2Midi function
                      */
-                    if (input_length < 3) goto shortbuf;
-                    midi_setup_channelprefix(mdi, event_data[2]);
-                    ret_cnt += 3;
+                    setup = midi_setup_channelprefix(mdi, event_data[2]);
                 } else if ((event_data[0] == 0x21) && (event_data[1] == 0x01)) {
                     /*
                      Port Prefix
                      We only setting this up here for WM_Event2Midi function
                      */
-                    if (input_length < 3) goto shortbuf;
-                    midi_setup_portprefix(mdi, event_data[2]);
-                    ret_cnt += 3;
+                    setup = midi_setup_portprefix(mdi, event_data[2]);
                 } else if ((event_data[0] == 0x2F) && (event_data[1] == 0x00)) {
                     /*
                      End of Track
                      Deal with this inside calling function
                      We only setting this up here for _WM_Event2Midi function
                      */
-                    _WM_midi_setup_endoftrack(mdi);
-                    ret_cnt += 2;
+                    setup = _WM_midi_setup_endoftrack(mdi);
                 } else if ((event_data[0] == 0x51) && (event_data[1] == 0x03)) {
                     /*
                      Tempo
                      Deal with this inside calling function.
                      We only setting this up here for _WM_Event2Midi function
                      */
-                    if (input_length < 5) goto shortbuf;
-                    _WM_midi_setup_tempo(mdi, ((event_data[2] << 16) + (event_data[3] << 8) + event_data[4]));
-                    ret_cnt += 5;
+                    setup = _WM_midi_setup_tempo(mdi, ((event_data[2] << 16) + (event_data[3] << 8) + event_data[4]));
                 } else if ((event_data[0] == 0x54) && (event_data[1] == 0x05)) {
-                    if (input_length < 7) goto shortbuf;
                     /*
                      SMPTE Offset
                      We only setting this up here for WM_Event2Midi function
                      */
-                    midi_setup_smpteoffset(mdi, ((event_data[3] << 24) + (event_data[4] << 16) + (event_data[5] << 8) + event_data[6]));
+                    setup = midi_setup_smpteoffset(mdi, ((event_data[3] << 24) + (event_data[4] << 16) + (event_data[5] << 8) + event_data[6]));
 
                     /*
                      Because this has 5 bytes of data we gonna "hack" it a little
                      */
-                    mdi->events[mdi->events_size - 1].event_data.channel = event_data[2];
-
-                    ret_cnt += 7;
+                    if (setup == 0) mdi->events[mdi->events_size - 1].channel = event_data[2];
                 } else if ((event_data[0] == 0x58) && (event_data[1] == 0x04)) {
                     /*
                      Time Signature
                      We only setting this up here for WM_Event2Midi function
                      */
-                    if (input_length < 6) goto shortbuf;
-                    midi_setup_timesignature(mdi, ((event_data[2] << 24) + (event_data[3] << 16) + (event_data[4] << 8) + event_data[5]));
-                    ret_cnt += 6;
+                    setup = midi_setup_timesignature(mdi, ((event_data[2] << 24) + (event_data[3] << 16) + (event_data[4] << 8) + event_data[5]));
                 } else if ((event_data[0] == 0x59) && (event_data[1] == 0x02)) {
                     /*
                      Key Signature
                      We only setting this up here for WM_Event2Midi function
                      */
-                    if (input_length < 4) goto shortbuf;
-                    midi_setup_keysignature(mdi, ((event_data[2] << 8) + event_data[3]));
-                    ret_cnt += 4;
-                } else {
-                    /*
-                     Unsupported Meta Event
-                     */
-                    event_data++;
-                    ret_cnt++;
-                    if (--input_length && *event_data > 0x7f) {
-                        do {
-                            if (!input_length) break;
-                            tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                            event_data++;
-                            input_length--;
-                            ret_cnt++;
-                        } while (*event_data > 0x7f);
-                    }
-                    if (!input_length) goto shortbuf;
-                    tmp_length = (tmp_length << 7) + (*event_data & 0x7f);
-                    ret_cnt++;
-                    ret_cnt += tmp_length;
-                    if (--input_length < tmp_length) goto shortbuf;
+                    setup = midi_setup_keysignature(mdi, ((event_data[2] << 8) + event_data[3]));
                 }
+                /* Unsupported Meta Events are skipped */
 
-            } else if ((channel == 0) || (channel == 7)) {
+            } else {
                 /*
                  Sysex Events
                  */
-                uint32_t sysex_len = 0;
+                uint32_t sysex_len = data_length;
                 uint8_t *sysex_store = NULL;
 
-                if (*event_data > 0x7f) {
-                    do {
-                        if (!input_length) break;
-                        sysex_len = (sysex_len << 7) + (*event_data & 0x7F);
-                        event_data++;
-                        input_length--;
-                        ret_cnt++;
-                    } while (*event_data > 0x7f);
-                }
-                if (!input_length) goto shortbuf;
-                sysex_len = (sysex_len << 7) + (*event_data & 0x7F);
-                event_data++;
-                ret_cnt++;
-                if (--input_length < sysex_len) goto shortbuf;
                 if (!sysex_len) break;/* broken file? */
 
                 sysex_store = (uint8_t *) malloc(sizeof(uint8_t) * sysex_len);
-                memcpy(sysex_store, event_data, sysex_len);
+                if (sysex_store == NULL) {
+                    _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, "to store sysex", errno);
+                    return 0;
+                }
+                memcpy(sysex_store, data, sysex_len);
 
                 if (sysex_store[sysex_len - 1] == 0xF7) {
                     uint8_t rolandsysexid[] = { 0x41, 0x10, 0x42, 0x12 };
@@ -2443,10 +2899,10 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, uint8_t * event_data, uint32_t inp
                                     } else if (sysex_ch <= 0x09) {
                                         sysex_ch -= 1;
                                     }
-                                    midi_setup_sysex_roland_drum_track(mdi, sysex_ch, sysex_store[7]);
+                                    setup = midi_setup_sysex_roland_drum_track(mdi, sysex_ch, sysex_store[7]);
                                 } else if ((sysex_store[5] == 0x00) && (sysex_store[6] == 0x7F) && (sysex_store[7] == 0x00)) {
                                     /* Roland GS Reset */
-                                    midi_setup_sysex_roland_reset(mdi);
+                                    setup = midi_setup_sysex_roland_reset(mdi);
                                 }
                             }
                         }
@@ -2457,31 +2913,20 @@ uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, uint8_t * event_data, uint32_t inp
 
                         if (sysex_len >= 5 && memcmp(gm_reset, sysex_store, 5) == 0) {
                             /* GM Reset */
-                            midi_setup_sysex_gm_reset(mdi);
+                            setup = midi_setup_sysex_gm_reset(mdi);
                         } else if (sysex_len >= 8 && memcmp(yamaha_reset,sysex_store,8) == 0) {
                             /* Yamaha Reset */
-                            midi_setup_sysex_yamaha_reset(mdi);
+                            setup = midi_setup_sysex_yamaha_reset(mdi);
                         }
                     }
                 }
                 free(sysex_store);
                 sysex_store = NULL;
-                /*
-                event_data += sysex_len;
-                */
-                ret_cnt += sysex_len;
-            } else {
-                _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, "(unrecognized meta type event)", 0);
-                return 0;
             }
             break;
-
-        default: /* Should NEVER get here */
-            ret_cnt = 0;
-            break;
     }
-    if (ret_cnt == 0)
-        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, "(missing event)", 0);
+    /* the setup reported why it failed */
+    if (setup == -1) return 0;
     return ret_cnt;
 
 shortbuf:
@@ -2489,3 +2934,14 @@ shortbuf:
     return 0;
 }
 
+/*
+ Returns the number of bytes _WM_SetupMidiEvent would consume for the
+ event, or 0 where it would fail. Nothing is set up and no error is
+ raised, so this is safe to call from the track decoding threads.
+ */
+uint32_t _WM_MidiEventLength(const uint8_t *event_data, uint32_t input_length, uint8_t running_event) {
+    uint32_t data_length;
+
+    return (midi_event_length(event_data, input_length, running_event, &data_length));
+}
+
@@ -0,0 +1,92 @@
+/*
+ * live.c - live midi input queue for lib
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#define WM_BARRIER() MemoryBarrier()
+#elif defined(HAVE___SYNC_BOOL_COMPARE_AND_SWAP)
+#define WM_BARRIER() __sync_synchronize()
+#else
+/* no atomics, the volatile head and tail are all we have */
+#define WM_BARRIER() do {} while (0)
+#endif
+
+#include "wildmidi_lib.h"
+#include "internal_midi.h"
+#include "live.h"
+
+struct _live *_WM_NewLive(void) {
+    return ((struct _live *) calloc(1, sizeof(struct _live)));
+}
+
+/*
+ _WM_LivePush(live, sample, message)
+
+ live    = queue to add to
+ sample  = output sample the event is due at
+ message = the midi message
+
+ returns -1 if the queue is full, 0 otherwise.
+ Only one thread may push to a queue. It never waits on the render thread.
+ */
+int _WM_LivePush(struct _live *live, uint32_t sample, uint32_t message) {
+    uint32_t head = live->head;
+    struct _live_event *live_event;
+
+    if ((head - live->tail) >= LIVE_QUEUE_SIZE) return (-1);
+
+    live_event = &live->queue[head & (LIVE_QUEUE_SIZE - 1)];
+    live_event->sample = sample;
+    live_event->message = message;
+    /* the event has to be in place before the render thread can see it */
+    WM_BARRIER();
+    live->head = head + 1;
+    return (0);
+}
+
+/*
+ _WM_LivePeek(live)
+
+ returns the oldest event in the queue without taking it off, or NULL
+ if the queue is empty. Only the render thread may call this.
+ */
+struct _live_event *_WM_LivePeek(struct _live *live) {
+    uint32_t tail = live->tail;
+
+    if (tail == live->head) return (NULL);
+    /* don't read the event before seeing head move past it */
+    WM_BARRIER();
+    return (&live->queue[tail & (LIVE_QUEUE_SIZE - 1)]);
+}
+
+/* Take the event _WM_LivePeek() returned off the queue. */
+void _WM_LivePop(struct _live *live) {
+    /* finish with the slot before the producer can fill it again */
+    WM_BARRIER();
+    live->tail = live->tail + 1;
+}
@@ -57,6 +57,15 @@
  */
 void _WM_Lock(int * wmlock) {
     LOCK_START:
+#if defined(_WIN32)
+    if (__builtin_expect((InterlockedCompareExchange((LONG volatile *) wmlock, 1, 0) == 0), 1)) {
+        return; /* Lock cleanly set */
+    }
+#elif defined(HAVE___SYNC_BOOL_COMPARE_AND_SWAP)
+    if (__builtin_expect((__sync_bool_compare_and_swap(wmlock, 0, 1)), 1)) {
+        return; /* Lock cleanly set */
+    }
+#else
     /* Check if lock is clear, if so set it */
     if (__builtin_expect(((*wmlock) == 0), 1)) {
         (*wmlock)++;
@@ -68,6 +77,7 @@ void _WM_Lock(int * wmlock) {
         }
         (*wmlock)--;
     }
+#endif
 #ifdef _WIN32
     Sleep(10);
 #elif defined(__OS2__) || defined(__EMX__)
@@ -94,10 +104,16 @@ void _WM_Lock(int * wmlock) {
  Removes a lock previously placed on the MDI tree.
  */
 void _WM_Unlock(int *wmlock) {
+#if defined(_WIN32)
+    InterlockedExchange((LONG volatile *) wmlock, 0);
+#elif defined(HAVE___SYNC_BOOL_COMPARE_AND_SWAP)
+    __sync_lock_release(wmlock);
+#else
     /* We don't want a -1 lock, so just to make sure */
     if ((*wmlock) != 0) {
         (*wmlock)--;
     }
+#endif
 }
 
 #endif /* !WM_NO_LOCK */
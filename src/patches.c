@@ -99,3 +99,57 @@ void _WM_load_patch(struct _mdi *mdi, uint16_t patchid) {
     tmp_patch->inuse_count++;
     _WM_Unlock(&_WM_patch_lock);
 }
+
+/*
+ * As _WM_load_patch(), for WildMidi_Live() on the producer's thread.
+ * lock guards mdi->patches against the render thread, and is only
+ * taken once the samples are loaded so rendering never waits on them.
+ */
+void _WM_load_live_patch(struct _mdi *mdi, uint16_t patchid, int *lock) {
+    struct _patch *tmp_patch = NULL;
+    struct _patch **patches;
+    uint32_t i;
+
+    tmp_patch = _WM_get_patch_data(mdi, patchid);
+    if (tmp_patch == NULL) {
+        return;
+    }
+
+    _WM_Lock(&_WM_patch_lock);
+    if (!tmp_patch->loaded) {
+        if (_WM_load_sample(tmp_patch) == -1) {
+            _WM_Unlock(&_WM_patch_lock);
+            return;
+        }
+    }
+
+    if (tmp_patch->first_sample == NULL) {
+        _WM_Unlock(&_WM_patch_lock);
+        return;
+    }
+    /* keeps the samples loaded until mdi holds them */
+    tmp_patch->inuse_count++;
+    _WM_Unlock(&_WM_patch_lock);
+
+    _WM_Lock(lock);
+    for (i = 0; i < mdi->patch_count; i++) {
+        if (mdi->patches[i] == tmp_patch) break;
+    }
+    if (i == mdi->patch_count) {
+        patches = (struct _patch **) realloc(mdi->patches,
+                               (sizeof(struct _patch*) * (mdi->patch_count + 1)));
+        if (patches != NULL) {
+            mdi->patches = patches;
+            mdi->patches[mdi->patch_count++] = tmp_patch;
+            tmp_patch = NULL;
+        }
+    }
+    _WM_Unlock(lock);
+
+    if (tmp_patch != NULL) {
+        /* mdi already had it, or couldn't take it */
+        _WM_Lock(&_WM_patch_lock);
+        tmp_patch->inuse_count--;
+        _WM_Unlock(&_WM_patch_lock);
+    }
+}
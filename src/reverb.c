@@ -26,35 +26,235 @@
 #include <stdint.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
+#include "lock.h"
 #include "reverb.h"
 
+#if defined(WM_SSE2)
+#include <emmintrin.h>
+#elif defined(WM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* reverbs freed by handles, for the next to open with the same settings */
+#define RVB_POOL_SIZE 4
+static struct _rvb *rvb_pool = NULL;
+static int rvb_pool_count = 0;
+static int rvb_pool_lock = 0;
+
+/*
+ * x / 2^n rounded towards zero, the same as C division gives,
+ * but in a form the filter loop can be vectorized with.
+ */
+#define RVB_DIV_POW2(x, n) (((x) + (((x) >> 31) & ((1 << (n)) - 1))) >> (n))
+
+#if defined(WM_SSE2)
+/*
+ SSE2 only multiplies the even lanes, into 64 bits. Just the low 32 bits
+ of the filter sums are kept, so the even and odd lanes are summed apart
+ in 64 bits and only put back together at the end.
+ */
+#define RVB_ODD(x) _mm_srli_epi64((x), 32)
+
+#define RVB_DIV_POW2_SSE2(x, n) _mm_srai_epi32(_mm_add_epi32((x), \
+        _mm_and_si128(_mm_srai_epi32((x), 31), _mm_set1_epi32((1 << (n)) - 1))), (n))
+#elif defined(WM_NEON)
+#define RVB_DIV_POW2_NEON(x, n) vshrq_n_s32(vaddq_s32((x), \
+        vandq_s32(vshrq_n_s32((x), 31), vdupq_n_s32((1 << (n)) - 1))), (n))
+#endif
+
+/*
+ run every band filter of one side on its next input, rfl, and return
+ the sum of their outputs each divided by 8. All the filters get the
+ same input, so they run side by side, 4 at a time with SSE2 or NEON.
+ */
+static inline int32_t rvb_filter(const struct _rvb *rvb, int32_t rfl,
+                                 int32_t flt_in[2], int32_t flt_out[2][RVB_FILTERS]) {
+    int32_t flt_sum = 0;
+    int32_t flt;
+    int j = 0;
+
+#if defined(WM_SSE2)
+    __m128i in_0 = _mm_set1_epi32(rfl);
+    __m128i in_1 = _mm_set1_epi32(flt_in[0]);
+    __m128i in_2 = _mm_set1_epi32(flt_in[1]);
+    __m128i sum = _mm_setzero_si128();
+
+    for (; j <= (RVB_FILTERS - 4); j += 4) {
+        __m128i out_0 = _mm_loadu_si128((const __m128i *) &flt_out[0][j]);
+        __m128i out_1 = _mm_loadu_si128((const __m128i *) &flt_out[1][j]);
+        __m128i c_0 = _mm_loadu_si128((const __m128i *) &rvb->coeff[0][j]);
+        __m128i c_1 = _mm_loadu_si128((const __m128i *) &rvb->coeff[1][j]);
+        __m128i c_2 = _mm_loadu_si128((const __m128i *) &rvb->coeff[2][j]);
+        __m128i c_3 = _mm_loadu_si128((const __m128i *) &rvb->coeff[3][j]);
+        __m128i c_4 = _mm_loadu_si128((const __m128i *) &rvb->coeff[4][j]);
+        __m128i even, odd, v;
+
+        /* the inputs are the same in every lane, so need no shifting */
+        even = _mm_mul_epu32(in_0, c_0);
+        odd = _mm_mul_epu32(in_0, RVB_ODD(c_0));
+        even = _mm_add_epi64(even, _mm_mul_epu32(in_1, c_1));
+        odd = _mm_add_epi64(odd, _mm_mul_epu32(in_1, RVB_ODD(c_1)));
+        even = _mm_add_epi64(even, _mm_mul_epu32(in_2, c_2));
+        odd = _mm_add_epi64(odd, _mm_mul_epu32(in_2, RVB_ODD(c_2)));
+        even = _mm_sub_epi64(even, _mm_mul_epu32(out_0, c_3));
+        odd = _mm_sub_epi64(odd, _mm_mul_epu32(RVB_ODD(out_0), RVB_ODD(c_3)));
+        even = _mm_sub_epi64(even, _mm_mul_epu32(out_1, c_4));
+        odd = _mm_sub_epi64(odd, _mm_mul_epu32(RVB_ODD(out_1), RVB_ODD(c_4)));
+        v = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                               _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+        v = RVB_DIV_POW2_SSE2(v, 10);
+        _mm_storeu_si128((__m128i *) &flt_out[1][j], out_0);
+        _mm_storeu_si128((__m128i *) &flt_out[0][j], v);
+        sum = _mm_add_epi32(sum, RVB_DIV_POW2_SSE2(v, 3));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    flt_sum = _mm_cvtsi128_si32(sum);
+#elif defined(WM_NEON)
+    int32x4_t in_0 = vdupq_n_s32(rfl);
+    int32x4_t in_1 = vdupq_n_s32(flt_in[0]);
+    int32x4_t in_2 = vdupq_n_s32(flt_in[1]);
+    int32x4_t sum = vdupq_n_s32(0);
+    int32x2_t sum_2;
+
+    for (; j <= (RVB_FILTERS - 4); j += 4) {
+        int32x4_t out_0 = vld1q_s32(&flt_out[0][j]);
+        int32x4_t out_1 = vld1q_s32(&flt_out[1][j]);
+        int32x4_t v;
+
+        v = vmulq_s32(in_0, vld1q_s32(&rvb->coeff[0][j]));
+        v = vmlaq_s32(v, in_1, vld1q_s32(&rvb->coeff[1][j]));
+        v = vmlaq_s32(v, in_2, vld1q_s32(&rvb->coeff[2][j]));
+        v = vmlsq_s32(v, out_0, vld1q_s32(&rvb->coeff[3][j]));
+        v = vmlsq_s32(v, out_1, vld1q_s32(&rvb->coeff[4][j]));
+        v = RVB_DIV_POW2_NEON(v, 10);
+        vst1q_s32(&flt_out[1][j], out_0);
+        vst1q_s32(&flt_out[0][j], v);
+        sum = vaddq_s32(sum, RVB_DIV_POW2_NEON(v, 3));
+    }
+    sum_2 = vadd_s32(vget_low_s32(sum), vget_high_s32(sum));
+    flt_sum = vget_lane_s32(vpadd_s32(sum_2, sum_2), 0);
+#endif
+
+    for (; j < RVB_FILTERS; j++) {
+        flt = (rfl * rvb->coeff[0][j])
+                + (flt_in[0] * rvb->coeff[1][j])
+                + (flt_in[1] * rvb->coeff[2][j])
+                - (flt_out[0][j] * rvb->coeff[3][j])
+                - (flt_out[1][j] * rvb->coeff[4][j]);
+        flt = RVB_DIV_POW2(flt, 10);
+        flt_out[1][j] = flt_out[0][j];
+        flt_out[0][j] = flt;
+        flt_sum += RVB_DIV_POW2(flt, 3);
+    }
+    flt_in[1] = flt_in[0];
+    flt_in[0] = rfl;
+    return (flt_sum);
+}
+
+/* smallest power of 2 that is at least n */
+static int rvb_pow2(int n) {
+    int pow2 = 1;
+    while (pow2 < n) {
+        pow2 <<= 1;
+    }
+    return (pow2);
+}
+
+/* frames until pos reaches the end of a buffer of buf_size, at most run */
+static inline int rvb_run(int run, int buf_size, int pos) {
+    return (((buf_size - pos) < run) ? (buf_size - pos) : run);
+}
+
+/* true when x is past RVB_QUIET either side of 0 */
+#define RVB_LOUD(x) ((uint32_t) ((x) + RVB_QUIET) > (2 * RVB_QUIET))
+
+/*
+ count the frames gone quiet, when there have been enough to run every
+ delay line dry the tail is over, so clear what is left of it
+ */
+static void rvb_quiet(struct _rvb *rvb, int loud, int frames) {
+    if (loud) {
+        rvb->quiet = 0;
+        return;
+    }
+    rvb->quiet += frames;
+    if (rvb->quiet >= rvb->quiet_max) {
+        _WM_reset_reverb(rvb);
+    }
+}
+
 /*
  reverb function
  */
 void _WM_reset_reverb(struct _rvb *rvb) {
-    int i, j, k;
+    int i;
     for (i = 0; i < rvb->l_buf_size; i++) {
         rvb->l_buf[i] = 0;
     }
     for (i = 0; i < rvb->r_buf_size; i++) {
         rvb->r_buf[i] = 0;
     }
-    for (k = 0; k < 8; k++) {
-        for (i = 0; i < 6; i++) {
-            for (j = 0; j < 2; j++) {
-                rvb->l_buf_flt_in[k][i][j] = 0;
-                rvb->l_buf_flt_out[k][i][j] = 0;
-                rvb->r_buf_flt_in[k][i][j] = 0;
-                rvb->r_buf_flt_out[k][i][j] = 0;
-            }
-        }
+    if (rvb->fdn_buf) {
+        memset(rvb->fdn_buf, 0, (sizeof(int32_t) * rvb->fdn_size * RVB_FDN_LINES));
     }
+    memset(rvb->fdn_lp, 0, sizeof(rvb->fdn_lp));
+    memset(rvb->l_buf_flt_in, 0, sizeof(rvb->l_buf_flt_in));
+    memset(rvb->r_buf_flt_in, 0, sizeof(rvb->r_buf_flt_in));
+    memset(rvb->l_buf_flt_out, 0, sizeof(rvb->l_buf_flt_out));
+    memset(rvb->r_buf_flt_out, 0, sizeof(rvb->r_buf_flt_out));
+    /* nothing left to ring */
+    rvb->quiet = rvb->quiet_max;
 }
 
 /*
- _WM_init_reverb
+ rvb_init_fdn
+
+ The cheap alternative, 8 delay lines feeding back into each other
+ through a Hadamard matrix, each with a low pass to damp the highs.
+ Line lengths follow the size of the room and so does the decay time,
+ about 1.2 seconds for the default room.
+ */
+static struct _rvb *rvb_init_fdn(int rate, float room_x, float room_y) {
+    /* spread around the mean free path, no two lengths share a factor */
+    static const double line_mul[RVB_FDN_LINES] = {
+        0.53, 0.61, 0.71, 0.79, 0.89, 1.0, 1.13, 1.27
+    };
+    struct _rvb *rtn_rvb = (struct _rvb *) calloc(1, sizeof(struct _rvb));
+    double path = ((room_x + room_y) / 2.0) / 340.29 * (double) rate;
+    double rt60 = 0.03 * (room_x + room_y) * (double) rate;
+    int max_len = 0;
+    int i;
+
+    if (rtn_rvb == NULL) {
+        return NULL;
+    }
+    rtn_rvb->type = RVB_FDN;
+    for (i = 0; i < RVB_FDN_LINES; i++) {
+        rtn_rvb->fdn_len[i] = ((int) (path * line_mul[i])) | 1;
+        if (rtn_rvb->fdn_len[i] > max_len)
+            max_len = rtn_rvb->fdn_len[i];
+        /* -60dB over rt60, with the 1/sqrt(8) the matrix needs */
+        rtn_rvb->fdn_gain[i] = (int32_t) (pow(10.0, (-3.0 * rtn_rvb->fdn_len[i] / rt60))
+                                          / sqrt((double) RVB_FDN_LINES) * 32768.0);
+    }
+    rtn_rvb->fdn_size = rvb_pow2(max_len + 1);
+    rtn_rvb->quiet_max = rtn_rvb->fdn_size;
+    rtn_rvb->fdn_buf = (int32_t *) malloc(sizeof(int32_t) * rtn_rvb->fdn_size * RVB_FDN_LINES);
+    if (rtn_rvb->fdn_buf == NULL) {
+        free(rtn_rvb);
+        return NULL;
+    }
+
+    _WM_reset_reverb(rtn_rvb);
+    return rtn_rvb;
+}
+
+/*
+ rvb_init_room
 
  =========================
  Engine Description
@@ -69,9 +269,8 @@ void _WM_reset_reverb(struct _rvb *rvb) {
  The combined sounds are also sent to the reflective points on the opposite side.
 
  */
-struct _rvb *
-_WM_init_reverb(int rate, float room_x, float room_y, float listen_x,
-        float listen_y) {
+static struct _rvb *rvb_init_room(int rate, float room_x, float room_y,
+        float listen_x, float listen_y) {
 
     /* filters set at 125Hz, 250Hz, 500Hz, 1000Hz, 2000Hz, 4000Hz */
     double Freq[] = {125.0, 250.0, 500.0, 1000.0, 2000.0, 4000.0};
@@ -120,7 +319,7 @@ _WM_init_reverb(int rate, float room_x, float room_y, float listen_x,
     double SPR_LSN_YOFS = 0.0;
     double SPR_LSN_DST = 0.0;
 
-    struct _rvb *rtn_rvb = (struct _rvb *) malloc(sizeof(struct _rvb));
+    struct _rvb *rtn_rvb = NULL;
     int j = 0;
     int i = 0;
 
@@ -170,9 +369,11 @@ _WM_init_reverb(int rate, float room_x, float room_y, float listen_x,
     if (SPR_LSN_DST > MAXR_DST)
         MAXR_DST = SPR_LSN_DST;
 
+    rtn_rvb = (struct _rvb *) calloc(1, sizeof(struct _rvb));
     if (rtn_rvb == NULL) {
         return NULL;
     }
+    rtn_rvb->type = RVB_ROOM;
 
     for (j = 0; j < 8; j++) {
         double SPL_RFL_XOFS = 0;
@@ -250,22 +451,28 @@ _WM_init_reverb(int rate, float room_x, float room_y, float listen_x,
             double a1 = -2 * cs;
             double a2 = 1 - (alpha / A);
 
-            rtn_rvb->coeff[j][i][0] = (int32_t) ((b0 / a0) * 1024.0);
-            rtn_rvb->coeff[j][i][1] = (int32_t) ((b1 / a0) * 1024.0);
-            rtn_rvb->coeff[j][i][2] = (int32_t) ((b2 / a0) * 1024.0);
-            rtn_rvb->coeff[j][i][3] = (int32_t) ((a1 / a0) * 1024.0);
-            rtn_rvb->coeff[j][i][4] = (int32_t) ((a2 / a0) * 1024.0);
+            rtn_rvb->coeff[0][(j * 6) + i] = (int32_t) ((b0 / a0) * 1024.0);
+            rtn_rvb->coeff[1][(j * 6) + i] = (int32_t) ((b1 / a0) * 1024.0);
+            rtn_rvb->coeff[2][(j * 6) + i] = (int32_t) ((b2 / a0) * 1024.0);
+            rtn_rvb->coeff[3][(j * 6) + i] = (int32_t) ((a1 / a0) * 1024.0);
+            rtn_rvb->coeff[4][(j * 6) + i] = (int32_t) ((a2 / a0) * 1024.0);
         }
     }
 
-    /* init the reverb buffers */
-    rtn_rvb->l_buf_size = (int) ((float) rate * (MAXL_DST / 340.29));
-    rtn_rvb->l_buf = (int32_t *) malloc(sizeof(int32_t) * (rtn_rvb->l_buf_size + 1));
+    /*
+     init the reverb buffers, rounded up to a power of 2 so positions
+     wrap with a mask. The delays are the distances between positions,
+     so the extra room doesn't change them.
+     */
+    rtn_rvb->l_buf_size = rvb_pow2((int) ((float) rate * (MAXL_DST / 340.29)) + 1);
+    rtn_rvb->l_buf = (int32_t *) malloc(sizeof(int32_t) * rtn_rvb->l_buf_size);
     rtn_rvb->l_out = 0;
 
-    rtn_rvb->r_buf_size = (int) ((float) rate * (MAXR_DST / 340.29));
-    rtn_rvb->r_buf = (int32_t *) malloc(sizeof(int32_t) * (rtn_rvb->r_buf_size + 1));
+    rtn_rvb->r_buf_size = rvb_pow2((int) ((float) rate * (MAXR_DST / 340.29)) + 1);
+    rtn_rvb->r_buf = (int32_t *) malloc(sizeof(int32_t) * rtn_rvb->r_buf_size);
     rtn_rvb->r_out = 0;
+    rtn_rvb->quiet_max = (rtn_rvb->l_buf_size > rtn_rvb->r_buf_size) ?
+            rtn_rvb->l_buf_size : rtn_rvb->r_buf_size;
 
     for (i = 0; i < 4; i++) {
         rtn_rvb->l_sp_in[i] = (int) ((float) rate * (SPL_DST[i] / 340.29));
@@ -284,94 +491,281 @@ _WM_init_reverb(int rate, float room_x, float room_y, float listen_x,
     return rtn_rvb;
 }
 
-/* _WM_free_reverb - free up memory used for reverb */
-void _WM_free_reverb(struct _rvb *rvb) {
-    if (!rvb) return;
+/*
+ _WM_init_reverb
+
+ A type of RVB_ROOM gives the model of the room from rvb_init_room,
+ RVB_FDN the delay network from rvb_init_fdn. Setting either up costs
+ a fair bit of maths and memory, so a reverb freed with the same settings
+ is taken back from the pool when there is one.
+ */
+struct _rvb *
+_WM_init_reverb(int rate, float room_x, float room_y, float listen_x,
+        float listen_y, int type) {
+    struct _rvb *rtn_rvb;
+    struct _rvb **pool_rvb;
+
+    _WM_Lock(&rvb_pool_lock);
+    for (pool_rvb = &rvb_pool; *pool_rvb; pool_rvb = &(*pool_rvb)->next) {
+        rtn_rvb = *pool_rvb;
+        if ((rtn_rvb->rate == rate) && (rtn_rvb->type == type)
+                && (rtn_rvb->room_x == room_x) && (rtn_rvb->room_y == room_y)
+                && (rtn_rvb->listen_x == listen_x)
+                && (rtn_rvb->listen_y == listen_y)) {
+            *pool_rvb = rtn_rvb->next;
+            rvb_pool_count--;
+            _WM_Unlock(&rvb_pool_lock);
+            rtn_rvb->next = NULL;
+            _WM_reset_reverb(rtn_rvb);
+            return rtn_rvb;
+        }
+    }
+    _WM_Unlock(&rvb_pool_lock);
+
+    if (type == RVB_FDN) {
+        rtn_rvb = rvb_init_fdn(rate, room_x, room_y);
+    } else {
+        rtn_rvb = rvb_init_room(rate, room_x, room_y, listen_x, listen_y);
+    }
+    if (rtn_rvb == NULL) {
+        return NULL;
+    }
+    rtn_rvb->rate = rate;
+    rtn_rvb->room_x = room_x;
+    rtn_rvb->room_y = room_y;
+    rtn_rvb->listen_x = listen_x;
+    rtn_rvb->listen_y = listen_y;
+    return rtn_rvb;
+}
+
+static void rvb_free(struct _rvb *rvb) {
     free(rvb->l_buf);
     free(rvb->r_buf);
+    free(rvb->fdn_buf);
     free(rvb);
 }
 
+/*
+ _WM_free_reverb - done with the reverb, keep it in the pool for the next
+ handle unless the pool is full
+ */
+void _WM_free_reverb(struct _rvb *rvb) {
+    if (!rvb) return;
+    _WM_Lock(&rvb_pool_lock);
+    if (rvb_pool_count < RVB_POOL_SIZE) {
+        rvb->next = rvb_pool;
+        rvb_pool = rvb;
+        rvb_pool_count++;
+        rvb = NULL;
+    }
+    _WM_Unlock(&rvb_pool_lock);
+    if (rvb) {
+        rvb_free(rvb);
+    }
+}
+
+/* _WM_free_reverb_pool - free up memory held by pooled reverbs */
+void _WM_free_reverb_pool(void) {
+    struct _rvb *rvb;
+
+    _WM_Lock(&rvb_pool_lock);
+    while (rvb_pool) {
+        rvb = rvb_pool;
+        rvb_pool = rvb->next;
+        rvb_free(rvb);
+    }
+    rvb_pool_count = 0;
+    _WM_Unlock(&rvb_pool_lock);
+}
+
+static void rvb_do_fdn(struct _rvb *rvb, int32_t *buffer, int size) {
+    int i, j;
+    int mask = rvb->fdn_size - 1;
+    int pos = rvb->fdn_pos;
+    int32_t *line;
+    int32_t mix[RVB_FDN_LINES];
+    int32_t a, b;
+    int32_t in_l, in_r;
+    int32_t out_l, out_r;
+    int32_t loud = 0;
+
+    for (i = 0; i < size; i += 2) {
+        loud |= buffer[i] | buffer[i + 1];
+        in_l = RVB_DIV_POW2(buffer[i], 1);
+        in_r = RVB_DIV_POW2(buffer[i + 1], 1);
+
+        /*
+         damp what comes out of each line, the damped lines are the output.
+         Rounding here and in the feedback is towards 0, so the tail dies
+         away to nothing rather than sitting on a small offset.
+         */
+        line = rvb->fdn_buf;
+        for (j = 0; j < RVB_FDN_LINES; j++) {
+            rvb->fdn_lp[j] = line[pos] + RVB_DIV_POW2(((rvb->fdn_lp[j] - line[pos]) * 3), 3);
+            mix[j] = rvb->fdn_lp[j];
+            line += rvb->fdn_size;
+        }
+        out_l = mix[0] + mix[2] + mix[4] + mix[6];
+        out_r = mix[1] + mix[3] + mix[5] + mix[7];
+
+        /* Hadamard matrix, as 3 rounds of butterflies */
+        for (j = 1; j < RVB_FDN_LINES; j <<= 1) {
+            int k, l;
+            for (k = 0; k < RVB_FDN_LINES; k += (j << 1)) {
+                for (l = k; l < (k + j); l++) {
+                    a = mix[l];
+                    b = mix[l + j];
+                    mix[l] = a + b;
+                    mix[l + j] = a - b;
+                }
+            }
+        }
+
+        /* feed back, with the input going to alternate lines */
+        line = rvb->fdn_buf;
+        for (j = 0; j < RVB_FDN_LINES; j++) {
+            line[(pos + rvb->fdn_len[j]) & mask] =
+                (int32_t) (((int64_t) mix[j] * rvb->fdn_gain[j]) / 32768)
+                + ((j & 1) ? in_r : in_l);
+            line += rvb->fdn_size;
+        }
+        pos = (pos + 1) & mask;
+
+        out_l = RVB_DIV_POW2(out_l, 2);
+        out_r = RVB_DIV_POW2(out_r, 2);
+        loud |= RVB_LOUD(out_l) | RVB_LOUD(out_r);
+        buffer[i] += out_l;
+        buffer[i + 1] += out_r;
+    }
+    rvb->fdn_pos = pos;
+    rvb_quiet(rvb, loud, (size >> 1));
+}
+
 void _WM_do_reverb(struct _rvb *rvb, int32_t *buffer, int size) {
-    int i, j, k;
-    int32_t l_buf_flt = 0;
-    int32_t r_buf_flt = 0;
+    int i, j, n, run;
     int32_t l_rfl = 0;
     int32_t r_rfl = 0;
-    int vol_div = 64;
+    int32_t l_flt_sum;
+    int32_t r_flt_sum;
+    int32_t loud = 0;
+    int32_t *l_buf = rvb->l_buf;
+    int32_t *r_buf = rvb->r_buf;
+    int l_mask = rvb->l_buf_size - 1;
+    int r_mask = rvb->r_buf_size - 1;
+    /* local copies, so writes to the buffers can't be taken to change them */
+    int l_sp_in[8];
+    int r_sp_in[8];
+    int l_in[4];
+    int r_in[4];
+    int l_out = rvb->l_out;
+    int r_out = rvb->r_out;
+
+    if (rvb->quiet >= rvb->quiet_max) {
+        /* the tail is over, so until something comes in there is no work */
+        for (i = 0; i < size; i++) {
+            if (buffer[i] != 0)
+                break;
+        }
+        if (i == size)
+            return;
+    }
 
-    for (i = 0; i < size; i += 2) {
-        int32_t tmp_l_val = 0;
-        int32_t tmp_r_val = 0;
+    if (rvb->type == RVB_FDN) {
+        rvb_do_fdn(rvb, buffer, size);
+        return;
+    }
+
+    for (j = 0; j < 8; j++) {
+        l_sp_in[j] = rvb->l_sp_in[j];
+        r_sp_in[j] = rvb->r_sp_in[j];
+    }
+    for (j = 0; j < 4; j++) {
+        l_in[j] = rvb->l_in[j];
+        r_in[j] = rvb->r_in[j];
+    }
+
+    for (i = 0; i < size; i += (run * 2)) {
         /*
-         add the initial reflections
-         from each speaker, 4 to go the left, 4 go to the right buffers
+         work in runs of frames that stop at the next point any of the
+         positions wraps, so inside a run they are plain offsets
          */
-        tmp_l_val = buffer[i] / vol_div;
-        tmp_r_val = buffer[i + 1] / vol_div;
+        run = rvb_run(((size - i) >> 1), rvb->l_buf_size, l_out);
+        run = rvb_run(run, rvb->r_buf_size, r_out);
         for (j = 0; j < 4; j++) {
-            rvb->l_buf[rvb->l_sp_in[j]] += tmp_l_val;
-            rvb->l_sp_in[j] = (rvb->l_sp_in[j] + 1) % rvb->l_buf_size;
-            rvb->l_buf[rvb->r_sp_in[j]] += tmp_r_val;
-            rvb->r_sp_in[j] = (rvb->r_sp_in[j] + 1) % rvb->l_buf_size;
-
-            rvb->r_buf[rvb->l_sp_in[j + 4]] += tmp_l_val;
-            rvb->l_sp_in[j + 4] = (rvb->l_sp_in[j + 4] + 1) % rvb->r_buf_size;
-            rvb->r_buf[rvb->r_sp_in[j + 4]] += tmp_r_val;
-            rvb->r_sp_in[j + 4] = (rvb->r_sp_in[j + 4] + 1) % rvb->r_buf_size;
+            run = rvb_run(run, rvb->l_buf_size, l_sp_in[j]);
+            run = rvb_run(run, rvb->l_buf_size, r_sp_in[j]);
+            run = rvb_run(run, rvb->r_buf_size, l_sp_in[j + 4]);
+            run = rvb_run(run, rvb->r_buf_size, r_sp_in[j + 4]);
+            run = rvb_run(run, rvb->l_buf_size, l_in[j]);
+            run = rvb_run(run, rvb->r_buf_size, r_in[j]);
         }
 
-        /*
-         filter the reverb output and add to buffer
-         */
-        l_rfl = rvb->l_buf[rvb->l_out];
-        rvb->l_buf[rvb->l_out] = 0;
-        rvb->l_out = (rvb->l_out + 1) % rvb->l_buf_size;
-
-        r_rfl = rvb->r_buf[rvb->r_out];
-        rvb->r_buf[rvb->r_out] = 0;
-        rvb->r_out = (rvb->r_out + 1) % rvb->r_buf_size;
-
-        for (k = 0; k < 8; k++) {
-            for (j = 0; j < 6; j++) {
-                l_buf_flt = ((l_rfl * rvb->coeff[k][j][0])
-                        + (rvb->l_buf_flt_in[k][j][0] * rvb->coeff[k][j][1])
-                        + (rvb->l_buf_flt_in[k][j][1] * rvb->coeff[k][j][2])
-                        - (rvb->l_buf_flt_out[k][j][0] * rvb->coeff[k][j][3])
-                        - (rvb->l_buf_flt_out[k][j][1] * rvb->coeff[k][j][4]))
-                        / 1024;
-                rvb->l_buf_flt_in[k][j][1] = rvb->l_buf_flt_in[k][j][0];
-                rvb->l_buf_flt_in[k][j][0] = l_rfl;
-                rvb->l_buf_flt_out[k][j][1] = rvb->l_buf_flt_out[k][j][0];
-                rvb->l_buf_flt_out[k][j][0] = l_buf_flt;
-                buffer[i] += l_buf_flt / 8;
-
-                r_buf_flt = ((r_rfl * rvb->coeff[k][j][0])
-                        + (rvb->r_buf_flt_in[k][j][0] * rvb->coeff[k][j][1])
-                        + (rvb->r_buf_flt_in[k][j][1] * rvb->coeff[k][j][2])
-                        - (rvb->r_buf_flt_out[k][j][0] * rvb->coeff[k][j][3])
-                        - (rvb->r_buf_flt_out[k][j][1] * rvb->coeff[k][j][4]))
-                        / 1024;
-                rvb->r_buf_flt_in[k][j][1] = rvb->r_buf_flt_in[k][j][0];
-                rvb->r_buf_flt_in[k][j][0] = r_rfl;
-                rvb->r_buf_flt_out[k][j][1] = rvb->r_buf_flt_out[k][j][0];
-                rvb->r_buf_flt_out[k][j][0] = r_buf_flt;
-                buffer[i + 1] += r_buf_flt / 8;
+        for (n = 0; n < run; n++) {
+            int32_t *frame = &buffer[i + (n * 2)];
+            int32_t tmp_l_val = 0;
+            int32_t tmp_r_val = 0;
+            /*
+             add the initial reflections
+             from each speaker, 4 to go the left, 4 go to the right buffers
+             */
+            loud |= frame[0] | frame[1];
+            tmp_l_val = RVB_DIV_POW2(frame[0], 6);
+            tmp_r_val = RVB_DIV_POW2(frame[1], 6);
+            for (j = 0; j < 4; j++) {
+                l_buf[l_sp_in[j] + n] += tmp_l_val;
+                l_buf[r_sp_in[j] + n] += tmp_r_val;
+                r_buf[l_sp_in[j + 4] + n] += tmp_l_val;
+                r_buf[r_sp_in[j + 4] + n] += tmp_r_val;
+            }
+
+            /*
+             filter the reverb output and add to buffer
+             */
+            l_rfl = l_buf[l_out + n];
+            l_buf[l_out + n] = 0;
+
+            r_rfl = r_buf[r_out + n];
+            r_buf[r_out + n] = 0;
+
+            /* every band of every reflection point at once */
+            l_flt_sum = rvb_filter(rvb, l_rfl, rvb->l_buf_flt_in, rvb->l_buf_flt_out);
+            r_flt_sum = rvb_filter(rvb, r_rfl, rvb->r_buf_flt_in, rvb->r_buf_flt_out);
+            loud |= RVB_LOUD(l_flt_sum) | RVB_LOUD(r_flt_sum);
+            frame[0] += l_flt_sum;
+            frame[1] += r_flt_sum;
+
+            /*
+             add filtered result back into the buffers but on the opposite side
+             */
+            tmp_l_val = RVB_DIV_POW2(frame[1], 6);
+            tmp_r_val = RVB_DIV_POW2(frame[0], 6);
+            for (j = 0; j < 4; j++) {
+                l_buf[l_in[j] + n] += tmp_l_val;
+                r_buf[r_in[j] + n] += tmp_r_val;
             }
         }
 
-        /*
-         add filtered result back into the buffers but on the opposite side
-         */
-        tmp_l_val = buffer[i + 1] / vol_div;
-        tmp_r_val = buffer[i] / vol_div;
+        l_out = (l_out + run) & l_mask;
+        r_out = (r_out + run) & r_mask;
         for (j = 0; j < 4; j++) {
-            rvb->l_buf[rvb->l_in[j]] += tmp_l_val;
-            rvb->l_in[j] = (rvb->l_in[j] + 1) % rvb->l_buf_size;
-
-            rvb->r_buf[rvb->r_in[j]] += tmp_r_val;
-            rvb->r_in[j] = (rvb->r_in[j] + 1) % rvb->r_buf_size;
+            l_sp_in[j] = (l_sp_in[j] + run) & l_mask;
+            r_sp_in[j] = (r_sp_in[j] + run) & l_mask;
+            l_sp_in[j + 4] = (l_sp_in[j + 4] + run) & r_mask;
+            r_sp_in[j + 4] = (r_sp_in[j + 4] + run) & r_mask;
+            l_in[j] = (l_in[j] + run) & l_mask;
+            r_in[j] = (r_in[j] + run) & r_mask;
         }
     }
-}
 
+    rvb->l_out = l_out;
+    rvb->r_out = r_out;
+    for (j = 0; j < 8; j++) {
+        rvb->l_sp_in[j] = l_sp_in[j];
+        rvb->r_sp_in[j] = r_sp_in[j];
+    }
+    for (j = 0; j < 4; j++) {
+        rvb->l_in[j] = l_in[j];
+        rvb->r_in[j] = r_in[j];
+    }
+    rvb_quiet(rvb, loud, (size >> 1));
+}
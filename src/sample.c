@@ -130,22 +130,13 @@ _WM_load_sample(struct _patch *sample_patch) {
     if (_WM_auto_amp) {
         int16_t tmp_max = 0;
         int16_t tmp_min = 0;
-        int16_t samp_max = 0;
-        int16_t samp_min = 0;
         tmp_sample = guspat;
         do {
-            samp_max = 0;
-            samp_min = 0;
-            for (i = 0; i < (tmp_sample->data_length >> 10); i++) {
-                if (tmp_sample->data[i] > samp_max)
-                    samp_max = tmp_sample->data[i];
-                if (tmp_sample->data[i] < samp_min)
-                    samp_min = tmp_sample->data[i];
-            }
-            if (samp_max > tmp_max)
-                tmp_max = samp_max;
-            if (samp_min < tmp_min)
-                tmp_min = samp_min;
+            /* peaks are recorded while converting the sample data */
+            if (tmp_sample->peak_max > tmp_max)
+                tmp_max = tmp_sample->peak_max;
+            if (tmp_sample->peak_min < tmp_min)
+                tmp_min = tmp_sample->peak_min;
             tmp_sample = tmp_sample->next;
         } while (tmp_sample);
         if (_WM_auto_amp_with_amp) {
@@ -0,0 +1,380 @@
+/*
+ * thread.c - background worker threads for lib
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#if defined(WM_NO_LOCK)
+/* no locking means no threads either */
+#elif defined(_WIN32)
+#include <windows.h>
+#include <process.h>
+#define WM_THREADS_WIN32
+#elif defined(HAVE_PTHREAD)
+#include <pthread.h>
+#include <unistd.h>
+#define WM_THREADS_PTHREAD
+#endif
+
+#include "lock.h"
+#include "thread.h"
+
+struct _WM_Thread {
+#if defined(WM_THREADS_WIN32)
+    HANDLE handle;
+#elif defined(WM_THREADS_PTHREAD)
+    pthread_t id;
+#endif
+    _WM_ThreadFunc func;
+    void *arg;
+};
+
+#if defined(WM_THREADS_WIN32)
+static unsigned __stdcall WM_ThreadStart(void *arg) {
+    struct _WM_Thread *thread = (struct _WM_Thread *) arg;
+    thread->func(thread->arg);
+    return (0);
+}
+#elif defined(WM_THREADS_PTHREAD)
+static void *WM_ThreadStart(void *arg) {
+    struct _WM_Thread *thread = (struct _WM_Thread *) arg;
+    thread->func(thread->arg);
+    return (NULL);
+}
+#endif
+
+/*
+ _WM_CreateThread(func, arg)
+
+ func = function to run
+ arg  = pointer passed to func
+
+ returns a thread which must be passed to _WM_JoinThread, or
+ NULL if no thread could be started. Callers are expected to
+ run func themselves in that case.
+ */
+struct _WM_Thread *_WM_CreateThread(_WM_ThreadFunc func, void *arg) {
+#if defined(WM_THREADS_WIN32) || defined(WM_THREADS_PTHREAD)
+    struct _WM_Thread *thread = (struct _WM_Thread *) malloc(sizeof(struct _WM_Thread));
+    if (thread == NULL) return (NULL);
+
+    thread->func = func;
+    thread->arg = arg;
+#if defined(WM_THREADS_WIN32)
+    thread->handle = (HANDLE) _beginthreadex(NULL, 0, WM_ThreadStart, thread, 0, NULL);
+    if (thread->handle == 0) {
+        free(thread);
+        return (NULL);
+    }
+#else
+    if (pthread_create(&thread->id, NULL, WM_ThreadStart, thread) != 0) {
+        free(thread);
+        return (NULL);
+    }
+#endif
+    return (thread);
+#else
+    (void) func;
+    (void) arg;
+    return (NULL);
+#endif
+}
+
+/*
+ _WM_JoinThread(thread)
+
+ thread = a thread returned by _WM_CreateThread
+
+ returns nothing
+
+ Waits for the thread to finish and frees it.
+ */
+void _WM_JoinThread(struct _WM_Thread *thread) {
+    if (thread == NULL) return;
+#if defined(WM_THREADS_WIN32)
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#elif defined(WM_THREADS_PTHREAD)
+    pthread_join(thread->id, NULL);
+#endif
+    free(thread);
+}
+
+struct _WM_Signal {
+#if defined(WM_THREADS_WIN32)
+    HANDLE event;
+#elif defined(WM_THREADS_PTHREAD)
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int raised;
+#endif
+};
+
+/*
+ _WM_CreateSignal()
+
+ returns a signal for one thread to wake another with, or NULL
+ when threads are not supported or it could not be set up.
+ */
+struct _WM_Signal *_WM_CreateSignal(void) {
+#if defined(WM_THREADS_WIN32) || defined(WM_THREADS_PTHREAD)
+    struct _WM_Signal *signal = (struct _WM_Signal *) calloc(1, sizeof(struct _WM_Signal));
+    if (signal == NULL) return (NULL);
+
+#if defined(WM_THREADS_WIN32)
+    signal->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (signal->event != NULL) return (signal);
+#else
+    if (pthread_mutex_init(&signal->mutex, NULL) == 0) {
+        if (pthread_cond_init(&signal->cond, NULL) == 0) return (signal);
+        pthread_mutex_destroy(&signal->mutex);
+    }
+#endif
+    free(signal);
+#endif
+    return (NULL);
+}
+
+/*
+ _WM_RaiseSignal(signal)
+
+ signal = a signal returned by _WM_CreateSignal
+
+ returns nothing
+
+ Wakes the thread waiting on the signal, or the next one to wait on
+ it. Raising it again before then has no further effect.
+ */
+void _WM_RaiseSignal(struct _WM_Signal *signal) {
+#if defined(WM_THREADS_WIN32)
+    SetEvent(signal->event);
+#elif defined(WM_THREADS_PTHREAD)
+    pthread_mutex_lock(&signal->mutex);
+    signal->raised = 1;
+    pthread_cond_signal(&signal->cond);
+    pthread_mutex_unlock(&signal->mutex);
+#else
+    (void) signal;
+#endif
+}
+
+/*
+ _WM_WaitSignal(signal)
+
+ signal = a signal returned by _WM_CreateSignal
+
+ returns nothing
+
+ Waits for the signal to be raised and lowers it again.
+ */
+void _WM_WaitSignal(struct _WM_Signal *signal) {
+#if defined(WM_THREADS_WIN32)
+    WaitForSingleObject(signal->event, INFINITE);
+#elif defined(WM_THREADS_PTHREAD)
+    pthread_mutex_lock(&signal->mutex);
+    while (!signal->raised) {
+        pthread_cond_wait(&signal->cond, &signal->mutex);
+    }
+    signal->raised = 0;
+    pthread_mutex_unlock(&signal->mutex);
+#else
+    (void) signal;
+#endif
+}
+
+/*
+ _WM_FreeSignal(signal)
+
+ signal = a signal returned by _WM_CreateSignal, or NULL
+
+ returns nothing
+ */
+void _WM_FreeSignal(struct _WM_Signal *signal) {
+    if (signal == NULL) return;
+#if defined(WM_THREADS_WIN32)
+    CloseHandle(signal->event);
+#elif defined(WM_THREADS_PTHREAD)
+    pthread_cond_destroy(&signal->cond);
+    pthread_mutex_destroy(&signal->mutex);
+#endif
+    free(signal);
+}
+
+#if defined(WM_THREADS_WIN32) || defined(WM_THREADS_PTHREAD)
+/*
+ * A thread kept around to run one function at a time for the pool,
+ * sleeping in between.
+ */
+struct _WM_Worker {
+    struct _WM_Thread *thread;
+    struct _WM_Signal *start;
+    struct _WM_Signal *done;
+    _WM_ThreadFunc func;
+    void *arg;
+    int quit;
+};
+
+#define WM_POOL_SIZE 15
+
+static struct _WM_Worker *WM_Pool[WM_POOL_SIZE];
+static int WM_PoolCount = 0;
+static int WM_PoolBusy = 0;
+static int WM_PoolLock = 0;
+
+static void WM_WorkerMain(void *arg) {
+    struct _WM_Worker *worker = (struct _WM_Worker *) arg;
+
+    for (;;) {
+        _WM_WaitSignal(worker->start);
+        if (worker->quit) break;
+        worker->func(worker->arg);
+        _WM_RaiseSignal(worker->done);
+    }
+}
+
+static struct _WM_Worker *WM_CreateWorker(void) {
+    struct _WM_Worker *worker = (struct _WM_Worker *) calloc(1, sizeof(struct _WM_Worker));
+    if (worker == NULL) return (NULL);
+
+    worker->start = _WM_CreateSignal();
+    worker->done = _WM_CreateSignal();
+    if ((worker->start != NULL) && (worker->done != NULL)) {
+        worker->thread = _WM_CreateThread(WM_WorkerMain, worker);
+        if (worker->thread != NULL) return (worker);
+    }
+    _WM_FreeSignal(worker->start);
+    _WM_FreeSignal(worker->done);
+    free(worker);
+    return (NULL);
+}
+
+static void WM_WorkerStart(struct _WM_Worker *worker, _WM_ThreadFunc func, void *arg) {
+    worker->func = func;
+    worker->arg = arg;
+    _WM_RaiseSignal(worker->start);
+}
+
+static void WM_WorkerWait(struct _WM_Worker *worker) {
+    _WM_WaitSignal(worker->done);
+}
+
+static void WM_FreeWorker(struct _WM_Worker *worker) {
+    worker->quit = 1;
+    _WM_RaiseSignal(worker->start);
+    _WM_JoinThread(worker->thread);
+    _WM_FreeSignal(worker->start);
+    _WM_FreeSignal(worker->done);
+    free(worker);
+}
+#endif
+
+/*
+ _WM_RunOnPool(func, arg, threads)
+
+ func    = function to run
+ arg     = pointer passed to func
+ threads = how many threads should run func, the caller included
+
+ returns nothing
+
+ Runs func on the calling thread and on up to threads - 1 pooled
+ threads at once, returning once all of them are done. The pool
+ threads are started on first use and kept until _WM_FreeThreadPool.
+ While another caller has the pool func only runs on the calling
+ thread, so func must not rely on the number of threads it gets.
+ */
+void _WM_RunOnPool(_WM_ThreadFunc func, void *arg, int threads) {
+#if defined(WM_THREADS_WIN32) || defined(WM_THREADS_PTHREAD)
+    int count = 0;
+    int mine = 0;
+    int i;
+
+    if (threads > 1) {
+        _WM_Lock(&WM_PoolLock);
+        if (!WM_PoolBusy) {
+            WM_PoolBusy = 1;
+            mine = 1;
+        }
+        _WM_Unlock(&WM_PoolLock);
+    }
+    if (mine) {
+        count = threads - 1;
+        if (count > WM_POOL_SIZE) count = WM_POOL_SIZE;
+        while (WM_PoolCount < count) {
+            struct _WM_Worker *worker = WM_CreateWorker();
+            if (worker == NULL) break;
+            WM_Pool[WM_PoolCount++] = worker;
+        }
+        if (count > WM_PoolCount) count = WM_PoolCount;
+        for (i = 0; i < count; i++) {
+            WM_WorkerStart(WM_Pool[i], func, arg);
+        }
+    }
+    func(arg);
+    if (mine) {
+        for (i = 0; i < count; i++) {
+            WM_WorkerWait(WM_Pool[i]);
+        }
+        _WM_Lock(&WM_PoolLock);
+        WM_PoolBusy = 0;
+        _WM_Unlock(&WM_PoolLock);
+    }
+#else
+    (void) threads;
+    func(arg);
+#endif
+}
+
+/*
+ _WM_FreeThreadPool()
+
+ returns nothing
+
+ Stops the pool threads. Nothing may be running on the pool.
+ */
+void _WM_FreeThreadPool(void) {
+#if defined(WM_THREADS_WIN32) || defined(WM_THREADS_PTHREAD)
+    while (WM_PoolCount) {
+        WM_FreeWorker(WM_Pool[--WM_PoolCount]);
+    }
+#endif
+}
+
+/*
+ _WM_GetCPUCount()
+
+ returns the number of processors available to run threads on,
+ or 1 when threads are not supported or the count is unknown.
+ */
+int _WM_GetCPUCount(void) {
+#if defined(WM_THREADS_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    if (info.dwNumberOfProcessors > 0) return ((int) info.dwNumberOfProcessors);
+#elif defined(WM_THREADS_PTHREAD) && defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0) return ((int) count);
+#endif
+    return (1);
+}
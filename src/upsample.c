@@ -0,0 +1,177 @@
+/*
+ * upsample.c - doubles the rate of the output for lib
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "upsample.h"
+
+/*
+ The output is mixed at half the rate and doubled with a half band
+ filter. Every other output frame is an input frame as it is, the ones
+ between come from UPS_TAPS frames either side, windowed sinc weighted.
+ */
+
+struct _upsample *_WM_init_upsample(int channels) {
+    struct _upsample *ups = (struct _upsample *) calloc(1, sizeof(struct _upsample));
+    double coeff[UPS_TAPS];
+    double sum = 0.0;
+    double t;
+    int i;
+
+    if (ups == NULL) {
+        return NULL;
+    }
+    ups->channels = channels;
+    for (i = 0; i < UPS_TAPS; i++) {
+        /* sinc at half way between frames, Blackman window */
+        t = (double) i + 0.5;
+        coeff[i] = sin(M_PI * t) / (M_PI * t);
+        coeff[i] *= 0.42 + (0.5 * cos(M_PI * t / UPS_TAPS))
+                + (0.08 * cos(2.0 * M_PI * t / UPS_TAPS));
+        sum += coeff[i] * 2.0;
+    }
+    /* so a steady level comes out at the same level */
+    for (i = 0; i < UPS_TAPS; i++) {
+        ups->coeff[i] = (int32_t) floor((coeff[i] / sum * 16384.0) + 0.5);
+    }
+    return ups;
+}
+
+void _WM_reset_upsample(struct _upsample *ups) {
+    if (!ups) return;
+    ups->have_spare = 0;
+    ups->flushed = 0;
+    if (!ups->buf) return;
+    memset(ups->buf, 0, (UPS_HIST * ups->channels * 2));
+}
+
+void _WM_free_upsample(struct _upsample *ups) {
+    if (!ups) return;
+    free(ups->buf);
+    free(ups);
+}
+
+/*
+ Where to mix size bytes of half rate output, the buffer follows on from
+ the history. NULL if there is no memory for it.
+ */
+int8_t *_WM_upsample_buffer(struct _upsample *ups, uint32_t size) {
+    uint32_t hist = UPS_HIST * ups->channels * 2;
+    int8_t *buf;
+
+    if (hist + size > ups->buf_size) {
+        buf = (int8_t *) realloc(ups->buf, (hist + size));
+        if (buf == NULL) {
+            return NULL;
+        }
+        if (ups->buf == NULL) {
+            memset(buf, 0, hist);
+        }
+        ups->buf = buf;
+        ups->buf_size = hist + size;
+    }
+    return (ups->buf + hist);
+}
+
+/*
+ Puts the frame left over from the last _WM_do_upsample() into out, if
+ there is one. Returns the bytes put there.
+ */
+uint32_t _WM_upsample_spare(struct _upsample *ups, int8_t *out) {
+    if (!ups->have_spare) {
+        return 0;
+    }
+    memcpy(out, ups->spare, (ups->channels * 2));
+    ups->have_spare = 0;
+    return (ups->channels * 2);
+}
+
+/*
+ For when the input has ended with size bytes in _WM_upsample_buffer(),
+ which has room for room bytes. Pads them with silence to bring out the
+ UPS_TAPS - 1 frames the filter still holds back, as far as there is
+ room and they haven't been already. Returns the bytes to double.
+ */
+uint32_t _WM_upsample_flush(struct _upsample *ups, uint32_t size, uint32_t room) {
+    uint32_t frame_size = ups->channels * 2;
+    uint32_t frames = (room - size) / frame_size;
+
+    if (frames > ((UPS_TAPS - 1) - ups->flushed)) {
+        frames = (UPS_TAPS - 1) - ups->flushed;
+    }
+    memset((ups->buf + (UPS_HIST * frame_size) + size), 0, (frames * frame_size));
+    ups->flushed += frames;
+    return (size + (frames * frame_size));
+}
+
+/*
+ Doubles the size bytes mixed into _WM_upsample_buffer() into out, which
+ has room for out_size bytes. When that is a frame short the last frame
+ is kept for _WM_upsample_spare(). Returns the bytes put in out.
+ */
+uint32_t _WM_do_upsample(struct _upsample *ups, int8_t *out, uint32_t size, uint32_t out_size) {
+    int16_t *in = (int16_t *) ups->buf;
+    int16_t *dst = (int16_t *) out;
+    int channels = ups->channels;
+    uint32_t frames = size / (channels * 2);
+    uint32_t out_frames = out_size / (channels * 2);
+    uint32_t i;
+    int ch, k;
+    int32_t acc;
+
+    for (i = 0; i < frames; i++) {
+        /* in[] frame (UPS_TAPS - 1) is the one going out now */
+        int16_t *frame = &in[(i + UPS_TAPS - 1) * channels];
+        for (ch = 0; ch < channels; ch++) {
+            acc = 8192;
+            for (k = 0; k < UPS_TAPS; k++) {
+                acc += ups->coeff[k] * (frame[ch - (k * channels)]
+                                        + frame[ch + ((k + 1) * channels)]);
+            }
+            acc >>= 14;
+            if (acc > 32767) acc = 32767;
+            else if (acc < -32768) acc = -32768;
+            dst[ch] = frame[ch];
+            if (((i * 2) + 1) < out_frames) {
+                dst[ch + channels] = (int16_t) acc;
+            } else {
+                ups->spare[ch] = (int16_t) acc;
+                ups->have_spare = 1;
+            }
+        }
+        dst += channels * 2;
+    }
+    /* keep the last frames for the next call */
+    memmove(ups->buf, (ups->buf + size), (UPS_HIST * channels * 2));
+
+    if (ups->have_spare) {
+        return ((frames * 2) - 1) * channels * 2;
+    }
+    return (frames * 2 * channels * 2);
+}
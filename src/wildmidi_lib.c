@@ -36,12 +36,16 @@
 #include "wm_error.h"
 #include "file_io.h"
 #include "lock.h"
+#include "thread.h"
 #include "reverb.h"
+#include "chorus.h"
+#include "upsample.h"
 #include "gus_pat.h"
 #include "common.h"
 #include "wildmidi_lib.h"
 #include "filenames.h"
 #include "internal_midi.h"
+#include "live.h"
 #include "f_hmi.h"
 #include "f_hmp.h"
 #include "f_midi.h"
@@ -62,6 +66,10 @@ static int WM_Initialized = 0;
 uint16_t _WM_MixerOptions = 0;
 
 uint16_t _WM_SampleRate;
+/* WM_MO_HALF_RATE mixes at _WM_SampleRate, the output is this much faster */
+static int WM_RateShift = 0;
+/* bytes in an output frame as a shift, 1 with WM_MO_MONO */
+static int WM_FrameShift = 2;
 int16_t _WM_MasterVolume;
 
 /* when converting files to midi */
@@ -79,6 +87,7 @@ float _WM_reverb_room_length = 22.5f;
 
 float _WM_reverb_listen_posx = 8.4375f;
 float _WM_reverb_listen_posy = 16.875f;
+int _WM_reverb_type = RVB_ROOM;
 
 int _WM_fix_release = 0;
 int _WM_auto_amp = 0;
@@ -186,6 +195,19 @@ struct _hndl {
 
 static struct _hndl * first_handle = NULL;
 
+struct _async_job {
+    char *filename;
+    struct _mdi *mdi;
+    _WM_Async_Callback callback;
+    void *user;
+    struct _WM_Thread *thread;
+    int done;
+    struct _async_job *next;
+};
+
+static struct _async_job *async_jobs = NULL;
+static int async_lock = 0;
+
 #define MAX_AUTO_AMP 2.0
 
 /*
@@ -552,6 +574,23 @@ static int load_config(const char *config_file, const char *conf_dir) {
                             _WM_DEBUG_MSG("%s: reverb_listen_posy set outside of room", config_file);
                             _WM_reverb_listen_posy = _WM_reverb_room_length * 0.75f;
                         }
+                    } else if (wm_strcasecmp(line_tokens[0], "reverb_type") == 0) {
+                        if (!line_tokens[1]) {
+                            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(syntax error in reverb_type line)", 0);
+                            WM_FreePatches();
+                            free(config_dir);
+                            free(line_tokens);
+                            _WM_FreeBufferFile(config_buffer);
+                            return (-1);
+                        }
+                        if (wm_strcasecmp(line_tokens[1], "fdn") == 0) {
+                            _WM_reverb_type = RVB_FDN;
+                        } else if (wm_strcasecmp(line_tokens[1], "room") == 0) {
+                            _WM_reverb_type = RVB_ROOM;
+                        } else {
+                            _WM_DEBUG_MSG("%s: unknown reverb_type, using room", config_file);
+                            _WM_reverb_type = RVB_ROOM;
+                        }
                     } else if (wm_strcasecmp(line_tokens[0], "guspat_editor_author_cant_read_so_fix_release_time_for_me") == 0) {
                         _WM_fix_release = 1;
                     } else if (wm_strcasecmp(line_tokens[0], "auto_amp") == 0) {
@@ -819,7 +858,135 @@ static int add_handle(void * handle) {
 #endif
 
 
-static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
+/*
+ * Bounce a ping pong loop off its ends.
+ * overshoot is how far the last step went past the loop point the note was
+ * heading towards, which can be more than a loop length for large increments.
+ */
+static inline void WM_PingPongLoop(struct _note *note_data, uint32_t overshoot) {
+    uint32_t loop_size = note_data->sample->loop_size;
+
+    overshoot %= (loop_size << 1);
+    if (overshoot > loop_size) {
+        overshoot -= loop_size;
+    } else {
+        note_data->loop_reverse ^= 1;
+    }
+    if (note_data->loop_reverse) {
+        note_data->sample_pos = note_data->sample->loop_end - overshoot;
+    } else {
+        note_data->sample_pos = note_data->sample->loop_start + overshoot;
+    }
+}
+
+/*
+ * Output samples left before the song reaches its next event, at most max.
+ * The song runs tempo_scale / 65536 samples for every output sample, which
+ * scales every delay the tempo map gave us without touching the events.
+ */
+static inline uint32_t WM_OutputToEvent(struct _mdi *mdi, uint32_t max) {
+    uint64_t song_left;
+    uint64_t output_left;
+
+    if (__builtin_expect((mdi->tempo_scale == TEMPO_SCALE_ONE), 1)) {
+        return ((mdi->samples_to_mix < max) ? mdi->samples_to_mix : max);
+    }
+    song_left = ((uint64_t) mdi->samples_to_mix << 16) - mdi->tempo_scale_pos;
+    output_left = (song_left + mdi->tempo_scale - 1) / mdi->tempo_scale;
+    return ((output_left < max) ? (uint32_t) output_left : max);
+}
+
+/*
+ * Move the song on by count output samples. Whatever goes past the next
+ * event is kept in tempo_scale_pos for WM_CatchUpSong().
+ */
+static inline void WM_AdvanceSong(struct _mdi *mdi, uint32_t count) {
+    uint64_t song_pos;
+
+    if (__builtin_expect((mdi->tempo_scale == TEMPO_SCALE_ONE), 1)) {
+        mdi->extra_info.current_sample += count;
+        mdi->samples_to_mix -= count;
+        return;
+    }
+    song_pos = ((uint64_t) count * mdi->tempo_scale) + mdi->tempo_scale_pos;
+    if ((song_pos >> 16) >= mdi->samples_to_mix) {
+        mdi->tempo_scale_pos = (uint32_t) (song_pos - ((uint64_t) mdi->samples_to_mix << 16));
+        mdi->extra_info.current_sample += mdi->samples_to_mix;
+        mdi->samples_to_mix = 0;
+    } else {
+        mdi->tempo_scale_pos = (uint32_t) (song_pos & 0xffff);
+        mdi->extra_info.current_sample += (uint32_t) (song_pos >> 16);
+        mdi->samples_to_mix -= (uint32_t) (song_pos >> 16);
+    }
+}
+
+/*
+ * Spend the song samples a sped up song already ran past the last event
+ * on the delay to the next, so short gaps pass without any output.
+ */
+static inline void WM_CatchUpSong(struct _mdi *mdi) {
+    uint32_t whole = mdi->tempo_scale_pos >> 16;
+
+    if (whole > mdi->samples_to_mix) {
+        whole = mdi->samples_to_mix;
+    }
+    mdi->tempo_scale_pos -= whole << 16;
+    mdi->extra_info.current_sample += whole;
+    mdi->samples_to_mix -= whole;
+}
+
+/* a step of the note's low pass, the biquad from set_channel_lpf */
+static inline int32_t WM_LowPass(struct _note *nte, int32_t in) {
+    int32_t out = (int32_t)(((int64_t)nte->lpf_b0 * (in + (nte->lpf_x[0] * 2) + nte->lpf_x[1])
+                             - ((int64_t)nte->lpf_a1 * nte->lpf_y[0])
+                             - ((int64_t)nte->lpf_a2 * nte->lpf_y[1])) >> LPF_BITS);
+    nte->lpf_x[1] = nte->lpf_x[0];
+    nte->lpf_x[0] = in;
+    nte->lpf_y[1] = nte->lpf_y[0];
+    nte->lpf_y[0] = out;
+    return (out);
+}
+
+/*
+ Only what the channels send to the reverb goes through it. It comes back
+ with the reverb added, so the send is taken out of the mix first.
+ */
+static void WM_ReverbSend(struct _mdi *mdi, int32_t *buffer, uint32_t size) {
+    int32_t *rvb_buffer = mdi->reverb_buffer;
+    uint32_t i;
+
+    for (i = 0; i < size; i++) {
+        buffer[i] -= rvb_buffer[i];
+    }
+    if (WM_FrameShift == 1) {
+        /*
+         the reverb is a stereo room, so in mono the send goes in on both
+         sides and what comes back is the average of the two
+         */
+        i = size;
+        while (i--) {
+            rvb_buffer[(i * 2) + 1] = rvb_buffer[i * 2] = rvb_buffer[i];
+        }
+        _WM_do_reverb(mdi->reverb, rvb_buffer, (size * 2));
+        for (i = 0; i < size; i++) {
+            buffer[i] += (rvb_buffer[i * 2] + rvb_buffer[(i * 2) + 1]) / 2;
+        }
+        return;
+    }
+    _WM_do_reverb(mdi->reverb, rvb_buffer, size);
+    for (i = 0; i < size; i++) {
+        buffer[i] += rvb_buffer[i];
+    }
+}
+
+/* the mixers are built once for mono and once for stereo */
+#ifdef __GNUC__
+#define WM_ALWAYS_INLINE static inline __attribute__((always_inline))
+#else
+#define WM_ALWAYS_INLINE static inline
+#endif
+
+WM_ALWAYS_INLINE int WM_Mix_Linear(midi * handle, int8_t *buffer, uint32_t size, const int mono) {
     uint32_t buffer_used = 0;
     uint32_t i, env_ptr;
     struct _mdi *mdi = (struct _mdi *) handle;
@@ -829,22 +996,33 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
 //  int32_t vol_mul;
     struct _note *note_data = NULL;
     uint32_t count;
-    struct _event *event = mdi->current_event;
+    struct _event *event;
     int32_t *tmp_buffer;
     int32_t *out_buffer;
+    int32_t *rvb_buffer = NULL;
+    int32_t *cho_buffer = NULL;
+    int32_t premix_left, premix_right;
+    int32_t rvb_left, rvb_right;
+    int32_t cho_left, cho_right;
+    /* two channels' worth even in mono, the reverb runs in stereo */
+    uint32_t mix_size = (size >> WM_FrameShift) * 2;
 
     _WM_Lock(&mdi->lock);
+    /* the parse thread moves the events about under the lock */
+    event = mdi->current_event;
 
     buffer_used = 0;
     memset(buffer, 0, size);
 
-    if ( (size / 2) > mdi->mix_buffer_size) {
-        if ( (size / 2) <= ( mdi->mix_buffer_size * 2 )) {
+    if (mix_size > mdi->mix_buffer_size) {
+        if (mix_size <= ( mdi->mix_buffer_size * 2 )) {
             mdi->mix_buffer_size += MEM_CHUNK;
         } else {
-            mdi->mix_buffer_size = size / 2;
+            mdi->mix_buffer_size = mix_size;
         }
         mdi->mix_buffer = (int32_t *) realloc(mdi->mix_buffer, mdi->mix_buffer_size * sizeof(int32_t));
+        mdi->reverb_buffer = (int32_t *) realloc(mdi->reverb_buffer, mdi->mix_buffer_size * sizeof(int32_t));
+        mdi->chorus_buffer = (int32_t *) realloc(mdi->chorus_buffer, mdi->mix_buffer_size * sizeof(int32_t));
     }
 
     tmp_buffer = mdi->mix_buffer;
@@ -852,39 +1030,50 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
     memset(tmp_buffer, 0, ((size / 2) * sizeof(int32_t)));
     out_buffer = tmp_buffer;
 
+    if (mdi->extra_info.mixer_options & WM_MO_REVERB) {
+        rvb_buffer = mdi->reverb_buffer;
+        memset(rvb_buffer, 0, ((size / 2) * sizeof(int32_t)));
+    }
+    if (mdi->chorus) {
+        cho_buffer = mdi->chorus_buffer;
+        memset(cho_buffer, 0, ((size / 2) * sizeof(int32_t)));
+    }
+
     do {
         if (__builtin_expect((!mdi->samples_to_mix), 0)) {
-            while ((!mdi->samples_to_mix) && (event->do_event)) {
-                event->do_event(mdi, &event->event_data);
-                if ((mdi->extra_info.mixer_options & WM_MO_LOOP) && (event[0].evtype == ev_meta_endoftrack)) {
-                    _WM_ResetToStart(mdi);
+            while ((!mdi->samples_to_mix) && (event->evtype != ev_null)) {
+                if (__builtin_expect((mdi->extra_info.current_sample >= mdi->checkpoint_next), 0)) {
+                    _WM_SaveCheckpoint(mdi, event, 1);
+                }
+                _WM_do_event[event->evtype](mdi, event);
+                if ((mdi->extra_info.mixer_options & WM_MO_LOOP) && (event[0].evtype == ev_meta_endoftrack)
+                    && (_WM_ResetToStart(mdi) == 0)) {
                     event = mdi->current_event;
                 } else {
                     mdi->samples_to_mix = event->samples_to_next;
                     event++;
                     mdi->current_event = event;
                 }
+                if (__builtin_expect((mdi->tempo_scale_pos >= 0x10000), 0)) {
+                    WM_CatchUpSong(mdi);
+                }
             }
 
             if (__builtin_expect((!mdi->samples_to_mix), 0)) {
                 if (mdi->extra_info.current_sample >= mdi->extra_info.approx_total_samples) {
                     break;
                 } else if ((mdi->extra_info.approx_total_samples
-                             - mdi->extra_info.current_sample) > (size >> 2)) {
-                    mdi->samples_to_mix = size >> 2;
+                             - mdi->extra_info.current_sample) > (size >> WM_FrameShift)) {
+                    mdi->samples_to_mix = size >> WM_FrameShift;
                 } else {
                     mdi->samples_to_mix = mdi->extra_info.approx_total_samples
                                            - mdi->extra_info.current_sample;
                 }
             }
         }
-        if (__builtin_expect((mdi->samples_to_mix > (size >> 2)), 1)) {
-            real_samples_to_mix = size >> 2;
-        } else {
-            real_samples_to_mix = mdi->samples_to_mix;
-            if (real_samples_to_mix == 0) {
-                continue;
-            }
+        real_samples_to_mix = WM_OutputToEvent(mdi, (size >> WM_FrameShift));
+        if (real_samples_to_mix == 0) {
+            continue;
         }
 
         /* do mixing here */
@@ -893,6 +1082,8 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
         do {
             note_data = mdi->note;
             left_mix = right_mix = 0;
+            rvb_left = rvb_right = 0;
+            cho_left = cho_right = 0;
             RESAMPLE_DEBUGI("SAMPLES_TO_MIX",count);
             if (__builtin_expect((note_data != NULL), 1)) {
                 RESAMPLE_DEBUGS("Processing Notes");
@@ -905,8 +1096,27 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
                     data_pos = note_data->sample_pos >> FPBITS;
                     premix = ((note_data->sample->data[data_pos] + (((note_data->sample->data[data_pos + 1] - note_data->sample->data[data_pos]) * (int32_t)(note_data->sample_pos & FPMASK)) / 1024)) * (note_data->env_level >> 12)) / 1024;
 
-                    left_mix += (premix * (int32_t)note_data->left_mix_volume) / 1024;
-                    right_mix += (premix * (int32_t)note_data->right_mix_volume) / 1024;
+                    if (note_data->lpf_b0) {
+                        premix = WM_LowPass(note_data, premix);
+                    }
+                    premix_left = (premix * (int32_t)note_data->left_mix_volume) / 1024;
+                    left_mix += premix_left;
+                    if (rvb_buffer) {
+                        rvb_left += (premix_left * (int32_t)note_data->reverb_send) / 1024;
+                    }
+                    if (note_data->chorus_send) {
+                        cho_left += (premix_left * (int32_t)note_data->chorus_send) / 1024;
+                    }
+                    if (!mono) {
+                        premix_right = (premix * (int32_t)note_data->right_mix_volume) / 1024;
+                        right_mix += premix_right;
+                        if (rvb_buffer) {
+                            rvb_right += (premix_right * (int32_t)note_data->reverb_send) / 1024;
+                        }
+                        if (note_data->chorus_send) {
+                            cho_right += (premix_right * (int32_t)note_data->chorus_send) / 1024;
+                        }
+                    }
 
                     /*
                      * ========================
@@ -930,16 +1140,33 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
                     fprintf(stderr,"\r\n");
 #endif
 
-                    note_data->sample_pos += note_data->sample_inc;
+                    if (__builtin_expect((note_data->loop_reverse), 0)
+                        && (note_data->modes & SAMPLE_LOOP)) {
+                        if (note_data->sample_inc > (note_data->sample_pos
+                                                     - note_data->sample->loop_start)) {
+                            WM_PingPongLoop(note_data, note_data->sample_inc
+                                            - (note_data->sample_pos
+                                               - note_data->sample->loop_start));
+                        } else {
+                            note_data->sample_pos -= note_data->sample_inc;
+                        }
+                    } else {
+                        note_data->sample_pos += note_data->sample_inc;
+                    }
 
                     if (__builtin_expect((note_data->modes & SAMPLE_LOOP), 1)) {
                         if (__builtin_expect(
                                              (note_data->sample_pos > note_data->sample->loop_end),
                                              0)) {
-                            note_data->sample_pos = note_data->sample->loop_start
-                                + ((note_data->sample_pos
-                                    - note_data->sample->loop_start)
-                                % note_data->sample->loop_size);
+                            if (note_data->modes & SAMPLE_PINGPONG) {
+                                WM_PingPongLoop(note_data, note_data->sample_pos
+                                                - note_data->sample->loop_end);
+                            } else {
+                                note_data->sample_pos = note_data->sample->loop_start
+                                    + ((note_data->sample_pos
+                                        - note_data->sample->loop_start)
+                                    % note_data->sample->loop_size);
+                            }
                         }
 
                     } else if (__builtin_expect(
@@ -1090,51 +1317,95 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
                     continue;
                 }
             }
+            /* in mono the left has the whole note, see _WM_AdjustNoteVolumes */
             *tmp_buffer++ = left_mix;
-            *tmp_buffer++ = right_mix;
+            if (rvb_buffer) {
+                *rvb_buffer++ = rvb_left;
+            }
+            if (cho_buffer) {
+                *cho_buffer++ = cho_left;
+            }
+            if (!mono) {
+                *tmp_buffer++ = right_mix;
+                if (rvb_buffer) {
+                    *rvb_buffer++ = rvb_right;
+                }
+                if (cho_buffer) {
+                    *cho_buffer++ = cho_right;
+                }
+            }
         } while (--count);
 
-        buffer_used += real_samples_to_mix * 4;
-        size -= (real_samples_to_mix << 2);
-        mdi->extra_info.current_sample += real_samples_to_mix;
-        mdi->samples_to_mix -= real_samples_to_mix;
+        buffer_used += real_samples_to_mix << WM_FrameShift;
+        size -= (real_samples_to_mix << WM_FrameShift);
+        WM_AdvanceSong(mdi, real_samples_to_mix);
     } while (size);
 
     tmp_buffer = out_buffer;
 
+    if (mdi->chorus) {
+        if (mono) {
+            _WM_do_chorus_mono(mdi->chorus, tmp_buffer, mdi->chorus_buffer, (buffer_used / 2));
+        } else {
+            _WM_do_chorus(mdi->chorus, tmp_buffer, mdi->chorus_buffer, (buffer_used / 2));
+        }
+    }
     if (mdi->extra_info.mixer_options & WM_MO_REVERB) {
-        _WM_do_reverb(mdi->reverb, tmp_buffer, (buffer_used / 2));
+        WM_ReverbSend(mdi, tmp_buffer, (buffer_used / 2));
     }
 
     //_WM_DynamicVolumeAdjust(mdi, tmp_buffer, (buffer_used/2));
 
-    for (i = 0; i < buffer_used; i += 4) {
-        left_mix = *tmp_buffer++;
-        right_mix = *tmp_buffer++;
-
-        /*
-         * ===================
-         * Write to the buffer
-         * ===================
-         */
+    /*
+     * ===================
+     * Write to the buffer
+     * ===================
+     */
+    if (mono) {
+        for (i = 0; i < buffer_used; i += 2) {
+            left_mix = *tmp_buffer++;
+#ifdef WORDS_BIGENDIAN
+            (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
+            (*buffer++) = left_mix & 0xff;
+#else
+            (*buffer++) = left_mix & 0xff;
+            (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
+#endif
+        }
+    } else {
+        for (i = 0; i < buffer_used; i += 4) {
+            left_mix = *tmp_buffer++;
+            right_mix = *tmp_buffer++;
 #ifdef WORDS_BIGENDIAN
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
+            (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
+            (*buffer++) = left_mix & 0xff;
+            (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
+            (*buffer++) = right_mix & 0xff;
 #else
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
+            (*buffer++) = left_mix & 0xff;
+            (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
+            (*buffer++) = right_mix & 0xff;
+            (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
 #endif
+        }
     }
 
     _WM_Unlock(&mdi->lock);
     return (buffer_used);
 }
 
-static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
+/*
+ * The mixers take mono as a constant, so each copy of them is built
+ * without testing it for every note of every sample.
+ */
+static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
+    if (WM_FrameShift == 1) {
+        return (WM_Mix_Linear(handle, buffer, size, 1));
+    }
+    return (WM_Mix_Linear(handle, buffer, size, 0));
+}
+
+WM_ALWAYS_INLINE int WM_Mix_Gauss(midi * handle, int8_t *buffer, uint32_t size, const int mono) {
     uint32_t buffer_used = 0;
     uint32_t i, env_ptr;
     struct _mdi *mdi = (struct _mdi *) handle;
@@ -1148,22 +1419,33 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
     double *gptr, *gend;
     int left, right, temp_n;
     int ii, jj;
-    struct _event *event = mdi->current_event;
+    struct _event *event;
     int32_t *tmp_buffer;
     int32_t *out_buffer;
+    int32_t *rvb_buffer = NULL;
+    int32_t *cho_buffer = NULL;
+    int32_t premix_left, premix_right;
+    int32_t rvb_left, rvb_right;
+    int32_t cho_left, cho_right;
+    /* two channels' worth even in mono, the reverb runs in stereo */
+    uint32_t mix_size = (size >> WM_FrameShift) * 2;
 
     _WM_Lock(&mdi->lock);
+    /* the parse thread moves the events about under the lock */
+    event = mdi->current_event;
 
     buffer_used = 0;
     memset(buffer, 0, size);
 
-    if ( (size / 2) > mdi->mix_buffer_size) {
-        if ( (size / 2) <= ( mdi->mix_buffer_size * 2 )) {
+    if (mix_size > mdi->mix_buffer_size) {
+        if (mix_size <= ( mdi->mix_buffer_size * 2 )) {
             mdi->mix_buffer_size += MEM_CHUNK;
         } else {
-            mdi->mix_buffer_size = size / 2;
+            mdi->mix_buffer_size = mix_size;
         }
         mdi->mix_buffer = (int32_t *) realloc(mdi->mix_buffer, mdi->mix_buffer_size * sizeof(int32_t));
+        mdi->reverb_buffer = (int32_t *) realloc(mdi->reverb_buffer, mdi->mix_buffer_size * sizeof(int32_t));
+        mdi->chorus_buffer = (int32_t *) realloc(mdi->chorus_buffer, mdi->mix_buffer_size * sizeof(int32_t));
     }
 
     tmp_buffer = mdi->mix_buffer;
@@ -1171,18 +1453,33 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
     memset(tmp_buffer, 0, ((size / 2) * sizeof(int32_t)));
     out_buffer = tmp_buffer;
 
+    if (mdi->extra_info.mixer_options & WM_MO_REVERB) {
+        rvb_buffer = mdi->reverb_buffer;
+        memset(rvb_buffer, 0, ((size / 2) * sizeof(int32_t)));
+    }
+    if (mdi->chorus) {
+        cho_buffer = mdi->chorus_buffer;
+        memset(cho_buffer, 0, ((size / 2) * sizeof(int32_t)));
+    }
+
     do {
         if (__builtin_expect((!mdi->samples_to_mix), 0)) {
-            while ((!mdi->samples_to_mix) && (event->do_event)) {
-                event->do_event(mdi, &event->event_data);
-                if ((mdi->extra_info.mixer_options & WM_MO_LOOP) && (event[0].evtype == ev_meta_endoftrack)) {
-                    _WM_ResetToStart(mdi);
+            while ((!mdi->samples_to_mix) && (event->evtype != ev_null)) {
+                if (__builtin_expect((mdi->extra_info.current_sample >= mdi->checkpoint_next), 0)) {
+                    _WM_SaveCheckpoint(mdi, event, 1);
+                }
+                _WM_do_event[event->evtype](mdi, event);
+                if ((mdi->extra_info.mixer_options & WM_MO_LOOP) && (event[0].evtype == ev_meta_endoftrack)
+                    && (_WM_ResetToStart(mdi) == 0)) {
                     event = mdi->current_event;
                 } else {
                     mdi->samples_to_mix = event->samples_to_next;
                     event++;
                     mdi->current_event = event;
                 }
+                if (__builtin_expect((mdi->tempo_scale_pos >= 0x10000), 0)) {
+                    WM_CatchUpSong(mdi);
+                }
             }
 
             if (!mdi->samples_to_mix) {
@@ -1190,21 +1487,17 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
                     >= mdi->extra_info.approx_total_samples) {
                     break;
                 } else if ((mdi->extra_info.approx_total_samples
-                            - mdi->extra_info.current_sample) > (size >> 2)) {
-                    mdi->samples_to_mix = size >> 2;
+                            - mdi->extra_info.current_sample) > (size >> WM_FrameShift)) {
+                    mdi->samples_to_mix = size >> WM_FrameShift;
                 } else {
                     mdi->samples_to_mix = mdi->extra_info.approx_total_samples
                     - mdi->extra_info.current_sample;
                 }
             }
         }
-        if (__builtin_expect((mdi->samples_to_mix > (size >> 2)), 1)) {
-            real_samples_to_mix = size >> 2;
-        } else {
-            real_samples_to_mix = mdi->samples_to_mix;
-            if (real_samples_to_mix == 0) {
-                continue;
-            }
+        real_samples_to_mix = WM_OutputToEvent(mdi, (size >> WM_FrameShift));
+        if (real_samples_to_mix == 0) {
+            continue;
         }
 
         /* do mixing here */
@@ -1212,6 +1505,8 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
         do {
             note_data = mdi->note;
             left_mix = right_mix = 0;
+            rvb_left = rvb_right = 0;
+            cho_left = cho_right = 0;
             if (__builtin_expect((note_data != NULL), 1)) {
                 while (note_data) {
                     /*
@@ -1261,24 +1556,60 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
 
                     premix = (int32_t)((y * (note_data->env_level >> 12)) / 1024);
 
-                    left_mix += (premix * (int32_t)note_data->left_mix_volume) / 1024;
-                    right_mix += (premix * (int32_t)note_data->right_mix_volume) / 1024;
+                    if (note_data->lpf_b0) {
+                        premix = WM_LowPass(note_data, premix);
+                    }
+                    premix_left = (premix * (int32_t)note_data->left_mix_volume) / 1024;
+                    left_mix += premix_left;
+                    if (rvb_buffer) {
+                        rvb_left += (premix_left * (int32_t)note_data->reverb_send) / 1024;
+                    }
+                    if (note_data->chorus_send) {
+                        cho_left += (premix_left * (int32_t)note_data->chorus_send) / 1024;
+                    }
+                    if (!mono) {
+                        premix_right = (premix * (int32_t)note_data->right_mix_volume) / 1024;
+                        right_mix += premix_right;
+                        if (rvb_buffer) {
+                            rvb_right += (premix_right * (int32_t)note_data->reverb_send) / 1024;
+                        }
+                        if (note_data->chorus_send) {
+                            cho_right += (premix_right * (int32_t)note_data->chorus_send) / 1024;
+                        }
+                    }
 
                     /*
                      * ========================
                      * sample position checking
                      * ========================
                      */
-                    note_data->sample_pos += note_data->sample_inc;
+                    if (__builtin_expect((note_data->loop_reverse), 0)
+                        && (note_data->modes & SAMPLE_LOOP)) {
+                        if (note_data->sample_inc > (note_data->sample_pos
+                                                     - note_data->sample->loop_start)) {
+                            WM_PingPongLoop(note_data, note_data->sample_inc
+                                            - (note_data->sample_pos
+                                               - note_data->sample->loop_start));
+                        } else {
+                            note_data->sample_pos -= note_data->sample_inc;
+                        }
+                    } else {
+                        note_data->sample_pos += note_data->sample_inc;
+                    }
                     if (__builtin_expect(
                                          (note_data->sample_pos > note_data->sample->loop_end),
                                          0)) {
                         if (note_data->modes & SAMPLE_LOOP) {
-                            note_data->sample_pos =
-                            note_data->sample->loop_start
-                            + ((note_data->sample_pos
-                                - note_data->sample->loop_start)
-                               % note_data->sample->loop_size);
+                            if (note_data->modes & SAMPLE_PINGPONG) {
+                                WM_PingPongLoop(note_data, note_data->sample_pos
+                                                - note_data->sample->loop_end);
+                            } else {
+                                note_data->sample_pos =
+                                note_data->sample->loop_start
+                                + ((note_data->sample_pos
+                                    - note_data->sample->loop_start)
+                                   % note_data->sample->loop_size);
+                            }
                         } else if (__builtin_expect(
                                                     (note_data->sample_pos
                                                      >= note_data->sample->data_length),
@@ -1427,49 +1758,89 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
                     continue;
                 }
             }
+            /* in mono the left has the whole note, see _WM_AdjustNoteVolumes */
             *tmp_buffer++ = left_mix;
-            *tmp_buffer++ = right_mix;
+            if (rvb_buffer) {
+                *rvb_buffer++ = rvb_left;
+            }
+            if (cho_buffer) {
+                *cho_buffer++ = cho_left;
+            }
+            if (!mono) {
+                *tmp_buffer++ = right_mix;
+                if (rvb_buffer) {
+                    *rvb_buffer++ = rvb_right;
+                }
+                if (cho_buffer) {
+                    *cho_buffer++ = cho_right;
+                }
+            }
         } while (--count);
 
-        buffer_used += real_samples_to_mix * 4;
-        size -= (real_samples_to_mix << 2);
-        mdi->extra_info.current_sample += real_samples_to_mix;
-        mdi->samples_to_mix -= real_samples_to_mix;
+        buffer_used += real_samples_to_mix << WM_FrameShift;
+        size -= (real_samples_to_mix << WM_FrameShift);
+        WM_AdvanceSong(mdi, real_samples_to_mix);
     } while (size);
 
     tmp_buffer = out_buffer;
 
+    if (mdi->chorus) {
+        if (mono) {
+            _WM_do_chorus_mono(mdi->chorus, tmp_buffer, mdi->chorus_buffer, (buffer_used / 2));
+        } else {
+            _WM_do_chorus(mdi->chorus, tmp_buffer, mdi->chorus_buffer, (buffer_used / 2));
+        }
+    }
     if (mdi->extra_info.mixer_options & WM_MO_REVERB) {
-        _WM_do_reverb(mdi->reverb, tmp_buffer, (buffer_used / 2));
+        WM_ReverbSend(mdi, tmp_buffer, (buffer_used / 2));
     }
 
     // _WM_DynamicVolumeAdjust(mdi, tmp_buffer, (buffer_used/2));
 
-    for (i = 0; i < buffer_used; i += 4) {
-        left_mix = *tmp_buffer++;
-        right_mix = *tmp_buffer++;
-
-        /*
-         * ===================
-         * Write to the buffer
-         * ===================
-         */
+    /*
+     * ===================
+     * Write to the buffer
+     * ===================
+     */
+    if (mono) {
+        for (i = 0; i < buffer_used; i += 2) {
+            left_mix = *tmp_buffer++;
+#ifdef WORDS_BIGENDIAN
+            (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
+            (*buffer++) = left_mix & 0xff;
+#else
+            (*buffer++) = left_mix & 0xff;
+            (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
+#endif
+        }
+    } else {
+        for (i = 0; i < buffer_used; i += 4) {
+            left_mix = *tmp_buffer++;
+            right_mix = *tmp_buffer++;
 #ifdef WORDS_BIGENDIAN
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
+            (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
+            (*buffer++) = left_mix & 0xff;
+            (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
+            (*buffer++) = right_mix & 0xff;
 #else
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
+            (*buffer++) = left_mix & 0xff;
+            (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
+            (*buffer++) = right_mix & 0xff;
+            (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
 #endif
+        }
     }
     _WM_Unlock(&mdi->lock);
     return (buffer_used);
 }
 
+static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
+    if (WM_FrameShift == 1) {
+        return (WM_Mix_Gauss(handle, buffer, size, 1));
+    }
+    return (WM_Mix_Gauss(handle, buffer, size, 0));
+}
+
 /*
  * =========================
  * External Functions
@@ -1478,18 +1849,20 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
 
 WM_SYMBOL int WildMidi_ConvertToMidi (const char *file, uint8_t **out, uint32_t *size) {
     uint8_t *buf;
+    uint32_t bufsize;
+    int mapped;
     int ret;
 
     if (!file) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL filename)", 0);
         return (-1);
     }
-    if ((buf = (uint8_t *) _WM_BufferFile(file, size)) == NULL) {
+    if ((buf = (uint8_t *) _WM_BufferFileRO(file, &bufsize, &mapped)) == NULL) {
         return (-1);
     }
 
-    ret = WildMidi_ConvertBufferToMidi(buf, *size, out, size);
-    _WM_FreeBufferFile(buf);
+    ret = WildMidi_ConvertBufferToMidi(buf, bufsize, out, size);
+    _WM_FreeBufferFileRO(buf, bufsize, mapped);
     return ret;
 }
 
@@ -1537,7 +1910,7 @@ WM_SYMBOL long WildMidi_GetVersion (void) {
     return (LIBWILDMIDI_VERSION);
 }
 
-static int _WM_Init(const struct _WM_VIO *callbacks,
+static int _WM_Init(const struct _WM_VIO *callbacks, const struct _WM_VIO_Stream *stream,
                     const char *config_file, uint16_t rate, uint16_t mixer_options) {
     if (WM_Initialized) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_ALR_INIT, NULL, 0);
@@ -1552,16 +1925,19 @@ static int _WM_Init(const struct _WM_VIO *callbacks,
 
     _WM_BufferFile = callbacks->allocate_file;
     _WM_FreeBufferFile = callbacks->free_file;
+    _WM_SetStreamVIO(stream);
 
     WM_InitPatches();
     if (WM_LoadConfig(config_file) == -1) {
+        _WM_SetStreamVIO(NULL);
         return (-1);
     }
 
-    if (mixer_options & 0x0FF0) {
+    if (mixer_options & 0x01F0) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(invalid option)",
                 0);
         WM_FreePatches();
+        _WM_SetStreamVIO(NULL);
         return (-1);
     }
     _WM_MixerOptions = mixer_options;
@@ -1570,9 +1946,19 @@ static int _WM_Init(const struct _WM_VIO *callbacks,
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG,
                 "(rate out of bounds, range is 11025 - 65535)", 0);
         WM_FreePatches();
+        _WM_SetStreamVIO(NULL);
+        return (-1);
+    }
+    WM_RateShift = (mixer_options & WM_MO_HALF_RATE) ? 1 : 0;
+    if ((rate >> WM_RateShift) < 11025) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG,
+                "(rate out of bounds, half rate needs 22050 - 65535)", 0);
+        WM_FreePatches();
+        _WM_SetStreamVIO(NULL);
         return (-1);
     }
-    _WM_SampleRate = rate;
+    _WM_SampleRate = rate >> WM_RateShift;
+    WM_FrameShift = (mixer_options & WM_MO_MONO) ? 1 : 2;
 
     gauss_lock = 0;
     _WM_patch_lock = 0;
@@ -1584,7 +1970,7 @@ static int _WM_Init(const struct _WM_VIO *callbacks,
 
 WM_SYMBOL int WildMidi_Init(const char *config_file, uint16_t rate, uint16_t mixer_options) {
     struct _WM_VIO callbacks_ = { _WM_BufferFileImpl, _WM_FreeBufferFileImpl };
-    return _WM_Init(&callbacks_, config_file, rate, mixer_options);
+    return _WM_Init(&callbacks_, NULL, config_file, rate, mixer_options);
 }
 
 WM_SYMBOL int WildMidi_InitVIO(struct _WM_VIO *callbacks, const char *config_file, uint16_t rate, uint16_t mixer_options) {
@@ -1593,7 +1979,19 @@ WM_SYMBOL int WildMidi_InitVIO(struct _WM_VIO *callbacks, const char *config_fil
         return (-1);
     }
 
-    return _WM_Init(callbacks, config_file, rate, mixer_options);
+    return _WM_Init(callbacks, NULL, config_file, rate, mixer_options);
+}
+
+WM_SYMBOL int WildMidi_InitStreamVIO(struct _WM_VIO_Stream *callbacks, const char *config_file, uint16_t rate, uint16_t mixer_options) {
+    struct _WM_VIO callbacks_ = { _WM_BufferFileStream, _WM_FreeBufferFileImpl };
+
+    if (!callbacks || !callbacks->open_file || !callbacks->read_file
+            || !callbacks->size_file || !callbacks->close_file) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL VIO callbacks)", 0);
+        return (-1);
+    }
+
+    return _WM_Init(&callbacks_, callbacks, config_file, rate, mixer_options);
 }
 
 WM_SYMBOL int WildMidi_MasterVolume(uint8_t master_volume) {
@@ -1629,6 +2027,12 @@ WM_SYMBOL int WildMidi_Close(midi * handle) {
         return (-1);
     }
     _WM_Lock(&mdi->lock);
+    if ((mdi->async_state != WM_ASYNC_LOADING) && (mdi->parse_thread != NULL)) {
+        /* the parse thread takes the lock, so it has to stop first */
+        _WM_Unlock(&mdi->lock);
+        _WM_StopMidiParse(mdi);
+        _WM_Lock(&mdi->lock);
+    }
     if (first_handle->handle == handle) {
         tmp_handle = first_handle->next;
         free(first_handle);
@@ -1652,46 +2056,78 @@ WM_SYMBOL int WildMidi_Close(midi * handle) {
         }
     }
 
+    if (mdi->async_state == WM_ASYNC_LOADING) {
+        /* the loader frees it once it notices */
+        mdi->async_state = WM_ASYNC_CANCELLED;
+        _WM_Unlock(&mdi->lock);
+        return (0);
+    }
+
     _WM_freeMDI(mdi);
 
     return (0);
 }
 
-WM_SYMBOL midi *WildMidi_Open(const char *midifile) {
-    uint8_t *mididata = NULL;
-    uint32_t midisize = 0;
+static struct _mdi *WM_ParseBuffer(uint8_t *midibuffer, uint32_t size, struct _mdi *owner) {
     uint8_t mus_hdr[] = { 'M', 'U', 'S', 0x1A };
     uint8_t xmi_hdr[] = { 'F', 'O', 'R', 'M' };
-    midi * ret = NULL;
 
-    if (!WM_Initialized) {
-        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
-        return (NULL);
+    if (memcmp(midibuffer,"HMIMIDIP", 8) == 0) {
+        return (_WM_ParseNewHmp(midibuffer, size, owner));
+    } else if (memcmp(midibuffer, "HMI-MIDISONG061595", 18) == 0) {
+        return (_WM_ParseNewHmi(midibuffer, size, owner));
+    } else if (memcmp(midibuffer, mus_hdr, 4) == 0) {
+        return (_WM_ParseNewMus(midibuffer, size, owner));
+    } else if (memcmp(midibuffer, xmi_hdr, 4) == 0) {
+        return (_WM_ParseNewXmi(midibuffer, size, owner));
     }
-    if (midifile == NULL) {
-        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL filename)", 0);
+    return (_WM_ParseNewMidi(midibuffer, size, owner));
+}
+
+/*
+ * owner is the handle WildMidi_OpenAsync() gave out, or NULL. The load
+ * gives up between stages once WildMidi_Close() has cancelled it.
+ */
+static struct _mdi *WM_ParseFile(const char *midifile, struct _mdi *owner) {
+    uint8_t *mididata = NULL;
+    uint32_t midisize = 0;
+    int mapped;
+    struct _mdi *ret;
+
+    if (_WM_AsyncCancelled(owner)) {
         return (NULL);
     }
-
-    if ((mididata = (uint8_t *) _WM_BufferFile(midifile, &midisize)) == NULL) {
+    if ((mididata = (uint8_t *) _WM_BufferFileRO(midifile, &midisize, &mapped)) == NULL) {
         return (NULL);
     }
     if (midisize < 18) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, "(too short)", 0);
+        _WM_FreeBufferFileRO(mididata, midisize, mapped);
         return (NULL);
     }
-    if (memcmp(mididata,"HMIMIDIP", 8) == 0) {
-        ret = (void *) _WM_ParseNewHmp(mididata, midisize);
-    } else if (memcmp(mididata, "HMI-MIDISONG061595", 18) == 0) {
-        ret = (void *) _WM_ParseNewHmi(mididata, midisize);
-    } else if (memcmp(mididata, mus_hdr, 4) == 0) {
-        ret = (void *) _WM_ParseNewMus(mididata, midisize);
-    } else if (memcmp(mididata, xmi_hdr, 4) == 0) {
-        ret = (void *) _WM_ParseNewXmi(mididata, midisize);
-    } else {
-        ret = (void *) _WM_ParseNewMidi(mididata, midisize);
+    if (_WM_AsyncCancelled(owner)) {
+        _WM_FreeBufferFileRO(mididata, midisize, mapped);
+        return (NULL);
+    }
+    ret = WM_ParseBuffer(mididata, midisize, owner);
+    _WM_FreeBufferFileRO(mididata, midisize, mapped);
+
+    return (ret);
+}
+
+WM_SYMBOL midi *WildMidi_Open(const char *midifile) {
+    midi * ret = NULL;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
+        return (NULL);
+    }
+    if (midifile == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL filename)", 0);
+        return (NULL);
     }
-    _WM_FreeBufferFile(mididata);
+
+    ret = (void *) WM_ParseFile(midifile, NULL);
 
     if (ret) {
         if (add_handle(ret) != 0) {
@@ -1704,8 +2140,6 @@ WM_SYMBOL midi *WildMidi_Open(const char *midifile) {
 }
 
 WM_SYMBOL midi *WildMidi_OpenBuffer(uint8_t *midibuffer, uint32_t size) {
-    uint8_t mus_hdr[] = { 'M', 'U', 'S', 0x1A };
-    uint8_t xmi_hdr[] = { 'F', 'O', 'R', 'M' };
     midi * ret = NULL;
 
     if (!WM_Initialized) {
@@ -1725,17 +2159,7 @@ WM_SYMBOL midi *WildMidi_OpenBuffer(uint8_t *midibuffer, uint32_t size) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_CORUPT, "(too short)", 0);
         return (NULL);
     }
-    if (memcmp(midibuffer,"HMIMIDIP", 8) == 0) {
-        ret = (void *) _WM_ParseNewHmp(midibuffer, size);
-    } else if (memcmp(midibuffer, "HMI-MIDISONG061595", 18) == 0) {
-        ret = (void *) _WM_ParseNewHmi(midibuffer, size);
-    } else if (memcmp(midibuffer, mus_hdr, 4) == 0) {
-        ret = (void *) _WM_ParseNewMus(midibuffer, size);
-    } else if (memcmp(midibuffer, xmi_hdr, 4) == 0) {
-        ret = (void *) _WM_ParseNewXmi(midibuffer, size);
-    } else {
-        ret = (void *) _WM_ParseNewMidi(midibuffer, size);
-    }
+    ret = (void *) WM_ParseBuffer(midibuffer, size, NULL);
 
     if (ret) {
         if (add_handle(ret) != 0) {
@@ -1747,63 +2171,315 @@ WM_SYMBOL midi *WildMidi_OpenBuffer(uint8_t *midibuffer, uint32_t size) {
     return (ret);
 }
 
-WM_SYMBOL int WildMidi_FastSeek(midi * handle, unsigned long int *sample_pos) {
+WM_SYMBOL midi *WildMidi_OpenLive(void) {
     struct _mdi *mdi;
-    struct _event *event;
-    struct _note *note_data;
+    int i;
 
     if (!WM_Initialized) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
-        return (-1);
+        return (NULL);
     }
-    if (handle == NULL) {
-        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL handle)", 0);
-        return (-1);
+
+    mdi = _WM_initMDI(NULL);
+    if ((mdi->live = _WM_NewLive()) == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
+        _WM_freeMDI(mdi);
+        return (NULL);
     }
-    if (sample_pos == NULL) {
-        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL seek position pointer)", 0);
-        return (-1);
+    if ((mdi->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width,
+            _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy,
+            _WM_reverb_type))
+          == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, 0);
+        _WM_freeMDI(mdi);
+        return (NULL);
     }
 
-    mdi = (struct _mdi *) handle;
-    _WM_Lock(&mdi->lock);
-    event = mdi->current_event;
-
-    /* make sure we havent asked for a positions beyond the end of the song. */
-    if (*sample_pos > mdi->extra_info.approx_total_samples) {
-        /* if so set the position to the end of the song */
-        *sample_pos = mdi->extra_info.approx_total_samples;
+    /* there is nothing to seek through, so no checkpoints either */
+    mdi->checkpoint_next = 0xffffffff;
+    _WM_do_sysex_gm_reset(mdi, NULL);
+    memcpy(mdi->live->channel, mdi->channel, sizeof(mdi->channel));
+    for (i = 0; i < 16; i++) {
+        mdi->live->bank[i] = mdi->channel[i].bank;
+        mdi->live->isdrum[i] = mdi->channel[i].isdrum;
     }
+    mdi->events[0].evtype = ev_null;
+    mdi->events[0].samples_to_next = 0;
 
-    /* was end of song requested and are we are there? */
-    if (*sample_pos == mdi->extra_info.approx_total_samples) {
-        /* yes */
-        _WM_Unlock(&mdi->lock);
-        return (0);
+    if (add_handle(mdi) != 0) {
+        WildMidi_Close(mdi);
+        return (NULL);
     }
+    return ((midi *) mdi);
+}
 
-    /* did we want to fast forward? */
-    if (mdi->extra_info.current_sample > *sample_pos) {
-        /* no - reset some stuff */
-        event = mdi->events;
-        _WM_ResetToStart((struct _mdi *) handle);
-        mdi->extra_info.current_sample = 0;
-        mdi->samples_to_mix = 0;
+/*
+ * Loads the patch a live event will need, so that setting it up on the
+ * render thread never has to go to the disk. Live events are channel
+ * messages only, so bank selects and program changes are all that move
+ * the banks, and the drum channels stay as a GM reset left them.
+ */
+static void WM_LivePatch(struct _mdi *mdi, uint32_t message) {
+    struct _live *live = mdi->live;
+    uint8_t ch = message & 0x0f;
+    uint8_t data_1 = (message >> 8) & 0x7f;
+    uint8_t data_2 = (message >> 16) & 0x7f;
+
+    switch (message & 0xf0) {
+    case 0x90:
+        if (live->isdrum[ch]) {
+            _WM_load_live_patch(mdi, ((live->bank[ch] << 8) | (data_1 | 0x80)), &live->patch_lock);
+        }
+        break;
+    case 0xb0:
+        if (data_1 == 0) {
+            live->bank[ch] = data_2;
+        }
+        break;
+    case 0xc0:
+        if (live->isdrum[ch]) {
+            live->bank[ch] = data_1;
+        } else {
+            _WM_load_live_patch(mdi, ((live->bank[ch] << 8) | data_1), &live->patch_lock);
+        }
+        break;
+    }
+}
+
+/*
+ * Doesn't take the handle lock, so an input thread can call it while
+ * another thread is inside WildMidi_GetOutput().
+ */
+WM_SYMBOL int WildMidi_Live(midi * handle, uint32_t midi_event, unsigned long int sample_pos) {
+    struct _mdi *mdi;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    mdi = (struct _mdi *) handle;
+    if (mdi->live == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(not a live handle)", 0);
+        return (-1);
+    }
+    if (((midi_event & 0x80) == 0) || ((midi_event & 0xf0) == 0xf0)) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(not a channel message)", 0);
+        return (-1);
+    }
+    WM_LivePatch(mdi, midi_event);
+    if (_WM_LivePush(mdi->live, (uint32_t) (sample_pos >> WM_RateShift), midi_event) != 0) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, "(live event queue full)", 0);
+        return (-1);
+    }
+    return (0);
+}
+
+/*
+ * Runs on the loader thread. The song is parsed straight into the
+ * handle the caller already holds, which nothing else looks into
+ * while it is loading.
+ */
+static void WM_AsyncLoad(void *arg) {
+    struct _async_job *job = (struct _async_job *) arg;
+    struct _mdi *mdi = job->mdi;
+    struct _mdi *ret = WM_ParseFile(job->filename, mdi);
+    int cancelled;
+
+    _WM_Lock(&mdi->lock);
+    cancelled = (mdi->async_state == WM_ASYNC_CANCELLED);
+    if (cancelled) {
+        /* WildMidi_Close() has already let go of the handle */
+        _WM_freeMDI(mdi);
+    } else if (ret) {
+        mdi->async_state = 0;
+        _WM_Unlock(&mdi->lock);
+    } else {
+        mdi->async_state = WM_ASYNC_FAILED;
+        _WM_Unlock(&mdi->lock);
+    }
+
+    if (!cancelled && job->callback) {
+        job->callback(mdi, (ret) ? 0 : -1, job->user);
+    }
+
+    _WM_Lock(&async_lock);
+    job->done = 1;
+    _WM_Unlock(&async_lock);
+}
+
+/* call with async_lock held */
+static void WM_ReapAsyncJobs(int wait) {
+    struct _async_job **job_ptr = &async_jobs;
+    struct _async_job *job;
+
+    while ((job = *job_ptr) != NULL) {
+        if (!wait && !job->done) {
+            job_ptr = &job->next;
+            continue;
+        }
+        *job_ptr = job->next;
+        if (!job->done) {
+            /* let the worker take async_lock to finish up */
+            _WM_Unlock(&async_lock);
+            _WM_JoinThread(job->thread);
+            _WM_Lock(&async_lock);
+        } else {
+            _WM_JoinThread(job->thread);
+        }
+        free(job->filename);
+        free(job);
+    }
+}
+
+WM_SYMBOL midi *WildMidi_OpenAsync(const char *midifile, _WM_Async_Callback callback, void *user) {
+    struct _mdi *mdi;
+    struct _async_job *job;
+    struct _WM_Thread *thread;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
+        return (NULL);
+    }
+    if (midifile == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL filename)", 0);
+        return (NULL);
+    }
+
+    /* an empty handle to give out until the loader has filled it in */
+    mdi = (struct _mdi *) calloc(1, sizeof(struct _mdi));
+    job = (struct _async_job *) calloc(1, sizeof(struct _async_job));
+    if (mdi == NULL || job == NULL
+            || (job->filename = wm_strdup(midifile)) == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, NULL, errno);
+        free(mdi);
+        free(job);
+        return (NULL);
+    }
+    mdi->async_state = WM_ASYNC_LOADING;
+    job->mdi = mdi;
+    job->callback = callback;
+    job->user = user;
+
+    if (add_handle(mdi) != 0) {
+        free(job->filename);
+        free(job);
+        free(mdi);
+        return (NULL);
+    }
+
+    _WM_Lock(&async_lock);
+    WM_ReapAsyncJobs(0);
+    job->next = async_jobs;
+    async_jobs = job;
+    thread = job->thread = _WM_CreateThread(WM_AsyncLoad, job);
+    _WM_Unlock(&async_lock);
+
+    if (thread == NULL) {
+        /* no threads available, load it right here */
+        WM_AsyncLoad(job);
+    }
+
+    return (mdi);
+}
+
+/* call with the handle locked */
+static int WM_AsyncNotReady(struct _mdi *mdi) {
+    if (__builtin_expect((mdi->async_state == 0), 1)) {
+        return (0);
+    }
+    if (mdi->async_state == WM_ASYNC_LOADING) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(midi file still loading)", 0);
+    } else {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(midi file failed to load)", 0);
+    }
+    return (-1);
+}
+
+WM_SYMBOL int WildMidi_FastSeek(midi * handle, unsigned long int *sample_pos) {
+    struct _mdi *mdi;
+    struct _event *event;
+    struct _note *note_data;
+    struct _checkpoint *checkpoint;
+    unsigned long int seek_pos;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (sample_pos == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL seek position pointer)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    if (mdi->live != NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(live handle)", 0);
+        return (-1);
+    }
+    /* the song is in _WM_SampleRate samples, the caller in output ones */
+    seek_pos = *sample_pos >> WM_RateShift;
+
+    _WM_Lock(&mdi->lock);
+    if (WM_AsyncNotReady(mdi)) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+    _WM_ParseMidiAhead(mdi, seek_pos);
+    event = mdi->current_event;
+
+    /* make sure we havent asked for a positions beyond the end of the song. */
+    if (seek_pos > mdi->extra_info.approx_total_samples) {
+        /* if so set the position to the end of the song */
+        seek_pos = mdi->extra_info.approx_total_samples;
+    }
+
+    /* was end of song requested and are we are there? */
+    if (seek_pos == mdi->extra_info.approx_total_samples) {
+        /* yes */
+        *sample_pos = seek_pos << WM_RateShift;
+        _WM_Unlock(&mdi->lock);
+        return (0);
+    }
+
+    /* did we want to fast forward? */
+    checkpoint = _WM_FindCheckpoint(mdi, seek_pos, 0xffffffff);
+    if (mdi->extra_info.current_sample > seek_pos) {
+        /* no - go back to the closest checkpoint or the start */
+        event = _WM_RestoreCheckpoint(mdi, checkpoint, mdi->events);
+    } else if ((checkpoint != NULL) && (checkpoint->event > (uint32_t) (event - mdi->events))) {
+        /* yes - and a checkpoint saves replaying part of the way */
+        event = _WM_RestoreCheckpoint(mdi, checkpoint, event);
+    }
+    if (event == NULL) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
     }
 
-    if ((mdi->extra_info.current_sample + mdi->samples_to_mix) > *sample_pos) {
-        mdi->samples_to_mix = (mdi->extra_info.current_sample + mdi->samples_to_mix) - *sample_pos;
-        mdi->extra_info.current_sample = *sample_pos;
+    mdi->tempo_scale_pos = 0;
+    if ((mdi->extra_info.current_sample + mdi->samples_to_mix) > seek_pos) {
+        mdi->samples_to_mix = (mdi->extra_info.current_sample + mdi->samples_to_mix) - seek_pos;
+        mdi->extra_info.current_sample = seek_pos;
     } else {
         mdi->extra_info.current_sample += mdi->samples_to_mix;
         mdi->samples_to_mix = 0;
-        while ((!mdi->samples_to_mix) && (event->do_event)) {
-            event->do_event(mdi, &event->event_data);
+        while ((!mdi->samples_to_mix) && (event->evtype != ev_null)) {
+            if (mdi->extra_info.current_sample >= mdi->checkpoint_next) {
+                _WM_SaveCheckpoint(mdi, event, 0);
+            }
+            _WM_do_event[event->evtype](mdi, event);
             mdi->samples_to_mix = event->samples_to_next;
                 
-            if ((mdi->extra_info.current_sample + mdi->samples_to_mix) > *sample_pos) {
-                mdi->samples_to_mix = (mdi->extra_info.current_sample + mdi->samples_to_mix) - *sample_pos;
-                mdi->extra_info.current_sample = *sample_pos;
+            if ((mdi->extra_info.current_sample + mdi->samples_to_mix) > seek_pos) {
+                mdi->samples_to_mix = (mdi->extra_info.current_sample + mdi->samples_to_mix) - seek_pos;
+                mdi->extra_info.current_sample = seek_pos;
             } else {
                 mdi->extra_info.current_sample += mdi->samples_to_mix;
                 mdi->samples_to_mix = 0;
@@ -1834,7 +2510,359 @@ WM_SYMBOL int WildMidi_FastSeek(midi * handle, unsigned long int *sample_pos) {
 
     /* clear the reverb buffers since we not gonna be using them here */
     _WM_reset_reverb(mdi->reverb);
+    _WM_seek_chorus(mdi->chorus, mdi->extra_info.current_sample, mdi->tempo_scale);
+    _WM_reset_upsample(mdi->upsample);
+
+    *sample_pos = seek_pos << WM_RateShift;
+    _WM_Unlock(&mdi->lock);
+    return (0);
+}
+
+/*
+ * Move sample_pos on by count steps of the mixers in one go.
+ * The caller makes sure a sample that doesn't loop isn't run off.
+ */
+static void WM_SkipSamplePos(struct _note *note_data, uint32_t count) {
+    struct _sample *sample = note_data->sample;
+    uint64_t pos = (uint64_t) note_data->sample_inc * count;
+    uint64_t size = sample->loop_size;
+
+    if (!(note_data->modes & SAMPLE_LOOP)) {
+        note_data->sample_pos += (uint32_t) pos;
+        return;
+    }
+
+    if (note_data->modes & SAMPLE_PINGPONG) {
+        /* unfold the loop to twice its size, going backwards in the second half */
+        if (note_data->sample_pos < sample->loop_start) {
+            pos += note_data->sample_pos;
+            if (pos <= sample->loop_end) {
+                note_data->sample_pos = (uint32_t) pos;
+                return;
+            }
+            pos -= sample->loop_start;
+        } else if (note_data->loop_reverse) {
+            pos += size + (sample->loop_end - note_data->sample_pos);
+        } else {
+            pos += note_data->sample_pos - sample->loop_start;
+        }
+        pos %= (size << 1);
+        if (pos > size) {
+            note_data->loop_reverse = 1;
+            note_data->sample_pos = sample->loop_end - (uint32_t) (pos - size);
+        } else {
+            note_data->loop_reverse = 0;
+            note_data->sample_pos = sample->loop_start + (uint32_t) pos;
+        }
+        return;
+    }
+
+    pos += note_data->sample_pos;
+    if (pos <= sample->loop_end) {
+        note_data->sample_pos = (uint32_t) pos;
+        return;
+    }
+    pos = (pos - sample->loop_start) % size;
+    if (pos == 0) {
+        /*
+         * loop_start and loop_end are the same point in the loop, the
+         * mixers only wrap once past loop_end so landing on it is
+         * possible with steps smaller than the loop. With steps the
+         * size of the loop the two take turns.
+         */
+        if (note_data->sample_inc < size) {
+            pos = size;
+        } else if (note_data->sample_inc == size) {
+            if (note_data->sample_pos < sample->loop_start) {
+                count -= (sample->loop_start - note_data->sample_pos) / note_data->sample_inc;
+            } else if (note_data->sample_pos == sample->loop_end) {
+                count++;
+            }
+            pos = (count & 1) ? size : 0;
+        }
+    }
+    note_data->sample_pos = sample->loop_start + (uint32_t) pos;
+}
+
+/*
+ * Play note_data for count samples the way the mixers would, without
+ * resampling anything. Runs between envelope stages and loop wraps are
+ * done in one step so the cost doesn't depend on count. Returns the
+ * note following it in mdi->note.
+ */
+static struct _note *WM_SkipNote(struct _mdi *mdi, struct _note *note_data, uint32_t count) {
+    uint32_t steps;
+    uint32_t end_steps;
+    uint32_t env_steps;
+    uint32_t end;
+    uint32_t env_ptr;
+    int32_t env_target;
+    uint8_t at_end;
+
+    while (count) {
+        steps = count;
+        at_end = 0;
+
+        /* steps until a sample that doesn't loop is played out */
+        if (!(note_data->modes & SAMPLE_LOOP)) {
+            end = note_data->sample->data_length;
+            if ((mdi->extra_info.mixer_options & WM_MO_ENHANCED_RESAMPLING)
+                && (end <= note_data->sample->loop_end)) {
+                /* the gauss mixer also wants to be past loop_end */
+                end = note_data->sample->loop_end + 1;
+            }
+            if (note_data->sample_pos >= end) {
+                end_steps = 1;
+            } else if (note_data->sample_inc) {
+                end_steps = ((end - note_data->sample_pos) - 1) / note_data->sample_inc + 1;
+            } else {
+                end_steps = 0;
+            }
+            if ((end_steps) && (end_steps <= steps)) {
+                steps = end_steps;
+                at_end = 1;
+            }
+        }
+
+        /* steps until the envelope reaches its target */
+        env_steps = 0;
+        if (note_data->env_inc) {
+            env_target = note_data->sample->env_target[note_data->env];
+            if (note_data->env_inc > 0) {
+                env_steps = (env_target > note_data->env_level) ?
+                    ((uint32_t) (env_target - note_data->env_level) - 1) / (uint32_t) note_data->env_inc + 1 : 1;
+            } else {
+                env_steps = (note_data->env_level > env_target) ?
+                    ((uint32_t) (note_data->env_level - env_target) - 1) / (uint32_t) -note_data->env_inc + 1 : 1;
+            }
+            if ((env_steps < steps) || ((env_steps == steps) && (!at_end))) {
+                steps = env_steps;
+                at_end = 0;
+            } else {
+                env_steps = 0;
+            }
+        }
+
+        count -= steps;
+        if (at_end) goto _END_THIS_NOTE;
+
+        WM_SkipSamplePos(note_data, steps);
+        if (!env_steps) {
+            note_data->env_level += note_data->env_inc * (int32_t) steps;
+            continue;
+        }
+
+        /* same as the mixers from here */
+        note_data->env_level = note_data->sample->env_target[note_data->env];
+        switch (note_data->env) {
+        case 0:
+            if (!(note_data->modes & SAMPLE_ENVELOPE)) {
+                note_data->env_inc = 0;
+                continue;
+            }
+            break;
+        case 2:
+            if (note_data->modes & SAMPLE_SUSTAIN) {
+                note_data->env_inc = 0;
+                continue;
+            }
+            env_ptr = (note_data->modes & SAMPLE_CLAMPED)? 5 : 4;
+            note_data->env = env_ptr;
+            if (note_data->env_level > note_data->sample->env_target[env_ptr]) {
+                note_data->env_inc = -note_data->sample->env_rate[env_ptr];
+            } else {
+                note_data->env_inc = note_data->sample->env_rate[env_ptr];
+            }
+            /* the mixers step the note again within the same sample */
+            count++;
+            continue;
+        case 5:
+            if (note_data->env_level == 0) {
+                goto _END_THIS_NOTE;
+            }
+            /* sample release */
+            if (note_data->modes & SAMPLE_LOOP)
+                note_data->modes ^= SAMPLE_LOOP;
+            note_data->env_inc = 0;
+            continue;
+        case 6:
+        _END_THIS_NOTE:
+            {
+                struct _note *prev_note = NULL;
+                struct _note *nte_array = mdi->note;
+
+                note_data->active = 0;
+                while (nte_array != note_data) {
+                    prev_note = nte_array;
+                    nte_array = nte_array->next;
+                }
+                if (note_data->replay == NULL) {
+                    if (prev_note) {
+                        prev_note->next = note_data->next;
+                    } else {
+                        mdi->note = note_data->next;
+                    }
+                    return (note_data->next);
+                }
+                if (prev_note) {
+                    prev_note->next = note_data->replay;
+                } else {
+                    mdi->note = note_data->replay;
+                }
+                note_data->replay->next = note_data->next;
+                note_data = note_data->replay;
+                note_data->active = 1;
+                /* which starts in the same sample */
+                count++;
+            }
+            continue;
+        }
+        note_data->env++;
+
+        if (note_data->is_off == 1) {
+            _WM_do_note_off_extra(note_data);
+        } else if (note_data->env_level >= note_data->sample->env_target[note_data->env]) {
+            note_data->env_inc = -note_data->sample->env_rate[note_data->env];
+        } else {
+            note_data->env_inc = note_data->sample->env_rate[note_data->env];
+        }
+    }
+    return (note_data->next);
+}
+
+/*
+ * Nothing is resampled, so a note's low pass history is lost while
+ * skipping. It is cleared instead, as when the filter is first engaged,
+ * which only shapes the first few samples mixed after the seek.
+ */
+static void WM_SkipNotes(struct _mdi *mdi, uint32_t count) {
+    struct _note *note_data = mdi->note;
+
+    if (!count) return;
+    while (note_data) {
+        note_data = WM_SkipNote(mdi, note_data, count);
+    }
+    for (note_data = mdi->note; note_data != NULL; note_data = note_data->next) {
+        note_data->lpf_x[0] = note_data->lpf_x[1] = 0;
+        note_data->lpf_y[0] = note_data->lpf_y[1] = 0;
+        if (note_data->replay != NULL) {
+            note_data->replay->lpf_x[0] = note_data->replay->lpf_x[1] = 0;
+            note_data->replay->lpf_y[0] = note_data->replay->lpf_y[1] = 0;
+        }
+    }
+}
+
+WM_SYMBOL int WildMidi_SlowSeek(midi * handle, unsigned long int *sample_pos) {
+    struct _mdi *mdi;
+    struct _event *event;
+    struct _checkpoint *checkpoint;
+    unsigned long int seek_pos;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (sample_pos == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL seek position pointer)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    if (mdi->live != NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(live handle)", 0);
+        return (-1);
+    }
+    /* the song is in _WM_SampleRate samples, the caller in output ones */
+    seek_pos = *sample_pos >> WM_RateShift;
+
+    _WM_Lock(&mdi->lock);
+    if (WM_AsyncNotReady(mdi)) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+    _WM_ParseMidiAhead(mdi, seek_pos);
+    event = mdi->current_event;
+
+    /* make sure we havent asked for a positions beyond the end of the song. */
+    if (seek_pos > mdi->extra_info.approx_total_samples) {
+        /* if so set the position to the end of the song */
+        seek_pos = mdi->extra_info.approx_total_samples;
+    }
+
+    /* was end of song requested and are we are there? */
+    if (seek_pos == mdi->extra_info.approx_total_samples) {
+        /* yes */
+        *sample_pos = seek_pos << WM_RateShift;
+        _WM_Unlock(&mdi->lock);
+        return (0);
+    }
+
+    /* only checkpoints taken while playing know which notes were on */
+    checkpoint = _WM_FindCheckpoint(mdi, seek_pos, 0xffffffff);
+    while ((checkpoint != NULL) && (checkpoint->note_count == 0xffffffff)) {
+        checkpoint = (checkpoint != mdi->checkpoints) ? (checkpoint - 1) : NULL;
+    }
+
+    if (mdi->extra_info.current_sample > seek_pos) {
+        event = _WM_RestoreCheckpoint(mdi, checkpoint, mdi->events);
+    } else if ((checkpoint != NULL) && (checkpoint->event > (uint32_t) (event - mdi->events))) {
+        event = _WM_RestoreCheckpoint(mdi, checkpoint, event);
+    }
+    if (event == NULL) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+
+    /*
+     * As WildMidi_FastSeek but the notes are kept going between events,
+     * leaving them where WildMidi_GetOutput would have.
+     */
+    mdi->tempo_scale_pos = 0;
+    if ((mdi->extra_info.current_sample + mdi->samples_to_mix) > seek_pos) {
+        WM_SkipNotes(mdi, seek_pos - mdi->extra_info.current_sample);
+        mdi->samples_to_mix = (mdi->extra_info.current_sample + mdi->samples_to_mix) - seek_pos;
+        mdi->extra_info.current_sample = seek_pos;
+    } else {
+        WM_SkipNotes(mdi, mdi->samples_to_mix);
+        mdi->extra_info.current_sample += mdi->samples_to_mix;
+        mdi->samples_to_mix = 0;
+        while ((!mdi->samples_to_mix) && (event->evtype != ev_null)) {
+            if (mdi->extra_info.current_sample >= mdi->checkpoint_next) {
+                _WM_SaveCheckpoint(mdi, event, 1);
+            }
+            _WM_do_event[event->evtype](mdi, event);
+            mdi->samples_to_mix = event->samples_to_next;
+
+            if ((mdi->extra_info.current_sample + mdi->samples_to_mix) > seek_pos) {
+                WM_SkipNotes(mdi, seek_pos - mdi->extra_info.current_sample);
+                mdi->samples_to_mix = (mdi->extra_info.current_sample + mdi->samples_to_mix) - seek_pos;
+                mdi->extra_info.current_sample = seek_pos;
+            } else {
+                WM_SkipNotes(mdi, mdi->samples_to_mix);
+                mdi->extra_info.current_sample += mdi->samples_to_mix;
+                mdi->samples_to_mix = 0;
+            }
+            event++;
+        }
+        mdi->current_event = event;
+
+        /* past the last event the notes just ring out */
+        if (mdi->extra_info.current_sample < seek_pos) {
+            WM_SkipNotes(mdi, seek_pos - mdi->extra_info.current_sample);
+            mdi->extra_info.current_sample = seek_pos;
+        }
+    }
+
+    /* the reverb can't be caught up without mixing, start it afresh */
+    _WM_reset_reverb(mdi->reverb);
+    _WM_seek_chorus(mdi->chorus, mdi->extra_info.current_sample, mdi->tempo_scale);
+    _WM_reset_upsample(mdi->upsample);
 
+    *sample_pos = seek_pos << WM_RateShift;
     _WM_Unlock(&mdi->lock);
     return (0);
 }
@@ -1854,7 +2882,15 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
         return (-1);
     }
     mdi = (struct _mdi *) handle;
+    if (mdi->live != NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(live handle)", 0);
+        return (-1);
+    }
     _WM_Lock(&mdi->lock);
+    if (WM_AsyncNotReady(mdi)) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
 
     if ((!mdi->is_type2) && (nextsong != 0)) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(Illegal use. Only usable with files detected to be type 2 compatible.", 0);
@@ -1889,8 +2925,8 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
             event--;
         }
         event_new = event;
-        event = mdi->events;
-        _WM_ResetToStart((struct _mdi *) handle);
+        event = _WM_RestoreCheckpoint(mdi, _WM_FindCheckpoint(mdi, 0xffffffff,
+                                      (uint32_t) (event_new - mdi->events)), mdi->events);
 
     } else if (nextsong == 1) {
         /* goto start of next song */
@@ -1908,6 +2944,7 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
         }
         event_new = event;
         event = mdi->current_event;
+        mdi->extra_info.current_sample += mdi->samples_to_mix;
 
     } else {
     START_THIS_SONG:
@@ -1920,16 +2957,24 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
             event--;
         }
         event_new = event;
-        event = mdi->events;
-        _WM_ResetToStart((struct _mdi *) handle);
+        event = _WM_RestoreCheckpoint(mdi, _WM_FindCheckpoint(mdi, 0xffffffff,
+                                      (uint32_t) (event_new - mdi->events)), mdi->events);
+    }
+
+    if (event == NULL) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
     }
 
     while (event != event_new) {
-        event->do_event(mdi, &event->event_data);
+        _WM_do_event[event->evtype](mdi, event);
         mdi->extra_info.current_sample += event->samples_to_next;
         event++;
     }
 
+    /* the end of track events replayed above don't get to set this */
+    mdi->samples_to_mix = 0;
+    mdi->tempo_scale_pos = 0;
     mdi->current_event = event;
 
     note_data = mdi->note;
@@ -1948,6 +2993,191 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
     return (0);
 }
 
+/*
+ * A live handle has no song to play. Each block gets an event list of
+ * its own, made from the queued events that fall in it, which the mixers
+ * then play like any other.
+ */
+static int WM_LiveEvents(struct _mdi *mdi, uint32_t samples) {
+    struct _live *live = mdi->live;
+    struct _live_event *live_event;
+    struct _channel channel[16];
+    uint32_t first = samples; /* silence before the first event */
+    uint32_t last = 0; /* where the last event taken falls */
+    int32_t offset;
+    uint8_t message[3];
+
+    mdi->event_count = 0;
+    if (_WM_LivePeek(live) != NULL) {
+        /* the patches are loaded by now, this only waits on adding one */
+        _WM_Lock(&live->patch_lock);
+        memcpy(channel, mdi->channel, sizeof(channel));
+        memcpy(mdi->channel, live->channel, sizeof(channel));
+        while ((live_event = _WM_LivePeek(live)) != NULL) {
+            offset = (int32_t) (live_event->sample - live->clock);
+            if (offset >= (int32_t) samples) break;
+            /* late events play straight away, but never ahead of earlier ones */
+            if (offset < (int32_t) last) offset = (int32_t) last;
+
+            if (mdi->event_count) {
+                mdi->events[mdi->event_count - 1].samples_to_next += (uint32_t) offset - last;
+            } else {
+                first = (uint32_t) offset;
+            }
+            last = (uint32_t) offset;
+
+            message[0] = live_event->message & 0xff;
+            message[1] = (live_event->message >> 8) & 0x7f;
+            message[2] = (live_event->message >> 16) & 0x7f;
+            _WM_LivePop(live);
+            _WM_SetupMidiEvent(mdi, message, 3, 0);
+        }
+        memcpy(live->channel, mdi->channel, sizeof(channel));
+        memcpy(mdi->channel, channel, sizeof(channel));
+        _WM_Unlock(&live->patch_lock);
+    }
+    if (mdi->event_count) {
+        mdi->events[mdi->event_count - 1].samples_to_next += samples - last;
+    } else {
+        first = samples;
+    }
+
+    if (_WM_ReserveEvents(mdi, mdi->event_count) == -1) {
+        return (-1);
+    }
+    mdi->events[mdi->event_count].evtype = ev_null;
+    mdi->events[mdi->event_count].channel = 0;
+    mdi->events[mdi->event_count].data.value = 0;
+    mdi->events[mdi->event_count].samples_to_next = 0;
+
+    mdi->current_event = mdi->events;
+    mdi->samples_to_mix = first;
+    mdi->extra_info.current_sample = 0;
+    mdi->extra_info.approx_total_samples = samples;
+    return (0);
+}
+
+static int WM_GetOutput_Live(midi * handle, int8_t *buffer, uint32_t size) {
+    struct _mdi *mdi = (struct _mdi *) handle;
+    int ret;
+
+    _WM_Lock(&mdi->lock);
+    if (WM_LiveEvents(mdi, (size >> WM_FrameShift)) == -1) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+    _WM_Unlock(&mdi->lock);
+
+    if (mdi->extra_info.mixer_options & WM_MO_ENHANCED_RESAMPLING) {
+        if (!gauss_table) init_gauss();
+        ret = WM_GetOutput_Gauss(handle, buffer, size);
+    } else {
+        ret = WM_GetOutput_Linear(handle, buffer, size);
+    }
+
+    _WM_Lock(&mdi->lock);
+    mdi->live->clock += size >> WM_FrameShift;
+    mdi->extra_info.current_sample = mdi->live->clock;
+    mdi->extra_info.approx_total_samples = mdi->live->clock;
+    _WM_Unlock(&mdi->lock);
+    return (ret);
+}
+
+static int WM_GetOutput_Mix(midi * handle, int8_t *buffer, uint32_t size) {
+    struct _mdi *mdi = (struct _mdi *) handle;
+
+    if (__builtin_expect((mdi->live != NULL), 0)) {
+        return (WM_GetOutput_Live(handle, buffer, size));
+    }
+
+    _WM_Lock(&mdi->lock);
+    if (__builtin_expect((mdi->parse != NULL), 0)) {
+        uint64_t ahead;
+        uint32_t sample;
+
+        /*
+         * The parse thread keeps the song parsed ahead of what we are
+         * about to play, we only wait for it when it falls behind.
+         */
+        ahead = mdi->extra_info.current_sample
+                + (((uint64_t) (size >> WM_FrameShift) * mdi->tempo_scale) >> 16);
+        sample = (ahead < 0xffffffff) ? (uint32_t) ahead : 0xffffffff;
+        while ((mdi->parse != NULL) && (mdi->extra_info.approx_total_samples <= sample)) {
+            _WM_WantMidiParse(mdi, sample);
+            _WM_Unlock(&mdi->lock);
+            _WM_WaitMidiParse(mdi);
+            _WM_Lock(&mdi->lock);
+        }
+        if ((mdi->parse != NULL)
+         && ((mdi->extra_info.approx_total_samples - sample) <= (_WM_SampleRate >> 1))) {
+            _WM_WantMidiParse(mdi, sample);
+        }
+    }
+    _WM_Unlock(&mdi->lock);
+
+    if (((struct _mdi *) handle)->extra_info.mixer_options & WM_MO_ENHANCED_RESAMPLING) {
+        if (!gauss_table) init_gauss();
+        return (WM_GetOutput_Gauss(handle, buffer, size));
+    }
+    return (WM_GetOutput_Linear(handle, buffer, size));
+}
+
+/*
+ WM_MO_HALF_RATE: mix half the frames at _WM_SampleRate then double them
+ into the callers buffer.
+ */
+static int WM_GetOutput_HalfRate(midi * handle, int8_t *buffer, uint32_t size) {
+    struct _mdi *mdi = (struct _mdi *) handle;
+    int8_t *half;
+    uint32_t spare;
+    uint32_t half_size;
+    int ret;
+
+    _WM_Lock(&mdi->lock);
+    if (mdi->upsample == NULL) {
+        if ((mdi->upsample = _WM_init_upsample((WM_FrameShift == 1) ? 1 : 2)) == NULL) {
+            _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, "to init upsampler", 0);
+            _WM_Unlock(&mdi->lock);
+            return (-1);
+        }
+    }
+    /* a frame left over from last time goes first */
+    spare = _WM_upsample_spare(mdi->upsample, buffer);
+    buffer += spare;
+    size -= spare;
+    if (size == 0) {
+        _WM_Unlock(&mdi->lock);
+        return (spare);
+    }
+
+    /* an odd number of frames mixes one more and keeps it back */
+    half_size = (((size >> WM_FrameShift) + 1) >> 1) << WM_FrameShift;
+    if ((half = _WM_upsample_buffer(mdi->upsample, half_size)) == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_MEM, "to upsample", 0);
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+    _WM_Unlock(&mdi->lock);
+
+    ret = WM_GetOutput_Mix(handle, half, half_size);
+    if (ret < 0) {
+        return (ret);
+    }
+
+    _WM_Lock(&mdi->lock);
+    if (((uint32_t) ret < half_size) && (mdi->current_event->evtype == ev_null)) {
+        /* the song is over, let out what the filter is holding back */
+        ret = (int) _WM_upsample_flush(mdi->upsample, (uint32_t) ret, half_size);
+    }
+    if (ret == 0) {
+        _WM_Unlock(&mdi->lock);
+        return (spare);
+    }
+    ret = (int) _WM_do_upsample(mdi->upsample, buffer, (uint32_t) ret, size);
+    _WM_Unlock(&mdi->lock);
+    return (ret + spare);
+}
+
 WM_SYMBOL int WildMidi_GetOutput(midi * handle, int8_t *buffer, uint32_t size) {
     if (__builtin_expect((!WM_Initialized), 0)) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
@@ -1964,16 +3194,34 @@ WM_SYMBOL int WildMidi_GetOutput(midi * handle, int8_t *buffer, uint32_t size) {
     if (__builtin_expect((size == 0), 0)) {
         return (0);
     }
-    if (__builtin_expect((!!(size % 4)), 0)) {
-        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(size not a multiple of 4)", 0);
+    if (__builtin_expect((!!(size & ((1 << WM_FrameShift) - 1))), 0)) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG,
+                ((WM_FrameShift == 1) ? "(size not a multiple of 2)" : "(size not a multiple of 4)"), 0);
         return (-1);
     }
 
-    if (((struct _mdi *) handle)->extra_info.mixer_options & WM_MO_ENHANCED_RESAMPLING) {
-        if (!gauss_table) init_gauss();
-        return (WM_GetOutput_Gauss(handle, buffer, size));
+    if (__builtin_expect((((struct _mdi *) handle)->async_state != 0), 0)) {
+        struct _mdi *mdi = (struct _mdi *) handle;
+        int loading;
+
+        _WM_Lock(&mdi->lock);
+        loading = (mdi->async_state == WM_ASYNC_LOADING);
+        if (!loading && WM_AsyncNotReady(mdi)) {
+            _WM_Unlock(&mdi->lock);
+            return (-1);
+        }
+        _WM_Unlock(&mdi->lock);
+        if (loading) {
+            /* play silence until WildMidi_OpenAsync() is done */
+            memset(buffer, 0, size);
+            return (size);
+        }
     }
-    return (WM_GetOutput_Linear(handle, buffer, size));
+
+    if (WM_RateShift) {
+        return (WM_GetOutput_HalfRate(handle, buffer, size));
+    }
+    return (WM_GetOutput_Mix(handle, buffer, size));
 }
 
 WM_SYMBOL int WildMidi_GetMidiOutput(midi * handle, int8_t **buffer, uint32_t *size) {
@@ -1989,10 +3237,63 @@ WM_SYMBOL int WildMidi_GetMidiOutput(midi * handle, int8_t **buffer, uint32_t *s
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL buffer pointer)", 0);
         return (-1);
     }
+    if (__builtin_expect((((struct _mdi *) handle)->async_state != 0), 0)) {
+        struct _mdi *mdi = (struct _mdi *) handle;
+        int notready;
+
+        _WM_Lock(&mdi->lock);
+        notready = WM_AsyncNotReady(mdi);
+        _WM_Unlock(&mdi->lock);
+        if (notready) return (-1);
+    }
+    if (((struct _mdi *) handle)->parse != NULL) {
+        struct _mdi *mdi = (struct _mdi *) handle;
+
+        /* the whole song is needed */
+        _WM_Lock(&mdi->lock);
+        _WM_ParseMidiAhead(mdi, 0xffffffff);
+        _WM_Unlock(&mdi->lock);
+    }
     return _WM_Event2Midi((struct _mdi *)handle, (uint8_t **)buffer, size);
 }
 
 
+WM_SYMBOL int WildMidi_SetTempoScale(midi * handle, float factor) {
+    struct _mdi *mdi;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    /* written so a NaN fails too */
+    if (!((factor >= 0.0625f) && (factor <= 16.0f))) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(tempo scale out of range)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    if (mdi->live != NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(live handle)", 0);
+        return (-1);
+    }
+    _WM_Lock(&mdi->lock);
+    if (WM_AsyncNotReady(mdi)) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+    /*
+     * Only the rate the mixer walks through the song changes. Positions,
+     * checkpoints and seeks all stay in song samples.
+     */
+    mdi->tempo_scale = (uint32_t) ((factor * (float) TEMPO_SCALE_ONE) + 0.5f);
+    _WM_Unlock(&mdi->lock);
+    return (0);
+}
+
 WM_SYMBOL int WildMidi_SetOption(midi * handle, uint16_t options, uint16_t setting) {
     struct _mdi *mdi;
 
@@ -2007,6 +3308,10 @@ WM_SYMBOL int WildMidi_SetOption(midi * handle, uint16_t options, uint16_t setti
 
     mdi = (struct _mdi *) handle;
     _WM_Lock(&mdi->lock);
+    if (WM_AsyncNotReady(mdi)) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
     if ((!(options & 0x800F)) || (options & 0x7FF0)) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(invalid option)", 0);
         _WM_Unlock(&mdi->lock);
@@ -2062,6 +3367,10 @@ WildMidi_GetInfo(midi * handle) {
         return (NULL);
     }
     _WM_Lock(&mdi->lock);
+    if (WM_AsyncNotReady(mdi)) {
+        _WM_Unlock(&mdi->lock);
+        return (NULL);
+    }
     if (mdi->tmp_info == NULL) {
         mdi->tmp_info = (struct _WM_Info *) malloc(sizeof(struct _WM_Info));
         if (mdi->tmp_info == NULL) {
@@ -2072,9 +3381,17 @@ WildMidi_GetInfo(midi * handle) {
         mdi->tmp_info->copyright = NULL;
     }
     mdi->tmp_info->current_sample = mdi->extra_info.current_sample;
-    mdi->tmp_info->approx_total_samples = mdi->extra_info.approx_total_samples;
+    if (mdi->parse != NULL) {
+        /* not known until an incremental parse is done */
+        mdi->tmp_info->approx_total_samples = 0;
+    } else {
+        mdi->tmp_info->approx_total_samples = mdi->extra_info.approx_total_samples;
+    }
     mdi->tmp_info->mixer_options = mdi->extra_info.mixer_options;
     mdi->tmp_info->total_midi_time = (mdi->tmp_info->approx_total_samples * 1000) / _WM_SampleRate;
+    /* WM_MO_HALF_RATE, in output samples */
+    mdi->tmp_info->current_sample <<= WM_RateShift;
+    mdi->tmp_info->approx_total_samples <<= WM_RateShift;
     if (mdi->extra_info.copyright) {
         free(mdi->tmp_info->copyright);
         mdi->tmp_info->copyright = (char *) malloc(strlen(mdi->extra_info.copyright) + 1);
@@ -2094,6 +3411,81 @@ WildMidi_GetInfo(midi * handle) {
     return ((struct _WM_Info *)mdi->tmp_info);
 }
 
+WM_SYMBOL int WildMidi_TickToSample(midi * handle, unsigned long int tick, unsigned long int *sample_pos) {
+    struct _mdi *mdi;
+    uint32_t sample;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (sample_pos == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL sample position pointer)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    if (WM_AsyncNotReady(mdi)) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+    if (tick > 0xffffffff) tick = 0xffffffff;
+
+    /* the tempo map is only known as far as the song is parsed */
+    while ((mdi->parse != NULL) && (mdi->tempo_tick < tick)) {
+        _WM_ParseMidiAhead(mdi, mdi->extra_info.approx_total_samples);
+    }
+
+    sample = _WM_TickToSample(mdi, (uint32_t) tick);
+    *sample_pos = (sample > mdi->samples_stripped) ? (sample - mdi->samples_stripped) : 0;
+    *sample_pos <<= WM_RateShift;
+
+    _WM_Unlock(&mdi->lock);
+    return (0);
+}
+
+WM_SYMBOL int WildMidi_SampleToTick(midi * handle, unsigned long int sample_pos, unsigned long int *tick) {
+    struct _mdi *mdi;
+    uint32_t sample;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (tick == NULL) {
+        _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_INVALID_ARG, "(NULL tick pointer)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    sample_pos >>= WM_RateShift;
+    _WM_Lock(&mdi->lock);
+    if (WM_AsyncNotReady(mdi)) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+    if (sample_pos > (0xffffffff - mdi->samples_stripped)) {
+        sample = 0xffffffff;
+    } else {
+        sample = (uint32_t) sample_pos + mdi->samples_stripped;
+    }
+
+    _WM_ParseMidiAhead(mdi, sample);
+    *tick = _WM_SampleToTick(mdi, sample);
+
+    _WM_Unlock(&mdi->lock);
+    return (0);
+}
+
 WM_SYMBOL int WildMidi_Shutdown(void) {
     if (!WM_Initialized) {
         _WM_GLOBAL_ERROR(__FUNCTION__, __LINE__, WM_ERR_NOT_INIT, NULL, 0);
@@ -2103,8 +3495,14 @@ WM_SYMBOL int WildMidi_Shutdown(void) {
         /* closes open handle and rotates the handles list. */
         WildMidi_Close((struct _mdi *) first_handle->handle);
     }
+    /* wait for any loaders still holding on to patches */
+    _WM_Lock(&async_lock);
+    WM_ReapAsyncJobs(1);
+    _WM_Unlock(&async_lock);
     WM_FreePatches();
     free_gauss();
+    _WM_free_reverb_pool();
+    _WM_FreeThreadPool();
 
     /* reset the globals */
     _cvt_reset_options ();
@@ -2117,13 +3515,20 @@ WM_SYMBOL int WildMidi_Shutdown(void) {
     _WM_reverb_room_length = 22.5f;
     _WM_reverb_listen_posx = 8.4375f;
     _WM_reverb_listen_posy = 16.875f;
+    _WM_reverb_type = RVB_ROOM;
+    WM_RateShift = 0;
+    WM_FrameShift = 2;
 
     WM_Initialized = 0;
 
-    if (_WM_Global_ErrorS != NULL) free(_WM_Global_ErrorS);
+    if (_WM_Global_ErrorS != NULL) {
+        free(_WM_Global_ErrorS);
+        _WM_Global_ErrorS = NULL;
+    }
 
     _WM_BufferFile = _WM_BufferFileImpl;
     _WM_FreeBufferFile = _WM_FreeBufferFileImpl;
+    _WM_SetStreamVIO(NULL);
 
     return (0);
 }
@@ -2158,8 +3563,24 @@ WM_SYMBOL char * WildMidi_GetLyric (midi * handle) {
         return (NULL);
     }
     _WM_Lock(&mdi->lock);
-    lyric = mdi->lyric;
-    mdi->lyric = NULL;
+    if (WM_AsyncNotReady(mdi)) {
+        _WM_Unlock(&mdi->lock);
+        return (NULL);
+    }
+    if (mdi->lyric != 0xffffffff) {
+        lyric = &mdi->strings[mdi->lyric];
+        if (mdi->parse != NULL) {
+            /* the parse thread can move the strings at any time */
+            size_t length = strlen(lyric) + 1;
+            char *lyric_copy = (char *) realloc(mdi->lyric_copy, length);
+            if (lyric_copy != NULL) {
+                memcpy(lyric_copy, lyric, length);
+                mdi->lyric_copy = lyric_copy;
+            }
+            lyric = lyric_copy;
+        }
+        mdi->lyric = 0xffffffff;
+    }
     _WM_Unlock(&mdi->lock);
     return (lyric);
 }
@@ -28,6 +28,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include "wm_error.h"
+#include "lock.h"
 
 void _WM_DEBUG_MSG(const char * wmfmt, ...) {
     va_list args;
@@ -67,6 +68,20 @@ static const char *errors[WM_ERR_MAX+1] = {
 char * _WM_Global_ErrorS = NULL;
 int _WM_Global_ErrorI = 0;
 
+/* errors can be raised from WildMidi_OpenAsync() worker threads */
+static int error_lock = 0;
+
+static void WM_SetError(char *errorstring, int wmerno) {
+    char *old;
+
+    _WM_Lock(&error_lock);
+    old = _WM_Global_ErrorS;
+    _WM_Global_ErrorS = errorstring;
+    _WM_Global_ErrorI = wmerno;
+    _WM_Unlock(&error_lock);
+    free(old);
+}
+
 void _WM_GLOBAL_ERROR(const char *func, int lne, int wmerno, const char *wmfor, int error) {
 
     char *errorstring;
@@ -74,10 +89,6 @@ void _WM_GLOBAL_ERROR(const char *func, int lne, int wmerno, const char *wmfor,
     if (wmerno < 0 || wmerno >= WM_ERR_MAX)
          wmerno = WM_ERR_MAX; /* set to invalid error code. */
 
-    _WM_Global_ErrorI = wmerno;
-
-    if (_WM_Global_ErrorS != NULL) free(_WM_Global_ErrorS);
-
     errorstring = (char *) malloc(MAX_ERROR_LEN+1);
 
     if (error == 0) {
@@ -99,7 +110,7 @@ void _WM_GLOBAL_ERROR(const char *func, int lne, int wmerno, const char *wmfor,
     }
 
     errorstring[MAX_ERROR_LEN] = 0;
-    _WM_Global_ErrorS = errorstring;
+    WM_SetError(errorstring, wmerno);
 }
 
 void _WM_ERROR_NEW(const char * wmfmt, ...) {
@@ -110,6 +121,5 @@ void _WM_ERROR_NEW(const char * wmfmt, ...) {
     vsprintf(errorstring, wmfmt, args);
     va_end(args);
     errorstring[MAX_ERROR_LEN] = 0;
-    _WM_Global_ErrorS = errorstring;
-    _WM_Global_ErrorI = WM_ERR_MAX;/* well, it's a custom error message */
+    WM_SetError(errorstring, WM_ERR_MAX);/* well, it's a custom error message */
 }
@@ -1,8 +1,493 @@
-/* tiny, minimal C source for testing, e.g. running under valgrind. */
+/*
+ * test.c -- regression checks for libWildMidi
+ *
+ * Copyright (C) WildMIDI Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Without arguments the checks below are run on a patch, config and
+ * midi file written to the current directory, which is what ctest does.
+ * Given a midi file it is just opened with ./wildmidi.cfg, which is
+ * handy for running under valgrind.
+ */
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <wildmidi_lib.h>
-midi *song;
+
+#define TEST_CFG  "wm_test.cfg"
+#define TEST_PAT  "wm_test.pat"
+#define TEST_MID  "wm_test.mid"
+#define TEST_RATE 44100
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static void put16(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v & 0xffff);
+    put16(p + 2, v >> 16);
+}
+
+/* a looped 16 bit triangle wave with a sustained envelope */
+static int write_patch(const char *name) {
+    static const uint8_t env_rate[6] = { 0x3f, 0x3f, 0x3f, 0x20, 0x10, 0x10 };
+    static const uint8_t env_level[6] = { 250, 240, 230, 100, 20, 0 };
+    uint8_t head[239 + 96];
+    uint8_t data[2000 * 2];
+    uint8_t *smp = &head[239];
+    FILE *f;
+    int i, v;
+
+    for (i = 0; i < 2000; i++) {
+        v = i % 50;
+        v = (v < 25) ? (v * 2400) - 30000 : 90000 - (v * 2400);
+        put16(&data[i * 2], (uint32_t) v & 0xffff);
+    }
+
+    memset(head, 0, sizeof(head));
+    memcpy(head, "GF1PATCH110\0ID#000002", 22);
+    head[82] = 1;                            /* instruments */
+    head[83] = 1;                            /* voices */
+    put16(&head[85], 1);                     /* waveforms */
+    put16(&head[87], 127);                   /* master volume */
+    put32(&head[89], sizeof(data));
+    put32(&head[147], sizeof(data));
+    head[151] = 1;                           /* layers */
+    put32(&head[194], sizeof(data));
+    head[198] = 1;                           /* samples */
+
+    put32(&smp[8], sizeof(data));
+    put32(&smp[12], 500 * 2);                /* loop start */
+    put32(&smp[16], 1500 * 2);               /* loop end */
+    put16(&smp[20], 22050);
+    put32(&smp[26], 20000000);               /* high frequency */
+    put32(&smp[30], 261626);                 /* root frequency */
+    smp[36] = 7;                             /* balance */
+    memcpy(&smp[37], env_rate, 6);
+    memcpy(&smp[43], env_level, 6);
+    smp[55] = 0x01 | 0x04 | 0x20 | 0x40;     /* 16 bit, loop, sustain, envelope */
+    put16(&smp[56], 60);
+    put16(&smp[58], 1024);
+
+    if ((f = fopen(name, "wb")) == NULL) return (-1);
+    if ((fwrite(head, sizeof(head), 1, f) != 1) || (fwrite(data, sizeof(data), 1, f) != 1)) {
+        fclose(f);
+        return (-1);
+    }
+    return (fclose(f) ? -1 : 0);
+}
+
+static int write_config(const char *name) {
+    FILE *f;
+
+    if ((f = fopen(name, "w")) == NULL) return (-1);
+    fprintf(f, "bank 0\n0 %s\n", TEST_PAT);
+    return (fclose(f) ? -1 : 0);
+}
+
+/* growing buffer for building a midi file */
+struct _buf {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t alloc;
+};
+
+static void buf_add(struct _buf *b, const uint8_t *data, uint32_t size) {
+    if (b->size + size > b->alloc) {
+        b->alloc = (b->size + size) * 2;
+        b->data = (uint8_t *) realloc(b->data, b->alloc);
+        if (b->data == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(&b->data[b->size], data, size);
+    b->size += size;
+}
+
+static void buf_byte(struct _buf *b, uint8_t c) {
+    buf_add(b, &c, 1);
+}
+
+static void buf_delta(struct _buf *b, uint32_t delta) {
+    uint8_t v[5];
+    int i = 4;
+
+    v[i] = delta & 0x7f;
+    while (delta >>= 7) {
+        v[--i] = (delta & 0x7f) | 0x80;
+    }
+    buf_add(b, &v[i], 5 - i);
+}
+
+static void buf_track(struct _buf *b, struct _buf *trk) {
+    uint8_t head[8] = { 'M', 'T', 'r', 'k' };
+
+    buf_delta(trk, 0);
+    buf_add(trk, (const uint8_t *) "\xff\x2f\x00", 3);
+    head[4] = (trk->size >> 24) & 0xff;
+    head[5] = (trk->size >> 16) & 0xff;
+    head[6] = (trk->size >> 8) & 0xff;
+    head[7] = trk->size & 0xff;
+    buf_add(b, head, 8);
+    buf_add(b, trk->data, trk->size);
+    trk->size = 0;
+}
+
+/*
+ * A type 1 file of about 20 seconds: a tempo track that keeps changing
+ * the tempo and three tracks of overlapping notes, with some pitch bends
+ * and panning. Made the same every time by a fixed random sequence.
+ */
+static uint8_t *make_midi(uint32_t *size) {
+    static const uint8_t head[14] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 4, 0, 96 };
+    struct _buf b = { NULL, 0, 0 };
+    struct _buf trk = { NULL, 0, 0 };
+    uint32_t seed = 12345;
+    uint32_t tempo;
+    int i, t, note;
+
+#define TEST_RAND(n) ((seed = (seed * 1103515245) + 12345), ((seed >> 16) % (n)))
+
+    buf_add(&b, head, 14);
+
+    for (i = 0; i < 24; i++) {
+        tempo = 300000 + TEST_RAND(600000);
+        buf_delta(&trk, (i == 0) ? 0 : 96 + TEST_RAND(300));
+        buf_add(&trk, (const uint8_t *) "\xff\x51\x03", 3);
+        buf_byte(&trk, (tempo >> 16) & 0xff);
+        buf_byte(&trk, (tempo >> 8) & 0xff);
+        buf_byte(&trk, tempo & 0xff);
+    }
+    buf_track(&b, &trk);
+
+    for (t = 0; t < 3; t++) {
+        buf_delta(&trk, 0);
+        buf_byte(&trk, 0xc0 | t);
+        buf_byte(&trk, 0);
+        buf_delta(&trk, 0);
+        buf_byte(&trk, 0xb0 | t);
+        buf_byte(&trk, 10);
+        buf_byte(&trk, TEST_RAND(128));
+        for (i = 0; i < 80; i++) {
+            note = 40 + TEST_RAND(40);
+            buf_delta(&trk, TEST_RAND(60));
+            buf_byte(&trk, 0x90 | t);
+            buf_byte(&trk, note);
+            buf_byte(&trk, 40 + TEST_RAND(88));
+            if (TEST_RAND(10) == 0) {
+                buf_delta(&trk, TEST_RAND(10));
+                buf_byte(&trk, 0xe0 | t);
+                buf_byte(&trk, TEST_RAND(128));
+                buf_byte(&trk, TEST_RAND(128));
+            }
+            buf_delta(&trk, 1 + TEST_RAND(120));
+            buf_byte(&trk, 0x80 | t);
+            buf_byte(&trk, note);
+            buf_byte(&trk, 64);
+        }
+        buf_track(&b, &trk);
+    }
+
+#undef TEST_RAND
+
+    free(trk.data);
+    *size = b.size;
+    return (b.data);
+}
+
+static int write_midi(const char *name, const uint8_t *data, uint32_t size) {
+    FILE *f;
+
+    if ((f = fopen(name, "wb")) == NULL) return (-1);
+    if (fwrite(data, size, 1, f) != 1) {
+        fclose(f);
+        return (-1);
+    }
+    return (fclose(f) ? -1 : 0);
+}
+
+/*
+ * Renders up to max bytes of song into out in pieces of size bytes,
+ * returning the bytes rendered or -1 on error.
+ */
+static long render(midi *song, int8_t *out, long max, uint32_t size) {
+    long done = 0;
+    int ret;
+
+    while (done < max) {
+        if ((long) size > max - done) size = (uint32_t) (max - done);
+        ret = WildMidi_GetOutput(song, &out[done], size);
+        if (ret < 0) return (-1);
+        if (ret == 0) break;
+        done += ret;
+    }
+    return (done);
+}
+
+#define SONG_MAX (TEST_RATE * 4 * 40)
+
+static int8_t *out_ref;
+static int8_t *out_test;
+static uint8_t *midi_data;
+static uint32_t midi_size;
+static long ref_size;
+
+/* WildMidi_OpenAsync(), closed straight away and played through */
+static void check_async(void) {
+    struct _WM_Info *info;
+    midi *song;
+    int i;
+
+    song = WildMidi_OpenBuffer(midi_data, midi_size);
+    CHECK(song != NULL);
+    if (song == NULL) return;
+    ref_size = render(song, out_ref, SONG_MAX, 16384);
+    CHECK(ref_size > 0);
+    for (i = 0; (i < ref_size) && (out_ref[i] == 0); i++);
+    CHECK(i < ref_size);
+    WildMidi_Close(song);
+
+    /* closing cancels the load, whatever stage it is at */
+    for (i = 0; i < 16; i++) {
+        song = WildMidi_OpenAsync(TEST_MID, NULL, NULL);
+        CHECK(song != NULL);
+        if (song) CHECK(WildMidi_Close(song) == 0);
+    }
+
+    song = WildMidi_OpenAsync(TEST_MID, NULL, NULL);
+    CHECK(song != NULL);
+    if (song == NULL) return;
+    while ((info = WildMidi_GetInfo(song)) == NULL) {
+        /* still loading */
+    }
+    CHECK(info->approx_total_samples == (unsigned long) (ref_size / 4));
+    CHECK(render(song, out_test, SONG_MAX, 16384) == ref_size);
+    CHECK(memcmp(out_ref, out_test, ref_size) == 0);
+    WildMidi_Close(song);
+
+    /* left for WildMidi_Shutdown() to wait on */
+    for (i = 0; i < 4; i++) {
+        CHECK(WildMidi_OpenAsync(TEST_MID, NULL, NULL) != NULL);
+    }
+}
+
+/*
+ * WildMidi_SlowSeek() then playing on has to give what playing through
+ * does, whether it starts from the top or from a checkpoint.
+ */
+static void check_slow_seek(midi *song, unsigned long pos) {
+    unsigned long seek_pos = pos;
+    long size;
+
+    CHECK(WildMidi_SlowSeek(song, &seek_pos) == 0);
+    CHECK(seek_pos == pos);
+    size = ref_size - (long) (pos * 4);
+    CHECK(render(song, out_test, SONG_MAX, 4096) == size);
+    CHECK(memcmp(&out_ref[pos * 4], out_test, size) == 0);
+}
+
+static void check_slowseek(void) {
+    unsigned long seek_pos;
+    midi *song;
+
+    song = WildMidi_OpenBuffer(midi_data, midi_size);
+    CHECK(song != NULL);
+    if (song == NULL) return;
+    check_slow_seek(song, TEST_RATE * 13 + 321);
+    /* played through, so the checkpoints have their notes */
+    check_slow_seek(song, TEST_RATE * 3 + 17);
+    check_slow_seek(song, TEST_RATE * 12 + 5);
+    WildMidi_Close(song);
+
+    /* the checkpoints a fast seek leaves get their notes by playing */
+    song = WildMidi_OpenBuffer(midi_data, midi_size);
+    CHECK(song != NULL);
+    if (song == NULL) return;
+    seek_pos = (unsigned long) (ref_size / 4) - 1;
+    CHECK(WildMidi_FastSeek(song, &seek_pos) == 0);
+    check_slow_seek(song, 0);
+    check_slow_seek(song, TEST_RATE * 11 + 99);
+    WildMidi_Close(song);
+}
+
+/*
+ * WildMidi_TickToSample() and WildMidi_SampleToTick() undo each other,
+ * the ticks in the test file all being longer than a sample.
+ */
+static void check_ticks(void) {
+    unsigned long tick, next_tick;
+    unsigned long sample, next_sample;
+    unsigned long last = 0;
+    midi *song;
+
+    song = WildMidi_OpenBuffer(midi_data, midi_size);
+    CHECK(song != NULL);
+    if (song == NULL) return;
+    for (tick = 0; tick < 20000; tick += 7) {
+        CHECK(WildMidi_TickToSample(song, tick, &sample) == 0);
+        CHECK(WildMidi_SampleToTick(song, sample, &next_tick) == 0);
+        CHECK(next_tick == tick);
+        CHECK((tick == 0) || (sample > last));
+        last = sample;
+    }
+    for (sample = 0; sample < (unsigned long) (ref_size / 4); sample += 997) {
+        CHECK(WildMidi_SampleToTick(song, sample, &tick) == 0);
+        CHECK(WildMidi_TickToSample(song, tick, &last) == 0);
+        CHECK(WildMidi_TickToSample(song, tick + 1, &next_sample) == 0);
+        CHECK((last <= sample) && (sample < next_sample));
+    }
+    WildMidi_Close(song);
+}
+
+/*
+ * WM_MO_HALF_RATE, played in pieces of an odd number of frames: what
+ * comes out has to be the same however it is asked for, and has to
+ * include the frames the upsampler holds back at the end.
+ */
+static void check_half_rate(void) {
+    static const uint32_t sizes[4] = { 4, 12, 4 * 37, 4 * 1001 };
+    struct _WM_Info *info;
+    long half_size;
+    long done = 0;
+    uint32_t size;
+    midi *song;
+    int ret;
+    int i = 0;
+
+    song = WildMidi_OpenBuffer(midi_data, midi_size);
+    CHECK(song != NULL);
+    if (song == NULL) return;
+    info = WildMidi_GetInfo(song);
+    CHECK(info != NULL);
+    half_size = render(song, out_ref, SONG_MAX, 16384);
+    if (info != NULL) {
+        CHECK(half_size == (long) ((info->approx_total_samples + 30) * 4));
+    }
+    WildMidi_Close(song);
+
+    song = WildMidi_OpenBuffer(midi_data, midi_size);
+    CHECK(song != NULL);
+    if (song == NULL) return;
+    while (done < SONG_MAX) {
+        size = sizes[i++ & 3];
+        if ((long) size > SONG_MAX - done) size = (uint32_t) (SONG_MAX - done);
+        ret = WildMidi_GetOutput(song, &out_test[done], size);
+        CHECK(ret >= 0);
+        if (ret <= 0) break;
+        CHECK((ret & 3) == 0);
+        done += ret;
+    }
+    CHECK(done == half_size);
+    CHECK(memcmp(out_ref, out_test, half_size) == 0);
+    WildMidi_Close(song);
+}
+
+/* WM_MO_INCREMENTAL, played while the parse thread goes along */
+static void check_incremental(void) {
+    midi *song;
+
+    song = WildMidi_OpenBuffer(midi_data, midi_size);
+    CHECK(song != NULL);
+    if (song == NULL) return;
+    CHECK(WildMidi_GetInfo(song)->approx_total_samples == 0);
+    CHECK(render(song, out_test, SONG_MAX, 4000) == ref_size);
+    CHECK(memcmp(out_ref, out_test, ref_size) == 0);
+    WildMidi_Close(song);
+
+    /* closed with the parse thread still going */
+    song = WildMidi_OpenBuffer(midi_data, midi_size);
+    CHECK(song != NULL);
+    if (song == NULL) return;
+    CHECK(render(song, out_test, TEST_RATE * 4 * 2, 4000) == TEST_RATE * 4 * 2);
+    CHECK(WildMidi_Close(song) == 0);
+}
+
+static int run_checks(void) {
+    if ((write_patch(TEST_PAT) != 0) || (write_config(TEST_CFG) != 0)) {
+        fprintf(stderr, "can't write test files\n");
+        return (1);
+    }
+    midi_data = make_midi(&midi_size);
+    out_ref = (int8_t *) malloc(SONG_MAX);
+    out_test = (int8_t *) malloc(SONG_MAX);
+    if ((out_ref == NULL) || (out_test == NULL)
+            || (write_midi(TEST_MID, midi_data, midi_size) != 0)) {
+        fprintf(stderr, "can't write test files\n");
+        return (1);
+    }
+
+    if (WildMidi_Init(TEST_CFG, TEST_RATE, 0) != 0) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        return (1);
+    }
+    check_async();
+    check_slowseek();
+    check_ticks();
+    WildMidi_Shutdown();
+
+    if (WildMidi_Init(TEST_CFG, TEST_RATE, WM_MO_INCREMENTAL) != 0) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        return (1);
+    }
+    check_incremental();
+    check_ticks();
+    WildMidi_Shutdown();
+
+    if (WildMidi_Init(TEST_CFG, TEST_RATE, WM_MO_HALF_RATE) != 0) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        return (1);
+    }
+    check_half_rate();
+    WildMidi_Shutdown();
+
+    free(out_test);
+    free(out_ref);
+    free(midi_data);
+    remove(TEST_MID);
+    remove(TEST_CFG);
+    remove(TEST_PAT);
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return (1);
+    }
+    return (0);
+}
+
 int main (int argc, char **argv) {
+    midi *song;
+
+    if (argc == 1) return (run_checks());
     if (argc != 2) return 1;
     if (WildMidi_Init("wildmidi.cfg", 44100, 0) != 0) return 1;
     song = WildMidi_Open (argv[1]);